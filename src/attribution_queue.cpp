@@ -0,0 +1,149 @@
+#include "attribution_queue.h"
+
+namespace
+{
+    // How long to wait between retries while packets are pending
+    const auto retryInterval{std::chrono::milliseconds{25}};
+}
+
+std::string AttributionQueue::Stats::toString() const
+{
+    return fmt::format("attribution queue: {} deferred, {} recovered, {} unresolved ({} dropped), {} pending",
+        deferred, recovered, unresolved, dropped, pending);
+}
+
+AttributionQueue::AttributionQueue(SocketOwners &socketOwners, ResolvedCallbackT resolvedFunc,
+    std::chrono::milliseconds deadline, std::size_t capacity)
+: _socketOwners{socketOwners}
+, _resolvedFunc{std::move(resolvedFunc)}
+, _deadline{deadline}
+, _capacity{std::max<std::size_t>(capacity, 1)}
+{
+    _retryThread = std::thread{[this] { retryLoop(); }};
+}
+
+AttributionQueue::~AttributionQueue()
+{
+    {
+        std::lock_guard lock{_mutex};
+        _stop = true;
+    }
+    _condition.notify_all();
+    _retryThread.join();
+}
+
+void AttributionQueue::defer(const PacketView &packet, const SocketOwners::Endpoint &endpoint)
+{
+    std::optional<Entry> overflow;
+
+    {
+        std::lock_guard lock{_mutex};
+        // Make room by giving up on the oldest packet
+        if(_entries.size() >= _capacity)
+        {
+            overflow.emplace(std::move(_entries.front()));
+            _entries.pop_front();
+        }
+
+        _entries.push_back({PacketRecord{packet}, endpoint, SocketOwners::Clock::now() + _deadline});
+    }
+    ++_deferred;
+    _condition.notify_one();
+
+    if(overflow)
+    {
+        ++_dropped;
+        ++_unresolved;
+        _resolvedFunc(overflow->packet, overflow->endpoint, 0);
+    }
+}
+
+AttributionQueue::Stats AttributionQueue::stats() const
+{
+    Stats stats;
+    stats.deferred = _deferred;
+    stats.recovered = _recovered;
+    stats.unresolved = _unresolved;
+    stats.dropped = _dropped;
+
+    std::lock_guard lock{_mutex};
+    stats.pending = _entries.size();
+
+    return stats;
+}
+
+void AttributionQueue::retryLoop()
+{
+    std::unique_lock lock{_mutex};
+    while(true)
+    {
+        _condition.wait(lock, [this] { return _stop || !_entries.empty(); });
+        if(_stop)
+            return;
+
+        lock.unlock();
+        const bool pending = retry();
+        lock.lock();
+
+        // Give the owner a little time to show up before trying again
+        if(pending && _condition.wait_for(lock, retryInterval, [this] { return _stop; }))
+            return;
+    }
+}
+
+bool AttributionQueue::retry()
+{
+    // The packets' sockets may well be gone by the next periodic refresh
+    _socketOwners.refreshNow();
+
+    std::deque<Entry> entries;
+    {
+        std::lock_guard lock{_mutex};
+        entries.swap(_entries);
+    }
+
+    const auto now{SocketOwners::Clock::now()};
+    std::deque<Entry> stillPending;
+    for(auto &entry : entries)
+    {
+        const auto &packet{entry.packet};
+        if(const auto pid = _socketOwners.find(entry.endpoint))
+        {
+            ++_recovered;
+            _resolvedFunc(packet, entry.endpoint, *pid);
+        }
+        else if(now >= entry.deadline)
+        {
+            ++_unresolved;
+            _resolvedFunc(packet, entry.endpoint, 0);
+        }
+        else
+            stillPending.push_back(std::move(entry));
+    }
+
+    // Anything deferred while we were busy is newer than what's still pending. Those
+    // may have filled the queue, in which case the oldest are given up on, as in defer().
+    std::vector<Entry> overflow;
+    bool pending{};
+    {
+        std::lock_guard lock{_mutex};
+        for(auto it = stillPending.rbegin(); it != stillPending.rend(); ++it)
+            _entries.push_front(std::move(*it));
+
+        while(_entries.size() > _capacity)
+        {
+            overflow.push_back(std::move(_entries.front()));
+            _entries.pop_front();
+        }
+        pending = !_entries.empty();
+    }
+
+    for(const auto &entry : overflow)
+    {
+        ++_dropped;
+        ++_unresolved;
+        _resolvedFunc(entry.packet, entry.endpoint, 0);
+    }
+
+    return pending;
+}
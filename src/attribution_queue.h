@@ -0,0 +1,83 @@
+#pragma once
+
+#include "common.h"
+#include "packet.h"
+#include "socket_owners.h"
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+// Packets whose local endpoint had no known owner when they were captured - typically
+// from short-lived sockets opened since the socket owners were last refreshed.
+//
+// Rather than being shown unattributed straight away, such packets are parked here
+// (oldest first) while a background thread refreshes the socket owners and retries them.
+// Each packet is handed back exactly once: with its owner as soon as one is found,
+// or with pid 0 (unresolved) once its deadline passes or the queue overflows.
+class AttributionQueue
+{
+public:
+    // Invoked (on the retry thread) with the packet, its local endpoint and its owner,
+    // or 0 if it was never found
+    using ResolvedCallbackT = std::function<void(const PacketRecord &packet, const SocketOwners::Endpoint &endpoint, pid_t pid)>;
+
+    struct Stats
+    {
+        std::uint64_t deferred{};
+        std::uint64_t recovered{};
+        std::uint64_t unresolved{};
+        // Unresolved because the queue was full
+        std::uint64_t dropped{};
+        std::uint64_t pending{};
+
+        std::string toString() const;
+    };
+
+public:
+    AttributionQueue(SocketOwners &socketOwners, ResolvedCallbackT resolvedFunc,
+        std::chrono::milliseconds deadline = std::chrono::milliseconds{500},
+        std::size_t capacity = 4096);
+    ~AttributionQueue();
+
+    AttributionQueue(const AttributionQueue&) = delete;
+    AttributionQueue& operator=(const AttributionQueue&) = delete;
+
+public:
+    // endpoint: the packet's local end, which is retried against the index
+    void defer(const PacketView &packet, const SocketOwners::Endpoint &endpoint);
+    Stats stats() const;
+
+private:
+    struct Entry
+    {
+        PacketRecord packet;
+        SocketOwners::Endpoint endpoint;
+        SocketOwners::Clock::time_point deadline;
+    };
+
+private:
+    void retryLoop();
+    // Retry every pending packet once, returns whether any are still pending
+    bool retry();
+
+private:
+    SocketOwners &_socketOwners;
+    const ResolvedCallbackT _resolvedFunc;
+    const std::chrono::milliseconds _deadline;
+    const std::size_t _capacity;
+
+    mutable std::mutex _mutex;
+    std::condition_variable _condition;
+    std::deque<Entry> _entries;
+    bool _stop{false};
+
+    std::atomic<std::uint64_t> _deferred{};
+    std::atomic<std::uint64_t> _recovered{};
+    std::atomic<std::uint64_t> _unresolved{};
+    std::atomic<std::uint64_t> _dropped{};
+
+    std::thread _retryThread;
+};
@@ -1,26 +1,13 @@
 #pragma once
 #include "util.h"
-#include <bsm/libbsm.h>
-#include <bsm/audit.h>
-#include <security/audit/audit_ioctl.h>
-#include <bsm/audit_kevents.h>
+#include "fd.h"
+#include "bsm_reader.h"
 
+// Live process events from the macOS audit pipe
 class AuditPipe
 {
 public:
-    struct ProcessEvent
-    {
-        enum Mode {Unknown, Starting, Exiting};
-        Mode mode{Mode::Unknown};
-
-        uint16_t type{};
-        pid_t pid{};
-        pid_t ppid{};
-        uid_t uid{};
-        uint32_t exitStatus{};
-        std::string path;
-        std::vector<std::string> arguments;
-    };
+    using ProcessEvent = BsmReader::ProcessEvent;
 
 private:
     using ProcCallbackT = std::function<void(const ProcessEvent&)>;
@@ -29,16 +16,12 @@ public:
     AuditPipe();
 
 public:
-    void onProcessStarted(ProcCallbackT proc) { _procStartedFunc = std::move(proc); }
-    void onProcessExited(ProcCallbackT proc) { _procExitedFunc = std::move(proc); }
-    void receive() const;
-
-private:
-    void processToken(const tokenstr_t &token, ProcessEvent &process, ProcessEvent &lastFork) const;
+    void onProcessStarted(ProcCallbackT proc) { _reader.onProcessStarted(std::move(proc)); }
+    void onProcessExited(ProcCallbackT proc) { _reader.onProcessExited(std::move(proc)); }
+    void receive() { _reader.receive(); }
 
 private:
-    AutoCloseFile _auditFile;
-    ProcCallbackT _procStartedFunc=[](auto&){};
-    ProcCallbackT _procExitedFunc=[](auto&){};
+    Fd _auditFd;
+    BsmReader _reader;
 };
 
@@ -3,15 +3,14 @@
 #include "util.h"
 #include "fd.h"
 #include "packet.h"
+#include "capture_device.h"
 #include <net/bpf.h>
 #include <netinet/if_ether.h>
 
-class BpfDevice
+class BpfDevice : public CaptureDevice
 {
     enum : size_t { MaxBpfNumber = 99 };
 
-    using PktCallbackT = std::function<void(const PacketView&)>;
-
    struct InterfaceConfig
    {
        Fd fd;
@@ -25,11 +24,9 @@ private:
     InterfaceConfig findAndConfigureInterface(const std::string &interfaceName) const;
 
 public:
-     void onPacketReceived(PktCallbackT proc) { _packetReceivedFunc = std::move(proc); }
-     void receive() const;
+     virtual void receive() const override;
 
 private:
     Fd _fd;
     std::uint32_t _bufferLength;
-    PktCallbackT _packetReceivedFunc=[](auto&){};
 };
@@ -0,0 +1,343 @@
+#include "bsm_reader.h"
+#include "proc.h"
+#include "process_cache.h"
+#include <bsm/audit_kevents.h>
+#include <cstring>
+
+namespace
+{
+    // Records are pulled in chunks this big - the audit pipe hands over as many
+    // as fit, a trail file is simply read sequentially
+    const std::size_t chunkSize{1024 * 1024};
+    // The token id and record size that start every record
+    const std::size_t headerPrefixSize{5};
+    // The file token at the start and end of a trail: id, seconds, milliseconds,
+    // then the name's length and the name itself
+    const std::size_t fileTokenPrefixSize{11};
+    // The records for a single exec are written within this long of each other
+    const std::uint64_t duplicateWindowMs{500};
+
+    std::uint32_t readBigEndian32(const std::uint8_t *pBytes)
+    {
+        return (static_cast<std::uint32_t>(pBytes[0]) << 24) | (static_cast<std::uint32_t>(pBytes[1]) << 16) |
+            (static_cast<std::uint32_t>(pBytes[2]) << 8) | pBytes[3];
+    }
+
+    std::uint16_t readBigEndian16(const std::uint8_t *pBytes)
+    {
+        return static_cast<std::uint16_t>((pBytes[0] << 8) | pBytes[1]);
+    }
+
+    bool shouldProcessRecord(uint16_t eventType)
+    {
+        return eventType == AUE_EXEC || eventType == AUE_EXIT || eventType == AUE_FORK ||
+            eventType == AUE_EXECVE || eventType == AUE_POSIX_SPAWN;
+    }
+
+    // The size of the record (or trail file token) at the start of data, 0 if
+    // not enough of it is there yet to tell
+    std::size_t recordSize(std::span<const std::uint8_t> data)
+    {
+        switch(data[0])
+        {
+        case AUT_HEADER32:
+        case AUT_HEADER32_EX:
+        case AUT_HEADER64:
+        case AUT_HEADER64_EX:
+        {
+            if(data.size() < headerPrefixSize)
+                return 0;
+
+            const std::size_t size = readBigEndian32(&data[1]);
+            if(size <= headerPrefixSize)
+                throw std::runtime_error{fmt::format("Invalid audit record size {}", size)};
+            return size;
+        }
+        case AUT_OTHER_FILE32:
+            return data.size() < fileTokenPrefixSize ? 0 : fileTokenPrefixSize + readBigEndian16(&data[9]);
+        default:
+            throw std::runtime_error{fmt::format("Invalid audit record, starting with token {:#x}", data[0])};
+        }
+    }
+}
+
+std::string BsmReader::Stats::toString() const
+{
+    return fmt::format("audit records: {} bytes, {} records, {} events, {} duplicates", bytes, records, events, duplicates);
+}
+
+BsmReader::BsmReader(int fd, Source source)
+: _fd{fd}
+, _source{source}
+, _buffer(chunkSize)
+{
+}
+
+void BsmReader::receive()
+{
+    // The bytes at the front of _buffer that haven't been parsed yet
+    std::size_t filled{0};
+
+    while(true)
+    {
+        const auto length = ::read(_fd, _buffer.data() + filled, _buffer.size() - filled);
+        if(length < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            throw SystemError("Could not read audit records");
+        }
+
+        if(length == 0)
+        {
+            if(filled)
+                std::cerr << "Ignoring a truncated audit record at the end of the trail" << std::endl;
+            return;
+        }
+
+        filled += static_cast<std::size_t>(length);
+        _stats.bytes += static_cast<std::size_t>(length);
+
+        std::size_t neededSize{0};
+        const auto consumed = parseRecords({_buffer.data(), filled}, neededSize);
+
+        // Keep the start of an incomplete record for the next read, making sure
+        // there's room for the rest of it
+        std::memmove(_buffer.data(), _buffer.data() + consumed, filled - consumed);
+        filled -= consumed;
+        if(neededSize > _buffer.size())
+            _buffer.resize(neededSize);
+    }
+}
+
+std::size_t BsmReader::parseRecords(std::span<std::uint8_t> data, std::size_t &neededSize)
+{
+    std::size_t offset{0};
+    while(offset < data.size())
+    {
+        const auto remaining = data.subspan(offset);
+        const auto size = recordSize(remaining);
+        if(!size || size > remaining.size())
+        {
+            neededSize = size;
+            break;
+        }
+
+        parseRecord(remaining.first(size));
+        offset += size;
+    }
+
+    return offset;
+}
+
+void BsmReader::parseRecord(std::span<std::uint8_t> record)
+{
+    ++_stats.records;
+    _event = {};
+    _arguments.clear();
+
+    for(std::size_t offset = 0; offset < record.size();)
+    {
+        // Tokens are parsed in place, their strings pointing into the record
+        tokenstr_t token{};
+        if(au_fetch_tok(&token, record.data() + offset, static_cast<int>(record.size() - offset)) == -1 || !token.len)
+            break;
+
+        processToken(token);
+        offset += token.len;
+    }
+}
+
+void BsmReader::processToken(const tokenstr_t &token)
+{
+    const bool live = _source == Source::Live;
+
+    switch(token.id)
+    {
+    // Determine process type from header
+    case AUT_HEADER32:
+    case AUT_HEADER32_EX:
+    case AUT_HEADER64:
+    case AUT_HEADER64_EX:
+    {
+        _event.type = token.tt.hdr32.e_type;
+
+        // The extended and 64-bit headers put the time in different places
+        if(AUT_HEADER32 == token.id)
+            _recordTime = std::uint64_t{token.tt.hdr32.s} * 1000 + token.tt.hdr32.ms;
+        else if(AUT_HEADER32_EX == token.id)
+            _recordTime = std::uint64_t{token.tt.hdr32_ex.s} * 1000 + token.tt.hdr32_ex.ms;
+        else if(AUT_HEADER64 == token.id)
+            _recordTime = token.tt.hdr64.s * 1000 + token.tt.hdr64.ms;
+        else
+            _recordTime = token.tt.hdr64_ex.s * 1000 + token.tt.hdr64_ex.ms;
+        break;
+    }
+
+    // Save the path of the process
+    case AUT_PATH:
+    {
+        _event.path = token.tt.path.path;
+        break;
+    }
+
+    // Get pid and ppid
+    case AUT_SUBJECT32:
+    case AUT_SUBJECT32_EX:
+    case AUT_SUBJECT64:
+    case AUT_SUBJECT64_EX:
+    {
+        if(AUE_POSIX_SPAWN == _event.type)
+        {
+            if(_event.pid == 0)
+            {
+                _event.pid = token.tt.subj32.pid;
+                _event.ppid = live ? ProcessCache::shared().ppid(_event.pid) : 0;
+            }
+            else
+            {
+                _event.ppid = token.tt.subj32.pid;
+            }
+        }
+        else if(AUE_FORK == _event.type)
+        {
+            _event.ppid = token.tt.subj32.pid;
+        }
+        else
+        {
+            _event.pid = token.tt.subj32.pid;
+            _event.ppid = live ? ProcessCache::shared().ppid(_event.pid) : 0;
+        }
+
+        _event.uid = token.tt.subj32.euid;
+        break;
+    }
+
+    // Get pid
+    case AUT_ARG32:
+    case AUT_ARG64:
+    {
+        if(AUE_POSIX_SPAWN == _event.type || AUE_FORK == _event.type)
+        {
+            if(AUT_ARG32 == token.id)
+                _event.pid = token.tt.arg32.val;
+            else
+                _event.pid = static_cast<pid_t>(token.tt.arg64.val);
+        }
+        break;
+    }
+
+    // Store args
+    case AUT_EXEC_ARGS:
+    {
+        for(std::size_t i = 0; i < token.tt.execarg.count; ++i)
+        {
+            if(const char *argument = token.tt.execarg.text[i])
+                _arguments.emplace_back(argument);
+        }
+        break;
+    }
+
+    // Exit status
+    case AUT_EXIT:
+    {
+        _event.exitStatus = token.tt.exit.status;
+        break;
+    }
+
+    // Trailer (parsing is complete)
+    case AUT_TRAILER:
+    {
+        finishRecord();
+        break;
+    }
+    default: // No-op
+    ;
+    }
+}
+
+void BsmReader::finishRecord()
+{
+    if(!shouldProcessRecord(_event.type))
+        return;
+
+    const bool live = _source == Source::Live;
+    _event.arguments = _arguments;
+    _event.timeUs = _recordTime * 1000;
+
+    // Exit records carry no arguments
+    if(AUE_EXIT == _event.type)
+    {
+        _event.mode = ProcessEvent::Exiting;
+        ++_stats.events;
+        _procExitedFunc(_event);
+        if(live)
+            ProcessCache::shared().exited(_event.pid);
+        return;
+    }
+
+    // A fork has nothing to report, but its child's exec will want the parent
+    if(AUE_FORK == _event.type)
+    {
+        _lastForkPid = _event.pid;
+        _lastForkPpid = _event.ppid;
+        if(live)
+            ProcessCache::shared().forked(_event.pid, _event.ppid);
+        return;
+    }
+
+    if(_lastForkPid == _event.pid)
+        _event.ppid = _lastForkPpid;
+
+    // The path token may be a script rather than the binary running it
+    if(live)
+    {
+        Proc::pidToPath(_event.pid, _path);
+        _event.path = _path;
+    }
+
+    if((_event.path.empty() || _event.path.starts_with("/dev/")) && !_arguments.empty())
+        _event.path = _arguments.front();
+
+    if(live)
+    {
+        auto &cache = ProcessCache::shared();
+        if(AUE_POSIX_SPAWN == _event.type)
+            cache.forked(_event.pid, _event.ppid);
+        cache.executed(_event.pid, _event.path, _arguments.empty() ? std::string_view{} : _arguments.front(), _event.uid);
+    }
+
+    _event.mode = ProcessEvent::Starting;
+
+    // Only starts with arguments are passed on
+    if(_arguments.empty())
+        return;
+
+    if(isDuplicate())
+    {
+        ++_stats.duplicates;
+        return;
+    }
+
+    ++_stats.events;
+    _procStartedFunc(_event);
+}
+
+bool BsmReader::isDuplicate()
+{
+    std::size_t hash = std::hash<std::string_view>{}(_event.path);
+    for(const auto &argument : _arguments)
+        hash = (hash ^ std::hash<std::string_view>{}(argument)) * 0x9e3779b97f4a7c15ULL;
+
+    for(const auto &recent : _recentExecs)
+    {
+        // Records can be slightly out of order, so the window works both ways
+        const auto age = _recordTime > recent.time ? _recordTime - recent.time : recent.time - _recordTime;
+        if(recent.pid == _event.pid && recent.hash == hash && age <= duplicateWindowMs)
+            return true;
+    }
+
+    _recentExecs[_nextRecentExec] = {_event.pid, hash, _recordTime};
+    _nextRecentExec = (_nextRecentExec + 1) % _recentExecs.size();
+    return false;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "util.h"
+#include <bsm/libbsm.h>
+
+// Process events from BSM audit records - read live from the audit pipe, or
+// replayed from an audit trail file.
+//
+// Records are read in large chunks and their tokens parsed in place: an event's
+// path and arguments are views into the read buffer rather than copies, so once
+// the buffers have grown to size nothing is allocated per event. The views are
+// only valid for the duration of the callback.
+//
+// One exec can produce several records (e.g posix_spawn followed by execve), so an
+// exec of the same path and arguments by the same pid within a short window of
+// the last is only passed on once.
+class BsmReader
+{
+public:
+    struct ProcessEvent
+    {
+        enum Mode {Unknown, Starting, Exiting};
+        Mode mode{Mode::Unknown};
+
+        uint16_t type{};
+        pid_t pid{};
+        pid_t ppid{};
+        uid_t uid{};
+        uint32_t exitStatus{};
+        // Microseconds since the epoch, from the record
+        std::uint64_t timeUs{};
+        std::string_view path;
+        std::span<const std::string_view> arguments;
+    };
+
+    enum class Source
+    {
+        // The records are happening now, so paths and parents can be looked up
+        // from the running processes
+        Live,
+        // The records are history, everything has to come from the records themselves
+        Trail
+    };
+
+    struct Stats
+    {
+        std::uint64_t bytes{};
+        std::uint64_t records{};
+        std::uint64_t events{};
+        // Execs already reported by an earlier record
+        std::uint64_t duplicates{};
+
+        std::string toString() const;
+    };
+
+private:
+    using ProcCallbackT = std::function<void(const ProcessEvent&)>;
+
+public:
+    BsmReader(int fd, Source source);
+
+public:
+    void onProcessStarted(ProcCallbackT proc) { _procStartedFunc = std::move(proc); }
+    void onProcessExited(ProcCallbackT proc) { _procExitedFunc = std::move(proc); }
+    // Read and dispatch records until the end of the file (a trail never
+    // ends for the audit pipe)
+    void receive();
+
+    const Stats &stats() const {return _stats;}
+
+private:
+    // Parse the complete records at the start of data, returning the number of
+    // bytes they took up. neededSize is set to the size of the incomplete record
+    // that follows them, if its header says.
+    std::size_t parseRecords(std::span<std::uint8_t> data, std::size_t &neededSize);
+    void parseRecord(std::span<std::uint8_t> record);
+    void processToken(const tokenstr_t &token);
+    // The trailer has been reached, complete the event
+    void finishRecord();
+    // Was the same exec passed on within the window? (remembering it if not)
+    bool isDuplicate();
+
+private:
+    const int _fd;
+    const Source _source;
+    std::vector<std::uint8_t> _buffer;
+
+    // The record being parsed
+    ProcessEvent _event;
+    std::vector<std::string_view> _arguments;
+    // Backs _event.path when it's looked up rather than in the record
+    std::string _path;
+
+    // The last fork seen, to give the child's exec its real parent
+    pid_t _lastForkPid{};
+    pid_t _lastForkPpid{};
+
+    struct RecentExec
+    {
+        pid_t pid{};
+        // Of the path and arguments
+        std::size_t hash{};
+        // Milliseconds since the epoch, from the record header
+        std::uint64_t time{};
+    };
+
+    // The record's time, in milliseconds since the epoch
+    std::uint64_t _recordTime{};
+    // The execs most recently passed on, oldest overwritten first
+    std::array<RecentExec, 16> _recentExecs{};
+    std::size_t _nextRecentExec{};
+
+    Stats _stats;
+    ProcCallbackT _procStartedFunc=[](auto&){};
+    ProcCallbackT _procExitedFunc=[](auto&){};
+};
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "util.h"
+#include "packet.h"
+
+// A source of captured packets - BpfDevice on macOS, PacketSocket on Linux
+class CaptureDevice
+{
+protected:
+    using PktCallbackT = std::function<void(const PacketView&)>;
+
+public:
+    virtual ~CaptureDevice() = default;
+
+public:
+    void onPacketReceived(PktCallbackT proc) { _packetReceivedFunc = std::move(proc); }
+    // Capture packets forever
+    virtual void receive() const = 0;
+
+protected:
+    PktCallbackT _packetReceivedFunc=[](auto&){};
+};
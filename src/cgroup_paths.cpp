@@ -0,0 +1,126 @@
+#include "cgroup_paths.h"
+#include "ebpf.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <climits>
+#include <cstring>
+
+namespace fs = std::filesystem;
+namespace
+{
+    // Without file handles, the hierarchy is walked at most this often
+    const auto rescanInterval{std::chrono::seconds{10}};
+    const std::string noPath;
+
+    // A file_handle with room for the handle itself
+    struct Handle
+    {
+        file_handle header;
+        std::uint8_t bytes[MAX_HANDLE_SZ];
+    };
+}
+
+CgroupPaths::CgroupPaths()
+: _root{Ebpf::cgroup2Root()}
+, _rootFd{::open(_root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)}
+{
+    if(!_rootFd)
+        throw SystemError("Could not open the cgroup v2 root");
+
+    // The root's own handle tells us the type, and that handles are the 8 byte id
+    Handle handle{};
+    handle.header.handle_bytes = MAX_HANDLE_SZ;
+    int mountId{};
+    if(::name_to_handle_at(_rootFd.get(), "", &handle.header, &mountId, AT_EMPTY_PATH) == 0 &&
+        handle.header.handle_bytes == sizeof(std::uint64_t))
+    {
+        _handleType = handle.header.handle_type;
+    }
+}
+
+const std::string &CgroupPaths::path(std::uint64_t cgroupId)
+{
+    auto it = _paths.find(cgroupId);
+    if(it == _paths.end())
+    {
+        if(_handleType)
+        {
+            it = _paths.emplace(cgroupId, resolve(cgroupId)).first;
+        }
+        else
+        {
+            // New cgroups come and go all the time (e.g a systemd scope per session)
+            if(std::chrono::steady_clock::now() - _lastScan >= rescanInterval)
+                scanCgroups();
+            it = _paths.try_emplace(cgroupId).first;
+        }
+    }
+
+    return it->second ? *it->second : noPath;
+}
+
+bool CgroupPaths::exists(std::uint64_t cgroupId)
+{
+    if(_handleType)
+        return resolve(cgroupId).has_value();
+
+    // The cgroup's directory has to still be there, and still be the same one
+    const auto &cgroupPath = path(cgroupId);
+    struct stat info{};
+    return !cgroupPath.empty() && ::stat((_root + cgroupPath).c_str(), &info) == 0 && info.st_ino == cgroupId;
+}
+
+std::optional<std::string> CgroupPaths::resolve(std::uint64_t cgroupId) const
+{
+    Handle handle{};
+    handle.header.handle_bytes = sizeof(cgroupId);
+    handle.header.handle_type = *_handleType;
+    std::memcpy(handle.header.f_handle, &cgroupId, sizeof(cgroupId));
+
+    Fd cgroupFd{::open_by_handle_at(_rootFd.get(), &handle.header, O_PATH | O_CLOEXEC)};
+    if(!cgroupFd)
+        return {};
+
+    char link[32]{};
+    ::snprintf(link, sizeof(link), "/proc/self/fd/%d", cgroupFd.get());
+    char fullPath[PATH_MAX];
+    const auto length = ::readlink(link, fullPath, sizeof(fullPath));
+    if(length <= 0)
+        return {};
+
+    const std::string_view absolute{fullPath, static_cast<std::size_t>(length)};
+    if(!absolute.starts_with(_root))
+        return {};
+
+    const auto relative = absolute.substr(_root.size());
+    return relative.empty() ? std::string{"/"} : std::string{relative};
+}
+
+void CgroupPaths::scanCgroups()
+{
+    _lastScan = std::chrono::steady_clock::now();
+
+    // A cgroup's id is the inode number of its directory
+    auto addPath = [&](const fs::path &path)
+    {
+        struct stat info{};
+        if(::stat(path.c_str(), &info) == 0)
+        {
+            const auto relative = path.lexically_relative(_root).string();
+            _paths[info.st_ino] = "/" + (relative == "." ? std::string{} : relative);
+        }
+    };
+
+    addPath(_root);
+
+    std::error_code error;
+    for(auto it = fs::recursive_directory_iterator{_root, fs::directory_options::skip_permission_denied, error};
+        it != fs::recursive_directory_iterator{}; it.increment(error))
+    {
+        if(error)
+            break;
+
+        if(it->is_directory(error))
+            addPath(it->path());
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "common.h"
+#include "fd.h"
+#include <chrono>
+#include <unordered_map>
+
+// cgroup v2 ids (as the BPF helpers report them) -> paths relative to the cgroup
+// v2 root. A cgroup's id is the inode number of its directory, and the cgroup
+// filesystem's file handles are just that id, so a path is resolved with a
+// single open_by_handle_at() rather than walking the hierarchy. Kernels without
+// those handles fall back to an (occasional) walk.
+//
+// Results are cached, including misses: cgroup ids are never reused, so a
+// cgroup that's gone stays gone. Not thread safe.
+class CgroupPaths
+{
+public:
+    CgroupPaths();
+
+public:
+    // Empty if the cgroup doesn't exist (any more)
+    const std::string &path(std::uint64_t cgroupId);
+    // Does the cgroup still exist? Always asks the kernel.
+    bool exists(std::uint64_t cgroupId);
+    // Drop the cached result, e.g once the cgroup is gone
+    void forget(std::uint64_t cgroupId) {_paths.erase(cgroupId);}
+
+private:
+    std::optional<std::string> resolve(std::uint64_t cgroupId) const;
+    // The fallback: add every cgroup in the hierarchy to _paths
+    void scanCgroups();
+
+private:
+    const std::string _root;
+    Fd _rootFd;
+    // The cgroup filesystem's file handle type, if it has usable handles
+    std::optional<int> _handleType;
+    std::chrono::steady_clock::time_point _lastScan{};
+    // Nothing for a cgroup that doesn't exist
+    std::unordered_map<std::uint64_t, std::optional<std::string>> _paths;
+};
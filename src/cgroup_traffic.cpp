@@ -0,0 +1,123 @@
+#include "cgroup_traffic.h"
+#include <fcntl.h>
+
+namespace
+{
+    const std::uint32_t maxCgroups{16 * 1024};
+
+    // Stack (r10 relative) offsets used by the program
+    const std::int16_t cgroupIdOffset{-8};
+    const std::int16_t zeroCountersOffset{-40};
+
+    // Count a packet against its cgroup's counters for this CPU. The counters are
+    // per-CPU, so they can be updated without atomics.
+    std::vector<bpf_insn> counterProgram(const Ebpf::Map &counters, bool egress)
+    {
+        const std::int16_t bytesOffset = egress ? offsetof(CgroupTraffic::Counters, txBytes) : offsetof(CgroupTraffic::Counters, rxBytes);
+        const std::int16_t packetsOffset = egress ? offsetof(CgroupTraffic::Counters, txPackets) : offsetof(CgroupTraffic::Counters, rxPackets);
+
+        auto emitLookup = [&](Ebpf::Assembler &as)
+        {
+            as.loadMap(BPF_REG_1, counters);
+            as.mov(BPF_REG_2, BPF_REG_10);
+            as.addImm(BPF_REG_2, cgroupIdOffset);
+            as.call(BPF_FUNC_map_lookup_elem);
+        };
+
+        Ebpf::Assembler as;
+        as.mov(BPF_REG_6, BPF_REG_1);
+
+        as.mov(BPF_REG_1, BPF_REG_6);
+        as.call(BPF_FUNC_skb_cgroup_id);
+        as.store(BPF_DW, BPF_REG_10, cgroupIdOffset, BPF_REG_0);
+
+        emitLookup(as);
+        as.jumpIfImm(BPF_JNE, BPF_REG_0, 0, "count");
+
+        // The cgroup's first packet (on this CPU): insert zeroed counters
+        for(std::int16_t offset = 0; offset < static_cast<std::int16_t>(sizeof(CgroupTraffic::Counters)); offset += 8)
+            as.storeImm(BPF_DW, BPF_REG_10, zeroCountersOffset + offset, 0);
+        as.loadMap(BPF_REG_1, counters);
+        as.mov(BPF_REG_2, BPF_REG_10);
+        as.addImm(BPF_REG_2, cgroupIdOffset);
+        as.mov(BPF_REG_3, BPF_REG_10);
+        as.addImm(BPF_REG_3, zeroCountersOffset);
+        as.movImm(BPF_REG_4, BPF_NOEXIST);
+        as.call(BPF_FUNC_map_update_elem);
+
+        emitLookup(as);
+        as.jumpIfImm(BPF_JEQ, BPF_REG_0, 0, "out");
+
+        as.label("count");
+        as.load(BPF_W, BPF_REG_1, BPF_REG_6, offsetof(__sk_buff, len));
+        as.load(BPF_DW, BPF_REG_2, BPF_REG_0, bytesOffset);
+        as.add(BPF_REG_2, BPF_REG_1);
+        as.store(BPF_DW, BPF_REG_0, bytesOffset, BPF_REG_2);
+        as.load(BPF_DW, BPF_REG_2, BPF_REG_0, packetsOffset);
+        as.addImm(BPF_REG_2, 1);
+        as.store(BPF_DW, BPF_REG_0, packetsOffset, BPF_REG_2);
+
+        // Let the packet through
+        as.label("out");
+        as.movImm(BPF_REG_0, 1);
+        as.exit();
+
+        return as.instructions();
+    }
+}
+
+CgroupTraffic::Counters &CgroupTraffic::Counters::operator+=(const Counters &other)
+{
+    rxBytes += other.rxBytes;
+    rxPackets += other.rxPackets;
+    txBytes += other.txBytes;
+    txPackets += other.txPackets;
+    return *this;
+}
+
+CgroupTraffic::Counters CgroupTraffic::Counters::operator-(const Counters &other) const
+{
+    return {rxBytes - other.rxBytes, rxPackets - other.rxPackets,
+        txBytes - other.txBytes, txPackets - other.txPackets};
+}
+
+CgroupTraffic::CgroupTraffic()
+: _counters{BPF_MAP_TYPE_PERCPU_HASH, sizeof(std::uint64_t), sizeof(Counters), maxCgroups}
+{
+    Fd cgroupFd{::open(Ebpf::cgroup2Root().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)};
+    if(!cgroupFd)
+        throw SystemError("Could not open the cgroup v2 root");
+
+    // Programs attached to the root see the traffic of every cgroup below it
+    for(const auto attachType : {BPF_CGROUP_INET_INGRESS, BPF_CGROUP_INET_EGRESS})
+    {
+        Ebpf::Program program{BPF_PROG_TYPE_CGROUP_SKB, attachType,
+            counterProgram(_counters, attachType == BPF_CGROUP_INET_EGRESS)};
+        _links.emplace_back(program, cgroupFd.get(), attachType);
+    }
+}
+
+std::unordered_map<std::uint64_t, CgroupTraffic::Counters> CgroupTraffic::totals() const
+{
+    std::unordered_map<std::uint64_t, Counters> totals;
+    for(const auto &cgroupId : _counters.keys<std::uint64_t>())
+    {
+        Counters &total = totals[cgroupId];
+        for(const auto &counters : _counters.lookupPerCpu<std::uint64_t, Counters>(cgroupId))
+            total += counters;
+    }
+
+    return totals;
+}
+
+void CgroupTraffic::removeDeleted(std::span<const std::uint64_t> cgroupIds)
+{
+    for(const auto cgroupId : cgroupIds)
+    {
+        if(_paths.exists(cgroupId))
+            continue;
+
+        _counters.erase(cgroupId);
+        _paths.forget(cgroupId);
+    }
+}
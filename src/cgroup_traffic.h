@@ -0,0 +1,43 @@
+#pragma once
+
+#include "common.h"
+#include "ebpf.h"
+#include "cgroup_paths.h"
+#include <unordered_map>
+
+// Per-cgroup traffic totals, counted in the kernel by cgroup_skb ingress/egress
+// programs into per-CPU counters. No packets are copied to userspace at all, we
+// just read the totals whenever we want them.
+class CgroupTraffic
+{
+public:
+    struct Counters
+    {
+        std::uint64_t rxBytes{};
+        std::uint64_t rxPackets{};
+        std::uint64_t txBytes{};
+        std::uint64_t txPackets{};
+
+        Counters &operator+=(const Counters &other);
+        Counters operator-(const Counters &other) const;
+        bool empty() const {return rxPackets == 0 && txPackets == 0;}
+    };
+
+public:
+    CgroupTraffic();
+
+public:
+    // cgroup id -> totals since we attached
+    std::unordered_map<std::uint64_t, Counters> totals() const;
+    // The cgroup's path relative to the cgroup v2 root (empty if it no longer exists)
+    const std::string &cgroupPath(std::uint64_t cgroupId) {return _paths.path(cgroupId);}
+    // Drop the counters of those of cgroupIds that have been deleted, so they
+    // don't fill up the map
+    void removeDeleted(std::span<const std::uint64_t> cgroupIds);
+
+private:
+    // cgroup id -> Counters (per CPU)
+    Ebpf::Map _counters;
+    std::vector<Ebpf::CgroupLink> _links;
+    CgroupPaths _paths;
+};
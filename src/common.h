@@ -16,6 +16,8 @@
 #include <functional>
 #include <filesystem>
 #include <algorithm>
+#include <utility>
+#include <string_view>
 #include <unistd.h>
 #include <stdio.h>
 #include <sys/errno.h>
@@ -23,6 +25,7 @@
 #include <span>
 #include <arpa/inet.h>
 #include <errno.h>
+#include "flat_set.h"
 
 #if defined(__linux__)
 #define RUMI_LINUX
@@ -35,7 +38,7 @@
 #endif
 
 // Types
-using PortSet = std::set<std::uint16_t>;
+using PidSet = FlatSet<pid_t>;
 enum IPVersion { IPv4, IPv6, Both };
 
 inline std::string ipVersionToString(IPVersion ipVersion)
@@ -8,6 +8,46 @@ Config::Config(const cxxopts::ParseResult &result)
     decideIpVersion(result);
     setDisplayColumns(result);
     setFormatString(result);
+
+    if(result.count("scan-threads"))
+        _scanThreads = result["scan-threads"].as<unsigned>();
+    if(result.count("watch"))
+        _watchInterval = result["watch"].as<unsigned>();
+    if(result.count("read"))
+        _auditTrail = result["read"].as<std::string>();
+    if(result.count("timeline"))
+        _timelinePath = result["timeline"].as<std::string>();
+    if(result.count("summary"))
+        _execSummaryInterval = result["summary"].as<unsigned>();
+    if(result.count("resources"))
+        _resourcesInterval = result["resources"].as<unsigned>();
+
+    _ebpf = result.count("ebpf") > 0;
+    _execExits = result.count("exits") > 0;
+    if(result.count("cgroup-traffic"))
+        _cgroupTrafficInterval = result["cgroup-traffic"].as<unsigned>();
+    if(result.count("socket-traffic"))
+        _socketTrafficInterval = result["socket-traffic"].as<unsigned>();
+    _tcpInfo = result.count("tcp-info") > 0;
+    if(result.count("sort"))
+        _sortMetric = result["sort"].as<std::string>();
+    if(result.count("where"))
+        _whereExpression = result["where"].as<std::string>();
+
+    if(result.count("files"))
+        _fileAccessPaths = result["files"].as<std::vector<std::string>>();
+    if(result.count("cgroup"))
+    {
+        const auto &cgroups = result["cgroup"].as<std::vector<std::string>>();
+        _processes._cgroups.insert(cgroups.begin(), cgroups.end());
+    }
+    if(result.count("group-by"))
+    {
+        const auto &groupBy = result["group-by"].as<std::string>();
+        if(groupBy != "process" && groupBy != "cgroup")
+            throw cxxopts::OptionParseException{"Unknown --group-by '" + groupBy + "', expected process or cgroup"};
+        _groupByCgroup = groupBy == "cgroup";
+    }
 }
 
 void Config::extractProcesses(const std::string &optionName, const cxxopts::ParseResult &result, SelectedProcesses &selectedProcesses)
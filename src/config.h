@@ -9,12 +9,15 @@ public:
     {
     public:
         const std::set<std::string> &names() const {return _names;}
-        const std::set<pid_t> &pids() const {return _pids;}
-        bool empty() const {return _names.empty() && _pids.empty();}
+        const PidSet &pids() const {return _pids;}
+        // Processes whose cgroup path contains one of these (Linux only)
+        const std::set<std::string> &cgroups() const {return _cgroups;}
+        bool empty() const {return _names.empty() && _pids.empty() && _cgroups.empty();}
 
     private:
         std::set<std::string> _names;
-        std::set<pid_t> _pids;
+        PidSet _pids;
+        std::set<std::string> _cgroups;
 
     private:
         friend class Config;
@@ -29,6 +32,36 @@ public:
     const SelectedProcesses &parentProcesses() const {return _parentProcesses;}
     const std::vector<std::string> &displayColumns() const {return _displayColumns;}
     const std::string &formatString() const {return _formatString;}
+    // 0 means use the default
+    unsigned scanThreads() const {return _scanThreads;}
+    // Seconds between -s rescans, 0 for a single listing
+    unsigned watchInterval() const {return _watchInterval;}
+    // A BSM audit trail for -e to replay rather than tracing live, empty if none
+    const std::string &auditTrail() const {return _auditTrail;}
+    // Seconds between -e summaries of the busiest commands and parents, 0 to show each exec
+    unsigned execSummaryInterval() const {return _execSummaryInterval;}
+    // Seconds between samples of the selected processes' CPU, memory, threads and fds, 0 if not requested
+    unsigned resourcesInterval() const {return _resourcesInterval;}
+    // Show -e exits with their CPU, memory and I/O usage (Linux only)
+    bool execExits() const {return _execExits;}
+    // A Chrome trace file to record -e process spans in, empty if none
+    const std::string &timelinePath() const {return _timelinePath;}
+    // -F: paths on the filesystems to trace file access on, empty if not requested (Linux only)
+    const std::vector<std::string> &fileAccessPaths() const {return _fileAccessPaths;}
+    // Attribute packets with eBPF socket hooks rather than socket table scans (Linux only)
+    bool ebpf() const {return _ebpf;}
+    // Seconds between per-cgroup traffic reports, 0 if not requested (Linux only)
+    unsigned cgroupTrafficInterval() const {return _cgroupTrafficInterval;}
+    // Seconds between per-process TCP traffic reports, 0 if not requested (Linux only)
+    unsigned socketTrafficInterval() const {return _socketTrafficInterval;}
+    // Show TCP health metrics with -s (Linux only) - implied by a sort metric or a where expression
+    bool tcpInfo() const {return _tcpInfo || !_sortMetric.empty() || !_whereExpression.empty();}
+    // The TCP metric to sort -s output by (highest first), empty to keep the dump order
+    const std::string &sortMetric() const {return _sortMetric;}
+    // Conditions on TCP metrics that -s connections must meet, e.g "retrans>0"
+    const std::string &whereExpression() const {return _whereExpression;}
+    // Aggregate outputs (--socket-traffic, -s --watch summaries) per cgroup rather than per process
+    bool groupByCgroup() const {return _groupByCgroup;}
 
     // indicates whether user specified any proocesses to watch on CLI
     // if this is true, should indicate that we must skip anything else
@@ -51,4 +84,19 @@ private:
     SelectedProcesses _parentProcesses;
     std::vector<std::string> _displayColumns;
     std::string _formatString;
+    unsigned _scanThreads{};
+    unsigned _watchInterval{};
+    std::string _auditTrail;
+    unsigned _execSummaryInterval{};
+    unsigned _resourcesInterval{};
+    bool _execExits{};
+    std::string _timelinePath;
+    std::vector<std::string> _fileAccessPaths;
+    bool _ebpf{};
+    unsigned _cgroupTrafficInterval{};
+    unsigned _socketTrafficInterval{};
+    bool _tcpInfo{};
+    std::string _sortMetric;
+    std::string _whereExpression;
+    bool _groupByCgroup{};
 };
@@ -0,0 +1,156 @@
+#include "connection_watch.h"
+#include <cstring>
+
+namespace
+{
+#if defined(RUMI_MACOS)
+    // Re-query every socket fd this often, to catch an fd number that was closed
+    // and reused for another socket between two scans
+    const unsigned fullScanEvery{10};
+
+    // Sockets whose cached info can be reused: their state won't change until
+    // they're closed
+    bool isStable(const std::optional<PortFinder::Connection> &connection)
+    {
+        if(!connection)
+            return true;
+
+        return connection->protocol() == IPPROTO_UDP || connection->stateName() == "LISTEN";
+    }
+#endif
+}
+
+std::size_t ConnectionWatch::KeyHash::operator()(const Key &key) const
+{
+    std::uint64_t words[4]{};
+    std::memcpy(&words[0], key.localAddress.data(), key.localAddress.size());
+    std::memcpy(&words[2], key.remoteAddress.data(), key.remoteAddress.size());
+
+    std::uint64_t hash = (static_cast<std::uint64_t>(key.pid) << 40) | (static_cast<std::uint64_t>(key.localPort) << 24) |
+        (static_cast<std::uint64_t>(key.remotePort) << 8) | key.protocol;
+    for(const auto word : words)
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+
+    return std::hash<std::uint64_t>{}(hash);
+}
+
+ConnectionWatch::ConnectionWatch(IPVersion ipVersion)
+: _ipVersion{ipVersion}
+{
+}
+
+ConnectionWatch::Key ConnectionWatch::makeKey(const PortFinder::Connection &connection)
+{
+    return {connection.pid(), static_cast<std::uint8_t>(connection.protocol()), connection.localPort(),
+        static_cast<std::uint16_t>(connection.remotePort()), connection.localAddressBytes(), connection.remoteAddressBytes()};
+}
+
+ConnectionWatch::Changes ConnectionWatch::update(const PidSet &pids)
+{
+    ConnectionTable connections;
+    Changes changes;
+
+    for(const auto &connection : scan(pids))
+    {
+        const auto key = makeKey(connection);
+        if(!connections.emplace(key, connection).second)
+            continue;
+
+        if(!_connections.contains(key))
+            changes.opened.push_back(connection);
+    }
+
+    for(const auto &[key, connection] : _connections)
+    {
+        if(!connections.contains(key))
+            changes.closed.push_back(connection);
+    }
+
+    _connections = std::move(connections);
+    return changes;
+}
+
+std::map<std::string, std::size_t> ConnectionWatch::stateCounts() const
+{
+    std::map<std::string, std::size_t> counts;
+    for(const auto &[key, connection] : _connections)
+        ++counts[connection.stateName()];
+
+    return counts;
+}
+
+std::map<pid_t, std::size_t> ConnectionWatch::processCounts() const
+{
+    std::map<pid_t, std::size_t> counts;
+    for(const auto &[key, connection] : _connections)
+        ++counts[key.pid];
+
+    return counts;
+}
+
+std::vector<PortFinder::Connection> ConnectionWatch::scan(const PidSet &pids)
+{
+    std::vector<PortFinder::Connection> connections;
+
+#if defined(RUMI_MACOS)
+    const auto scanPids = pids.empty() ? PortFinder::allPids() : std::vector<pid_t>(pids.begin(), pids.end());
+    const bool full = _scanCount++ % fullScanEvery == 0;
+
+    // Processes are scanned in parallel, each into its own slot
+    std::vector<FdTable> newFdTables(scanPids.size());
+    ThreadPool::shared().parallelFor(scanPids.size(), [&](std::size_t index, unsigned)
+    {
+        const pid_t pid = scanPids[index];
+        const FdTable *pPreviousTable{nullptr};
+        if(!full)
+        {
+            auto it = _fdTables.find(pid);
+            if(it != _fdTables.end())
+                pPreviousTable = &it->second;
+        }
+
+        FdTable &fdTable = newFdTables[index];
+        for(const auto &fd : PortFinder::socketFds(pid))
+        {
+            if(pPreviousTable)
+            {
+                auto it = pPreviousTable->find(fd);
+                if(it != pPreviousTable->end() && isStable(it->second))
+                {
+                    fdTable.emplace(fd, it->second);
+                    continue;
+                }
+            }
+
+            fdTable.emplace(fd, PortFinder::connectionForFd(pid, fd));
+        }
+    });
+
+    _fdTables.clear();
+    for(std::size_t index = 0; index < scanPids.size(); ++index)
+    {
+        for(const auto &[fd, connection] : newFdTables[index])
+        {
+            if(connection && PortFinder::matchesIpVersion(*connection, _ipVersion))
+                connections.push_back(*connection);
+        }
+
+        if(!newFdTables[index].empty())
+            _fdTables.emplace(scanPids[index], std::move(newFdTables[index]));
+    }
+#elif defined(RUMI_LINUX)
+    // A single bulk dump; the PortFinder's inode -> pid index already keeps
+    // every process's fds between scans, only reading those that are new.
+    // Sockets without an owner (e.g TIME_WAIT) aren't watched.
+    for(const auto &connection : PortFinder::allConnections())
+    {
+        if(connection.pid() && (pids.empty() || pids.contains(connection.pid())) &&
+            PortFinder::matchesIpVersion(connection, _ipVersion))
+        {
+            connections.push_back(connection);
+        }
+    }
+#endif
+
+    return connections;
+}
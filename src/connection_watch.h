@@ -0,0 +1,70 @@
+#pragma once
+
+#include "common.h"
+#include "port_finder.h"
+#include <unordered_map>
+#include <map>
+
+// Successive socket scans for -s --watch, diffed against each other. Connections
+// are keyed by their process and 5-tuple, so each update yields just the sockets
+// opened and closed since the previous one.
+class ConnectionWatch
+{
+public:
+    struct Changes
+    {
+        std::vector<PortFinder::Connection> opened;
+        std::vector<PortFinder::Connection> closed;
+
+        bool empty() const {return opened.empty() && closed.empty();}
+    };
+
+public:
+    explicit ConnectionWatch(IPVersion ipVersion);
+
+public:
+    // Scan the sockets of the given processes (every process if pids is empty)
+    // and diff them against the previous scan. Everything is opened the first time.
+    Changes update(const PidSet &pids);
+
+    std::size_t size() const {return _connections.size();}
+    // The current connections per state / per process
+    std::map<std::string, std::size_t> stateCounts() const;
+    std::map<pid_t, std::size_t> processCounts() const;
+
+private:
+    struct Key
+    {
+        pid_t pid{};
+        std::uint8_t protocol{};
+        std::uint16_t localPort{};
+        std::uint16_t remotePort{};
+        IPAddressBytes localAddress{};
+        IPAddressBytes remoteAddress{};
+
+        bool operator==(const Key&) const = default;
+    };
+
+    struct KeyHash
+    {
+        std::size_t operator()(const Key &key) const;
+    };
+
+    using ConnectionTable = std::unordered_map<Key, PortFinder::Connection, KeyHash>;
+
+private:
+    static Key makeKey(const PortFinder::Connection &connection);
+    std::vector<PortFinder::Connection> scan(const PidSet &pids);
+
+private:
+    IPVersion _ipVersion;
+    ConnectionTable _connections;
+#if defined(RUMI_MACOS)
+    // Each socket fd is a syscall on macOS, so we keep every process's fds between
+    // scans and only query the ones that are new or whose state may have changed.
+    // Non-TCP/UDP sockets are remembered (as empty) so they aren't queried again.
+    using FdTable = std::unordered_map<int, std::optional<PortFinder::Connection>>;
+    std::unordered_map<pid_t, FdTable> _fdTables;
+    unsigned _scanCount{};
+#endif
+};
@@ -0,0 +1,216 @@
+#include "ebpf.h"
+#include <sys/syscall.h>
+#include <fstream>
+#include <sstream>
+
+namespace
+{
+    // Large enough for the verifier's log of the small programs we load
+    const std::size_t verifierLogSize{64 * 1024};
+
+    int bpf(int command, bpf_attr &attr)
+    {
+        return static_cast<int>(::syscall(SYS_bpf, command, &attr, sizeof(attr)));
+    }
+
+    std::uint64_t toU64(const void *pointer)
+    {
+        return reinterpret_cast<std::uintptr_t>(pointer);
+    }
+}
+
+namespace Ebpf
+{
+Map::Map(bpf_map_type type, std::uint32_t keySize, std::uint32_t valueSize, std::uint32_t maxEntries)
+{
+    bpf_attr attr{};
+    attr.map_type = type;
+    attr.key_size = keySize;
+    attr.value_size = valueSize;
+    attr.max_entries = maxEntries;
+
+    _fd = Fd{bpf(BPF_MAP_CREATE, attr)};
+    if(!_fd)
+        throw SystemError("Could not create BPF map");
+}
+
+bool Map::lookup(const void *pKey, void *pValue) const
+{
+    bpf_attr attr{};
+    attr.map_fd = static_cast<std::uint32_t>(_fd.get());
+    attr.key = toU64(pKey);
+    attr.value = toU64(pValue);
+
+    return bpf(BPF_MAP_LOOKUP_ELEM, attr) == 0;
+}
+
+bool Map::nextKey(const void *pKey, void *pNextKey) const
+{
+    bpf_attr attr{};
+    attr.map_fd = static_cast<std::uint32_t>(_fd.get());
+    attr.key = toU64(pKey);
+    attr.next_key = toU64(pNextKey);
+
+    return bpf(BPF_MAP_GET_NEXT_KEY, attr) == 0;
+}
+
+void Map::update(const void *pKey, const void *pValue, std::uint64_t flags)
+{
+    bpf_attr attr{};
+    attr.map_fd = static_cast<std::uint32_t>(_fd.get());
+    attr.key = toU64(pKey);
+    attr.value = toU64(pValue);
+    attr.flags = flags;
+
+    if(bpf(BPF_MAP_UPDATE_ELEM, attr))
+        throw SystemError("Could not update BPF map");
+}
+
+void Map::erase(const void *pKey)
+{
+    bpf_attr attr{};
+    attr.map_fd = static_cast<std::uint32_t>(_fd.get());
+    attr.key = toU64(pKey);
+
+    if(bpf(BPF_MAP_DELETE_ELEM, attr) && errno != ENOENT)
+        throw SystemError("Could not delete from BPF map");
+}
+
+Program::Program(bpf_prog_type type, bpf_attach_type expectedAttachType, std::span<const bpf_insn> instructions)
+{
+    static const char license[]{"GPL"};
+    std::vector<char> log(verifierLogSize);
+
+    bpf_attr attr{};
+    attr.prog_type = type;
+    attr.expected_attach_type = expectedAttachType;
+    attr.insns = toU64(instructions.data());
+    attr.insn_cnt = static_cast<std::uint32_t>(instructions.size());
+    attr.license = toU64(license);
+    attr.log_buf = toU64(log.data());
+    attr.log_size = static_cast<std::uint32_t>(log.size());
+    attr.log_level = 1;
+
+    _fd = Fd{bpf(BPF_PROG_LOAD, attr)};
+    if(!_fd)
+        throw SystemError(std::string{"Could not load BPF program: "} + log.data());
+}
+
+CgroupLink::CgroupLink(const Program &program, int cgroupFd, bpf_attach_type attachType)
+{
+    bpf_attr attr{};
+    attr.link_create.prog_fd = static_cast<std::uint32_t>(program.fd());
+    attr.link_create.target_fd = static_cast<std::uint32_t>(cgroupFd);
+    attr.link_create.attach_type = attachType;
+
+    _fd = Fd{bpf(BPF_LINK_CREATE, attr)};
+    if(!_fd)
+        throw SystemError("Could not attach BPF program to cgroup");
+}
+
+void Assembler::emit(std::uint8_t code, int dst, int src, std::int16_t offset, std::int32_t imm)
+{
+    bpf_insn instruction{};
+    instruction.code = code;
+    instruction.dst_reg = static_cast<std::uint8_t>(dst);
+    instruction.src_reg = static_cast<std::uint8_t>(src);
+    instruction.off = offset;
+    instruction.imm = imm;
+    _instructions.push_back(instruction);
+}
+
+void Assembler::emitJump(std::uint8_t code, int dst, int src, std::int32_t imm, const std::string &label)
+{
+    // The offset is filled in by instructions(), once every label is known
+    _jumps.emplace(_instructions.size(), label);
+    emit(code, dst, src, 0, imm);
+}
+
+void Assembler::mov(int dst, int src) {emit(BPF_ALU64 | BPF_MOV | BPF_X, dst, src, 0, 0);}
+void Assembler::movImm(int dst, std::int32_t imm) {emit(BPF_ALU64 | BPF_MOV | BPF_K, dst, 0, 0, imm);}
+void Assembler::add(int dst, int src) {emit(BPF_ALU64 | BPF_ADD | BPF_X, dst, src, 0, 0);}
+void Assembler::addImm(int dst, std::int32_t imm) {emit(BPF_ALU64 | BPF_ADD | BPF_K, dst, 0, 0, imm);}
+void Assembler::rshImm(int dst, std::int32_t imm) {emit(BPF_ALU64 | BPF_RSH | BPF_K, dst, 0, 0, imm);}
+void Assembler::load(int size, int dst, int src, std::int16_t offset) {emit(BPF_LDX | size | BPF_MEM, dst, src, offset, 0);}
+void Assembler::store(int size, int dst, std::int16_t offset, int src) {emit(BPF_STX | size | BPF_MEM, dst, src, offset, 0);}
+void Assembler::storeImm(int size, int dst, std::int16_t offset, std::int32_t imm) {emit(BPF_ST | size | BPF_MEM, dst, 0, offset, imm);}
+void Assembler::call(bpf_func_id func) {emit(BPF_JMP | BPF_CALL, 0, 0, 0, func);}
+void Assembler::exit() {emit(BPF_JMP | BPF_EXIT, 0, 0, 0, 0);}
+
+void Assembler::loadMap(int dst, const Map &map)
+{
+    // A 64 bit immediate load spanning two instructions, which the kernel
+    // replaces with a pointer to the map
+    emit(BPF_LD | BPF_DW | BPF_IMM, dst, BPF_PSEUDO_MAP_FD, 0, map.fd());
+    emit(0, 0, 0, 0, 0);
+}
+
+void Assembler::jumpIfImm(int op, int dst, std::int32_t imm, const std::string &label)
+{
+    emitJump(static_cast<std::uint8_t>(BPF_JMP | op | BPF_K), dst, 0, imm, label);
+}
+
+void Assembler::jumpIf(int op, int dst, int src, const std::string &label)
+{
+    emitJump(static_cast<std::uint8_t>(BPF_JMP | op | BPF_X), dst, src, 0, label);
+}
+
+void Assembler::jump(const std::string &label)
+{
+    emitJump(BPF_JMP | BPF_JA, 0, 0, 0, label);
+}
+
+void Assembler::label(const std::string &name)
+{
+    _labels[name] = _instructions.size();
+}
+
+std::vector<bpf_insn> Assembler::instructions() const
+{
+    std::vector<bpf_insn> instructions{_instructions};
+    for(const auto &[index, label] : _jumps)
+    {
+        auto it = _labels.find(label);
+        if(it == _labels.end())
+            throw std::logic_error{"BPF jump to unknown label " + label};
+
+        // Jump offsets are relative to the instruction after the jump
+        instructions[index].off = static_cast<std::int16_t>(it->second - index - 1);
+    }
+
+    return instructions;
+}
+
+std::string cgroup2Root()
+{
+    std::ifstream mounts{"/proc/self/mounts"};
+    std::string line;
+    while(std::getline(mounts, line))
+    {
+        // <device> <mount point> <type> ...
+        std::istringstream fields{line};
+        std::string device, mountPoint, type;
+        if(fields >> device >> mountPoint >> type && type == "cgroup2")
+            return mountPoint;
+    }
+
+    throw std::runtime_error{"The cgroup v2 hierarchy is not mounted"};
+}
+
+unsigned possibleCpuCount()
+{
+    static const unsigned count = []
+    {
+        // A list of ranges such as "0-7" or "0,2-3", we want the highest CPU + 1
+        std::ifstream possible{"/sys/devices/system/cpu/possible"};
+        std::string ranges;
+        if(!std::getline(possible, ranges))
+            throw std::runtime_error{"Could not read the possible CPUs"};
+
+        const auto last = ranges.find_last_of(",-");
+        return static_cast<unsigned>(std::stoul(ranges.substr(last == std::string::npos ? 0 : last + 1))) + 1;
+    }();
+
+    return count;
+}
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include "util.h"
+#include "fd.h"
+#include <linux/bpf.h>
+#include <map>
+
+// Thin wrappers around the bpf() syscall. There's no libbpf (or BPF compiler)
+// involved: programs are assembled at runtime with Ebpf::Assembler.
+namespace Ebpf
+{
+    // The number of CPUs per-CPU maps hold values for
+    unsigned possibleCpuCount();
+
+    class Map
+    {
+    public:
+        Map(bpf_map_type type, std::uint32_t keySize, std::uint32_t valueSize, std::uint32_t maxEntries);
+
+    public:
+        template <typename Key_T, typename Value_T>
+        std::optional<Value_T> lookup(const Key_T &key) const
+        {
+            Value_T value{};
+            if(!lookup(&key, &value))
+                return {};
+
+            return value;
+        }
+
+        // For per-CPU maps: the value on every possible CPU
+        template <typename Key_T, typename Value_T>
+        std::vector<Value_T> lookupPerCpu(const Key_T &key) const
+        {
+            // The kernel copies out each CPU's value rounded up to 8 bytes
+            static_assert(sizeof(Value_T) % 8 == 0);
+            std::vector<Value_T> values(possibleCpuCount());
+            if(!lookup(&key, values.data()))
+                return {};
+
+            return values;
+        }
+
+        template <typename Key_T>
+        std::vector<Key_T> keys() const
+        {
+            std::vector<Key_T> keys;
+            Key_T key{};
+            for(const void *pKey = nullptr; nextKey(pKey, &key); pKey = &keys.back())
+                keys.push_back(key);
+
+            return keys;
+        }
+
+        template <typename Key_T, typename Value_T>
+        void update(const Key_T &key, const Value_T &value, std::uint64_t flags = BPF_ANY)
+        {
+            update(static_cast<const void*>(&key), static_cast<const void*>(&value), flags);
+        }
+
+        // Nothing happens if the key isn't there
+        template <typename Key_T>
+        void erase(const Key_T &key)
+        {
+            erase(static_cast<const void*>(&key));
+        }
+
+        int fd() const {return _fd.get();}
+
+    private:
+        bool lookup(const void *pKey, void *pValue) const;
+        // The key after pKey (the first key if pKey is null); false at the end
+        bool nextKey(const void *pKey, void *pNextKey) const;
+        void update(const void *pKey, const void *pValue, std::uint64_t flags);
+        void erase(const void *pKey);
+
+    private:
+        Fd _fd;
+    };
+
+    class Program
+    {
+    public:
+        // Throws SystemError (including the verifier's log) if the program is rejected
+        Program(bpf_prog_type type, bpf_attach_type expectedAttachType, std::span<const bpf_insn> instructions);
+
+    public:
+        int fd() const {return _fd.get();}
+
+    private:
+        Fd _fd;
+    };
+
+    // A program attached to a cgroup through a BPF link. The program is detached
+    // when the link is closed - including when we exit without cleaning up.
+    class CgroupLink
+    {
+    public:
+        CgroupLink(const Program &program, int cgroupFd, bpf_attach_type attachType);
+
+    private:
+        Fd _fd;
+    };
+
+    // Assembles a program instruction by instruction, resolving jumps to labels.
+    // Registers are the BPF_REG_* constants; sizes are BPF_B, BPF_H, BPF_W and BPF_DW.
+    class Assembler
+    {
+    public:
+        // dst = src
+        void mov(int dst, int src);
+        // dst = imm
+        void movImm(int dst, std::int32_t imm);
+        // dst += src
+        void add(int dst, int src);
+        // dst += imm
+        void addImm(int dst, std::int32_t imm);
+        // dst >>= imm
+        void rshImm(int dst, std::int32_t imm);
+        // dst = *(size *)(src + offset)
+        void load(int size, int dst, int src, std::int16_t offset);
+        // *(size *)(dst + offset) = src
+        void store(int size, int dst, std::int16_t offset, int src);
+        // *(size *)(dst + offset) = imm
+        void storeImm(int size, int dst, std::int16_t offset, std::int32_t imm);
+        // dst = the map (as a helper argument)
+        void loadMap(int dst, const Map &map);
+        void call(bpf_func_id func);
+        void exit();
+
+        // Jump to label if (dst op imm) / (dst op src), op being BPF_JEQ, BPF_JNE etc.
+        void jumpIfImm(int op, int dst, std::int32_t imm, const std::string &label);
+        void jumpIf(int op, int dst, int src, const std::string &label);
+        void jump(const std::string &label);
+        // Label the next instruction
+        void label(const std::string &name);
+
+        std::vector<bpf_insn> instructions() const;
+
+    private:
+        void emit(std::uint8_t code, int dst, int src, std::int16_t offset, std::int32_t imm);
+        void emitJump(std::uint8_t code, int dst, int src, std::int32_t imm, const std::string &label);
+
+    private:
+        std::vector<bpf_insn> _instructions;
+        std::map<std::string, std::size_t> _labels;
+        // Instruction index -> the label it jumps to
+        std::map<std::size_t, std::string> _jumps;
+    };
+
+    // Where the cgroup v2 hierarchy is mounted (throws if it isn't)
+    std::string cgroup2Root();
+}
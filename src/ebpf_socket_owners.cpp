@@ -0,0 +1,446 @@
+#include "ebpf_socket_owners.h"
+#include "net_namespace.h"
+#include "port_finder.h"
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <cstring>
+
+namespace
+{
+    // Shared with the BPF programs - the layouts must match the stack offsets below
+    struct EndpointKey
+    {
+        // The socket's network namespace, the same endpoint can exist in several
+        std::uint64_t netnsCookie;
+        // IPv4 addresses are stored v4-mapped (::ffff:a.b.c.d), so sockets of either
+        // family talking IPv4 share keys
+        std::uint8_t address[16];
+        // Host order
+        std::uint16_t port;
+        std::uint8_t protocol;
+        std::uint8_t pad;
+        std::uint32_t pad2;
+    };
+
+    struct Owner
+    {
+        std::uint64_t cookie;
+        std::uint64_t cgroupId;
+        std::uint64_t netnsCookie;
+        std::uint32_t pid;
+        std::uint32_t pad;
+        char comm[16];
+    };
+
+    static_assert(sizeof(EndpointKey) == 32 && sizeof(Owner) == 48);
+
+    const std::uint32_t maxSockets{64 * 1024};
+    // Namespaces lookups ask about that we have no cookie for are looked for at most this often
+    const auto netnsRefreshInterval{std::chrono::seconds{1}};
+
+    // Stack (r10 relative) offsets used by the programs
+    const std::int16_t ownerOffset{-48};
+    const std::int16_t endpointKeyOffset{-80};
+    const std::int16_t cookieKeyOffset{-88};
+
+    // Offsets into struct bpf_sock and struct __sk_buff
+    const std::int16_t sockFamily{offsetof(bpf_sock, family)};
+    const std::int16_t sockProtocol{offsetof(bpf_sock, protocol)};
+    const std::int16_t sockSrcIp4{offsetof(bpf_sock, src_ip4)};
+    const std::int16_t sockSrcIp6{offsetof(bpf_sock, src_ip6)};
+    const std::int16_t sockSrcPort{offsetof(bpf_sock, src_port)};
+    const std::int16_t skbSk{offsetof(__sk_buff, sk)};
+
+    // The stack offset of a field of the struct at base
+    constexpr std::int16_t fieldOffset(std::int16_t base, std::size_t field)
+    {
+        return static_cast<std::int16_t>(base + static_cast<std::int16_t>(field));
+    }
+
+    // Build an Owner for the current task (and the socket whose context is in r6)
+    // at ownerOffset, and its cookie at cookieKeyOffset
+    void emitOwner(Ebpf::Assembler &as)
+    {
+        as.mov(BPF_REG_1, BPF_REG_6);
+        as.call(BPF_FUNC_get_socket_cookie);
+        as.store(BPF_DW, BPF_REG_10, fieldOffset(ownerOffset, offsetof(Owner, cookie)), BPF_REG_0);
+        as.store(BPF_DW, BPF_REG_10, cookieKeyOffset, BPF_REG_0);
+
+        as.mov(BPF_REG_1, BPF_REG_6);
+        as.call(BPF_FUNC_get_netns_cookie);
+        as.store(BPF_DW, BPF_REG_10, fieldOffset(ownerOffset, offsetof(Owner, netnsCookie)), BPF_REG_0);
+
+        as.call(BPF_FUNC_get_current_cgroup_id);
+        as.store(BPF_DW, BPF_REG_10, fieldOffset(ownerOffset, offsetof(Owner, cgroupId)), BPF_REG_0);
+
+        // The upper half is the tgid, i.e the userspace pid
+        as.call(BPF_FUNC_get_current_pid_tgid);
+        as.rshImm(BPF_REG_0, 32);
+        as.store(BPF_W, BPF_REG_10, fieldOffset(ownerOffset, offsetof(Owner, pid)), BPF_REG_0);
+        as.storeImm(BPF_W, BPF_REG_10, fieldOffset(ownerOffset, offsetof(Owner, pad)), 0);
+
+        as.mov(BPF_REG_1, BPF_REG_10);
+        as.addImm(BPF_REG_1, fieldOffset(ownerOffset, offsetof(Owner, comm)));
+        as.movImm(BPF_REG_2, sizeof(Owner::comm));
+        as.call(BPF_FUNC_get_current_comm);
+    }
+
+    // Build the EndpointKey for the bpf_sock in sockReg at endpointKeyOffset, jumping
+    // to failLabel for sockets of other families. post_bind programs may only read
+    // the address field of their own family, so ipVersion limits what's read. The
+    // bpf_sock has no namespace, so that's copied from the Owner at ownerReg + ownerBase.
+    void emitEndpointKey(Ebpf::Assembler &as, int sockReg, int ownerReg, std::int16_t ownerBase, IPVersion ipVersion,
+        const std::string &failLabel)
+    {
+        const std::int16_t address = fieldOffset(endpointKeyOffset, offsetof(EndpointKey, address));
+
+        as.load(BPF_DW, BPF_REG_1, ownerReg, fieldOffset(ownerBase, offsetof(Owner, netnsCookie)));
+        as.store(BPF_DW, BPF_REG_10, fieldOffset(endpointKeyOffset, offsetof(EndpointKey, netnsCookie)), BPF_REG_1);
+
+        as.load(BPF_W, BPF_REG_1, sockReg, sockFamily);
+        if(ipVersion != IPv6)
+            as.jumpIfImm(BPF_JEQ, BPF_REG_1, AF_INET, "ipv4");
+
+        if(ipVersion != IPv4)
+        {
+            as.jumpIfImm(BPF_JNE, BPF_REG_1, AF_INET6, failLabel);
+            for(std::int16_t word = 0; word < 4; ++word)
+            {
+                as.load(BPF_W, BPF_REG_1, sockReg, sockSrcIp6 + word * 4);
+                as.store(BPF_W, BPF_REG_10, address + word * 4, BPF_REG_1);
+            }
+        }
+        as.jump(ipVersion == IPv4 ? failLabel : "port");
+
+        // ::ffff:a.b.c.d
+        if(ipVersion != IPv6)
+        {
+            as.label("ipv4");
+            as.storeImm(BPF_DW, BPF_REG_10, address, 0);
+            as.storeImm(BPF_W, BPF_REG_10, address + 8, static_cast<std::int32_t>(htonl(0x0000ffff)));
+            as.load(BPF_W, BPF_REG_1, sockReg, sockSrcIp4);
+            as.store(BPF_W, BPF_REG_10, address + 12, BPF_REG_1);
+        }
+
+        as.label("port");
+        as.load(BPF_W, BPF_REG_1, sockReg, sockSrcPort);
+        as.store(BPF_H, BPF_REG_10, fieldOffset(endpointKeyOffset, offsetof(EndpointKey, port)), BPF_REG_1);
+        as.load(BPF_W, BPF_REG_1, sockReg, sockProtocol);
+        as.store(BPF_B, BPF_REG_10, fieldOffset(endpointKeyOffset, offsetof(EndpointKey, protocol)), BPF_REG_1);
+        as.storeImm(BPF_B, BPF_REG_10, fieldOffset(endpointKeyOffset, offsetof(EndpointKey, pad)), 0);
+        as.storeImm(BPF_W, BPF_REG_10, fieldOffset(endpointKeyOffset, offsetof(EndpointKey, pad2)), 0);
+    }
+
+    // r1 = map, r2 = fp + keyOffset
+    void emitMapArgs(Ebpf::Assembler &as, const Ebpf::Map &map, std::int16_t keyOffset)
+    {
+        as.loadMap(BPF_REG_1, map);
+        as.mov(BPF_REG_2, BPF_REG_10);
+        as.addImm(BPF_REG_2, keyOffset);
+    }
+
+    // Every program allows the operation (or packet) through
+    void emitAllow(Ebpf::Assembler &as)
+    {
+        as.movImm(BPF_REG_0, 1);
+        as.exit();
+    }
+
+    // sock_create: cookie -> owner
+    std::vector<bpf_insn> sockCreateProgram(const Ebpf::Map &owners)
+    {
+        Ebpf::Assembler as;
+        as.mov(BPF_REG_6, BPF_REG_1);
+        emitOwner(as);
+
+        emitMapArgs(as, owners, cookieKeyOffset);
+        as.mov(BPF_REG_3, BPF_REG_10);
+        as.addImm(BPF_REG_3, ownerOffset);
+        as.movImm(BPF_REG_4, BPF_ANY);
+        as.call(BPF_FUNC_map_update_elem);
+
+        emitAllow(as);
+        return as.instructions();
+    }
+
+    // post_bind: bound endpoint -> owner (there are separate IPv4 and IPv6 hooks)
+    std::vector<bpf_insn> postBindProgram(const Ebpf::Map &endpoints, IPVersion ipVersion)
+    {
+        Ebpf::Assembler as;
+        as.mov(BPF_REG_6, BPF_REG_1);
+        emitOwner(as);
+        emitEndpointKey(as, BPF_REG_6, BPF_REG_10, ownerOffset, ipVersion, "out");
+
+        emitMapArgs(as, endpoints, endpointKeyOffset);
+        as.mov(BPF_REG_3, BPF_REG_10);
+        as.addImm(BPF_REG_3, ownerOffset);
+        as.movImm(BPF_REG_4, BPF_ANY);
+        as.call(BPF_FUNC_map_update_elem);
+
+        as.label("out");
+        emitAllow(as);
+        return as.instructions();
+    }
+
+    // egress: the sending socket's endpoint -> the owner recorded when it was created.
+    // This catches sockets bound implicitly by connect() or sendto(), which post_bind
+    // never sees. Packets are usually sent from softirq context (retransmits, acks)
+    // so the owner can't be taken from the current task here.
+    std::vector<bpf_insn> egressProgram(const Ebpf::Map &owners, const Ebpf::Map &endpoints)
+    {
+        Ebpf::Assembler as;
+        as.mov(BPF_REG_6, BPF_REG_1);
+
+        as.mov(BPF_REG_1, BPF_REG_6);
+        as.call(BPF_FUNC_get_socket_cookie);
+        as.jumpIfImm(BPF_JEQ, BPF_REG_0, 0, "out");
+        as.store(BPF_DW, BPF_REG_10, cookieKeyOffset, BPF_REG_0);
+
+        // Sockets created before we were attached have no owner
+        emitMapArgs(as, owners, cookieKeyOffset);
+        as.call(BPF_FUNC_map_lookup_elem);
+        as.jumpIfImm(BPF_JEQ, BPF_REG_0, 0, "out");
+        as.mov(BPF_REG_7, BPF_REG_0);
+
+        as.load(BPF_DW, BPF_REG_1, BPF_REG_6, skbSk);
+        as.jumpIfImm(BPF_JEQ, BPF_REG_1, 0, "out");
+        as.call(BPF_FUNC_sk_fullsock);
+        as.jumpIfImm(BPF_JEQ, BPF_REG_0, 0, "out");
+        as.mov(BPF_REG_8, BPF_REG_0);
+        emitEndpointKey(as, BPF_REG_8, BPF_REG_7, 0, Both, "out");
+
+        // Only write the endpoint on the socket's first packet (per endpoint)
+        emitMapArgs(as, endpoints, endpointKeyOffset);
+        as.call(BPF_FUNC_map_lookup_elem);
+        as.jumpIfImm(BPF_JEQ, BPF_REG_0, 0, "update");
+        as.load(BPF_DW, BPF_REG_1, BPF_REG_0, offsetof(Owner, cookie));
+        as.load(BPF_DW, BPF_REG_2, BPF_REG_7, offsetof(Owner, cookie));
+        as.jumpIf(BPF_JEQ, BPF_REG_1, BPF_REG_2, "out");
+
+        as.label("update");
+        emitMapArgs(as, endpoints, endpointKeyOffset);
+        as.mov(BPF_REG_3, BPF_REG_7);
+        as.movImm(BPF_REG_4, BPF_ANY);
+        as.call(BPF_FUNC_map_update_elem);
+
+        as.label("out");
+        emitAllow(as);
+        return as.instructions();
+    }
+
+    EndpointKey makeEndpointKey(std::uint64_t netnsCookie, IPVersion ipVersion, std::uint8_t protocol, std::uint16_t port,
+        const IPAddressBytes &address)
+    {
+        EndpointKey key{};
+        key.netnsCookie = netnsCookie;
+        if(ipVersion == IPv4)
+        {
+            key.address[10] = key.address[11] = 0xff;
+            std::copy(address.begin(), address.begin() + 4, key.address + 12);
+        }
+        else
+            std::copy(address.begin(), address.end(), key.address);
+
+        key.port = port;
+        key.protocol = protocol;
+        return key;
+    }
+
+    // The owner of the endpoint in the namespace with netnsCookie, falling back to
+    // the owner of the port on the "any" address
+    std::optional<Owner> findOwner(const Ebpf::Map &endpoints, std::uint64_t netnsCookie, const SocketOwners::Endpoint &endpoint)
+    {
+        auto lookup = [&](IPVersion ipVersion, const IPAddressBytes &address) -> std::optional<Owner>
+        {
+            auto owner = endpoints.lookup<EndpointKey, Owner>(makeEndpointKey(netnsCookie, ipVersion, endpoint.protocol,
+                endpoint.port, address));
+            if(!owner || owner->pid == 0)
+                return {};
+
+            return owner;
+        };
+
+        if(auto owner = lookup(endpoint.ipVersion, endpoint.address))
+            return owner;
+
+        // Sockets bound to the "any" address: IPv4 ones, then IPv6 ones (which also receive IPv4)
+        if(endpoint.ipVersion == IPv4)
+        {
+            if(auto owner = lookup(IPv4, {}))
+                return owner;
+        }
+
+        return lookup(IPv6, {});
+    }
+}
+
+EbpfSocketOwners::EbpfSocketOwners(bool verbose)
+// Entries for closed sockets are never removed, LRU maps evict the oldest instead
+: _owners{BPF_MAP_TYPE_LRU_HASH, sizeof(std::uint64_t), sizeof(Owner), maxSockets}
+, _endpoints{BPF_MAP_TYPE_LRU_HASH, sizeof(EndpointKey), sizeof(Owner), maxSockets}
+, _verbose{verbose}
+{
+    refreshNetnsCookies();
+    // Attach first, so no socket can slip between seeding and attaching
+    attachPrograms();
+    seedEndpoints();
+}
+
+void EbpfSocketOwners::attachPrograms()
+{
+    Fd cgroupFd{::open(Ebpf::cgroup2Root().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)};
+    if(!cgroupFd)
+        throw SystemError("Could not open the cgroup v2 root");
+
+    auto attach = [&](bpf_prog_type type, bpf_attach_type attachType, const std::vector<bpf_insn> &instructions)
+    {
+        // The link keeps the program alive
+        Ebpf::Program program{type, attachType, instructions};
+        _links.emplace_back(program, cgroupFd.get(), attachType);
+    };
+
+    attach(BPF_PROG_TYPE_CGROUP_SOCK, BPF_CGROUP_INET_SOCK_CREATE, sockCreateProgram(_owners));
+    attach(BPF_PROG_TYPE_CGROUP_SOCK, BPF_CGROUP_INET4_POST_BIND, postBindProgram(_endpoints, IPv4));
+    attach(BPF_PROG_TYPE_CGROUP_SOCK, BPF_CGROUP_INET6_POST_BIND, postBindProgram(_endpoints, IPv6));
+    attach(BPF_PROG_TYPE_CGROUP_SKB, BPF_CGROUP_INET_EGRESS, egressProgram(_owners, _endpoints));
+}
+
+void EbpfSocketOwners::seedEndpoints()
+{
+    // The owners of existing sockets are only known by pid, so record their names
+    // (once per process) in case they exit while we're running
+    std::unordered_map<pid_t, Owner> owners;
+
+    for(const auto &connection : PortFinder::allConnections())
+    {
+        if(connection.pid() == 0)
+            continue;
+
+        const auto netnsCookie = this->netnsCookie(connection.netns());
+        if(!netnsCookie)
+            continue;
+
+        auto [it, inserted] = owners.try_emplace(connection.pid());
+        Owner &owner = it->second;
+        if(inserted)
+        {
+            owner.pid = static_cast<std::uint32_t>(connection.pid());
+            const auto name = std::filesystem::path{PortFinder::pidToPath(connection.pid())}.filename().string();
+            ::strncpy(owner.comm, name.c_str(), sizeof(owner.comm) - 1);
+        }
+        owner.netnsCookie = *netnsCookie;
+
+        const auto key = makeEndpointKey(*netnsCookie, connection.isIpv4() ? IPv4 : IPv6,
+            static_cast<std::uint8_t>(connection.protocol()), connection.localPort(), connection.localAddressBytes());
+
+        // Don't clobber anything the programs have recorded since they were attached
+        try
+        {
+            _endpoints.update(key, owner, BPF_NOEXIST);
+        }
+        catch(const SystemError &error)
+        {
+            if(_verbose && error.code() != EEXIST)
+                std::cerr << "Could not seed the owner of a socket of pid " << connection.pid() << ": " << error.what() << std::endl;
+        }
+    }
+}
+
+void EbpfSocketOwners::refreshNetnsCookies()
+{
+    // A socket belongs to the namespace it was created in
+    std::unordered_map<std::uint32_t, std::uint64_t> cookies;
+    NetNamespace::forEach(NetNamespace::list(), [&](const NetNamespace::Info &ns)
+    {
+        Fd socketFd{::socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0)};
+        std::uint64_t cookie{};
+        socklen_t length{sizeof(cookie)};
+        if(socketFd && ::getsockopt(socketFd.get(), SOL_SOCKET, SO_NETNS_COOKIE, &cookie, &length) == 0)
+            cookies.emplace(ns.inode, cookie);
+        else if(ns.inode == NetNamespace::current())
+            throw SystemError("Could not get our network namespace cookie (needs Linux 5.14 or later)");
+    });
+
+    std::unique_lock lock{_netnsMutex};
+    _netnsCookies = std::move(cookies);
+    _lastNetnsRefresh = Clock::now();
+    _unknownNetns = false;
+}
+
+std::optional<std::uint64_t> EbpfSocketOwners::netnsCookie(std::uint32_t netns) const
+{
+    std::shared_lock lock{_netnsMutex};
+    auto it = _netnsCookies.find(netns);
+    if(it == _netnsCookies.end())
+    {
+        // A namespace created since we last looked, refreshNow() picks it up
+        _unknownNetns = true;
+        return {};
+    }
+
+    return it->second;
+}
+
+void EbpfSocketOwners::refreshNow()
+{
+    if(!_unknownNetns)
+        return;
+
+    {
+        std::shared_lock lock{_netnsMutex};
+        if(Clock::now() - _lastNetnsRefresh < netnsRefreshInterval)
+            return;
+    }
+
+    refreshNetnsCookies();
+}
+
+std::optional<pid_t> EbpfSocketOwners::find(const Endpoint &endpoint) const
+{
+    const auto netnsCookie = this->netnsCookie(endpoint.netns);
+    if(!netnsCookie)
+        return {};
+
+    const auto owner = findOwner(_endpoints, *netnsCookie, endpoint);
+    if(!owner)
+        return {};
+
+    return static_cast<pid_t>(owner->pid);
+}
+
+std::optional<SocketOwners::OwnerDetails> EbpfSocketOwners::ownerDetails(const Endpoint &endpoint) const
+{
+    const auto netnsCookie = this->netnsCookie(endpoint.netns);
+    if(!netnsCookie)
+        return {};
+
+    const auto owner = findOwner(_endpoints, *netnsCookie, endpoint);
+    if(!owner || !owner->comm[0])
+        return {};
+
+    OwnerDetails details{std::string{owner->comm, ::strnlen(owner->comm, sizeof(owner->comm))}, {}};
+    if(owner->cgroupId)
+    {
+        std::lock_guard lock{_cgroupMutex};
+        details.cgroupPath = _cgroupPaths.path(owner->cgroupId);
+    }
+
+    return details;
+}
+pid_t EbpfSocketOwners::endpointToPid(const Endpoint &endpoint)
+{
+    if(auto pid = find(endpoint))
+    {
+        ++_hits;
+        return *pid;
+    }
+
+    ++_misses;
+    return 0;
+}
+
+std::string EbpfSocketOwners::statsString() const
+{
+    return fmt::format("ebpf socket owners: {} hits, {} misses", _hits.load(), _misses.load());
+}
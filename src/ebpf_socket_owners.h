@@ -0,0 +1,68 @@
+#pragma once
+
+#include "common.h"
+#include "socket_owners.h"
+#include "ebpf.h"
+#include "cgroup_paths.h"
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+// Socket owners recorded by the kernel itself, so attribution doesn't race with
+// sockets being created and closed (even ones that only live for milliseconds).
+//
+// cgroup BPF programs attached to the root of the cgroup v2 hierarchy record:
+//   - on socket creation: socket cookie -> owner (pid, comm, cgroup id, netns cookie)
+//   - on bind: local endpoint -> owner
+//   - on the first egress packet of an (auto-bound) socket: local endpoint -> the
+//     owner recorded when the socket was created
+// and lookups just read the endpoint map - there's no /proc scanning beyond seeding
+// the map with the sockets that already exist on startup.
+//
+// Endpoints are keyed by the kernel's network namespace cookie, which is mapped
+// to and from the namespace's inode (as in Endpoint::netns) with SO_NETNS_COOKIE.
+class EbpfSocketOwners : public SocketOwners
+{
+public:
+    // verbose: report sockets that couldn't be seeded
+    explicit EbpfSocketOwners(bool verbose = false);
+
+public:
+    virtual pid_t endpointToPid(const Endpoint &endpoint) override;
+    virtual std::optional<pid_t> find(const Endpoint &endpoint) const override;
+    virtual std::optional<OwnerDetails> ownerDetails(const Endpoint &endpoint) const override;
+    // Pick up the namespaces created since we last looked, if a lookup needed one
+    virtual void refreshNow() override;
+    virtual std::string statsString() const override;
+
+private:
+    // Attach the programs that fill in _owners and _endpoints
+    void attachPrograms();
+    // Record the owners of the sockets that existed before the programs were attached
+    void seedEndpoints();
+    void refreshNetnsCookies();
+    // Nothing if the namespace (inode) is one we don't know yet
+    std::optional<std::uint64_t> netnsCookie(std::uint32_t netns) const;
+
+private:
+    // socket cookie -> Owner
+    Ebpf::Map _owners;
+    // EndpointKey -> Owner
+    Ebpf::Map _endpoints;
+    std::vector<Ebpf::CgroupLink> _links;
+    const bool _verbose;
+
+    // netns inode -> netns cookie
+    mutable std::shared_mutex _netnsMutex;
+    std::unordered_map<std::uint32_t, std::uint64_t> _netnsCookies;
+    Clock::time_point _lastNetnsRefresh;
+    mutable std::atomic<bool> _unknownNetns{};
+
+    // Resolving the owners' cgroups, which CgroupPaths doesn't do thread safely
+    mutable std::mutex _cgroupMutex;
+    mutable CgroupPaths _cgroupPaths;
+
+    std::atomic<std::uint64_t> _hits{};
+    std::atomic<std::uint64_t> _misses{};
+};
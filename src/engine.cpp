@@ -1,6 +1,62 @@
 #include "engine.h"
 #include "packet.h"
+#include "port_finder.h"
+#include "socket_index.h"
+#include "attribution_queue.h"
+#include "local_addresses.h"
+#include "process_selection.h"
+#include "connection_watch.h"
+#include "thread_pool.h"
+#include "process_cgroups.h"
+#include "exec_summary.h"
+#include "timeline.h"
+#include "process_resources.h"
+#include "process_cache.h"
+#include "view.h"
 #include <fmt/core.h>
+#include <thread>
+#include <fcntl.h>
+#if defined(RUMI_BSM)
+#include "bsm_reader.h"
+#endif
+
+namespace fs = std::filesystem;
+namespace
+{
+    std::string basename(const std::string& path)
+    {
+        return static_cast<std::string>(fs::path(path).filename());
+    }
+
+    // How often to report socket index statistics in verbose mode
+    const auto statsInterval{std::chrono::seconds{10}};
+
+    // The busiest processes listed in each -s --watch summary
+    const std::size_t watchedProcessesShown{10};
+
+    // The end of the packet's connection that belongs to a local socket. Outbound
+    // packets (including loopback ones, where both ends are local) come from it and
+    // inbound ones go to it. Container addresses count as local (on Linux), so
+    // traffic between containers is attributed to the sender. Packets between
+    // two other hosts are treated as outbound.
+    SocketOwners::Endpoint localEndpoint(const PacketView &packet, const LocalAddresses &localAddresses)
+    {
+        const auto ipVersion = packet.ipVersion();
+        auto sourceAddress = packet.sourceAddressBytes();
+        auto destAddress = packet.destAddressBytes();
+
+        const auto sourceNamespace = localAddresses.namespaceOf(ipVersion, sourceAddress);
+        if(!sourceNamespace)
+        {
+            if(const auto destNamespace = localAddresses.namespaceOf(ipVersion, destAddress))
+                return {ipVersion, packet.transportProtocol(), packet.destPort(), destAddress, *destNamespace};
+        }
+
+        return {ipVersion, packet.transportProtocol(), packet.sourcePort(), sourceAddress,
+            sourceNamespace.value_or(localAddresses.ownNamespace())};
+    }
+
+}
 
 void Engine::start(int argc, char **argv)
 {
@@ -13,17 +69,37 @@ void Engine::start(int argc, char **argv)
         ("s,sockets", "Show socket information.")
         ("e,exec", "Show process execs.")
         ("p,process", "The processes to observe (either pid or name)", cxxopts::value<std::vector<std::string>>())
-        ("P,parent", "The parent processes to observe (either pid or name)", cxxopts::value<std::vector<std::string>>())
-        ("c,cols", "The display columns to use for output.", cxxopts::value<std::vector<std::string>>())
-        ("f,format", "Set format string.", cxxopts::value<std::string>())
+        ("P,parent", "The parent processes whose descendants to observe (either pid or name)", cxxopts::value<std::vector<std::string>>())
+        ("c,cols", "The fields to show for -e, -s and -a, separated by spaces (see --format).", cxxopts::value<std::vector<std::string>>())
+        ("f,format", "The output of -e, -s and -a, with fields in braces, e.g '{pid} {name} {args}'.", cxxopts::value<std::string>())
         ("v,verbose", "Verbose output.",cxxopts::value<bool>()->default_value("false"))
+        ("watch", "With -s, rescan every N seconds and show only the sockets opened and closed.", cxxopts::value<unsigned>())
+        ("summary", "With -e, print the busiest commands and parents every N seconds rather than each exec. With -F, how often to print.", cxxopts::value<unsigned>())
+        ("timeline", "With -e, also record each process's lifetime to a Chrome trace file (for Perfetto or chrome://tracing).", cxxopts::value<std::string>())
+        ("resources", "Show the CPU, memory, threads and fds of the -p/-P processes every N seconds.", cxxopts::value<unsigned>())
+        ("read", "With -e, replay the execs in a BSM audit trail file rather than tracing live.", cxxopts::value<std::string>())
+        ("scan-threads", "Threads used to scan processes and sockets (default: one per core, up to 8).", cxxopts::value<unsigned>())
         ("4,inet", "IPv4 only.",cxxopts::value<bool>()->default_value("false"))
         ("6,inet6", "IPv6 only.",cxxopts::value<bool>()->default_value("false"));
+#if defined(RUMI_LINUX)
+    options.add_options()
+        ("ebpf", "Attribute traffic with eBPF cgroup socket hooks rather than scanning sockets (needs root and cgroup v2).")
+        ("exits", "With -e, also show each process's exit with its CPU time, peak RSS and I/O (with --summary, totals per command).")
+        ("F,files", "Show the files processes open, read and write on the filesystems of these paths, every 5 seconds (or --summary N).", cxxopts::value<std::vector<std::string>>())
+        ("cgroup-traffic", "Show traffic per cgroup every N seconds, counted in the kernel (needs root and cgroup v2).", cxxopts::value<unsigned>())
+        ("socket-traffic", "Show TCP traffic per process every N seconds, from the sockets' own byte counters.", cxxopts::value<unsigned>())
+        ("tcp-info", "Show TCP health metrics (RTT, cwnd, retransmits, queues) with -s.")
+        ("sort", "Sort -s output by a TCP metric, highest first (rtt, rttvar, cwnd, retrans, sendq, recvq, sendmem).", cxxopts::value<std::string>())
+        ("where", "Only show -s sockets whose TCP metrics match, e.g 'retrans>0' or 'rtt>=50,sendq>0'.", cxxopts::value<std::string>())
+        ("cgroup", "Only observe processes whose cgroup path contains this, e.g 'kubepods' or a container id.", cxxopts::value<std::vector<std::string>>())
+        ("group-by", "Group --socket-traffic and -s --watch summaries by 'process' (the default) or 'cgroup'.", cxxopts::value<std::string>());
+#endif
 
     auto result = options.parse(argc, argv);
 
     // Initialize our config from the CLI options
     Config config{result};
+    ThreadPool::setSharedThreadCount(config.scanThreads());
 
     if(!result.unmatched().empty())
     {
@@ -40,7 +116,26 @@ void Engine::start(int argc, char **argv)
     }
     else if(result["exec"].as<bool>())
     {
-        showExec(config);
+        if(config.auditTrail().empty())
+            showExec(config);
+        else
+            replayAuditTrail(config);
+    }
+    else if(config.resourcesInterval())
+    {
+        showResources(config);
+    }
+    else if(!config.fileAccessPaths().empty())
+    {
+        showFileAccess(config);
+    }
+    else if(config.cgroupTrafficInterval())
+    {
+        showCgroupTraffic(config);
+    }
+    else if(config.socketTrafficInterval())
+    {
+        showSocketTraffic(config);
     }
     else if(result["analyze"].as<bool>())
     {
@@ -52,22 +147,442 @@ void Engine::start(int argc, char **argv)
     }
 }
 
-void Engine::displayPacket(const PacketView &packet, const std::string &appPath)
+void Engine::showConnections(const Config &config)
+{
+    if(config.watchInterval())
+    {
+        watchConnections(config);
+        return;
+    }
+
+    ProcessSelection processes{config.processes()};
+    const auto pids = processes.snapshot();
+    const View::Socket<PortFinder::ConnectionRecord> socketView{config};
+
+    auto showConnectionsForIPVersion = [&](IPVersion ipVersion)
+    {
+        std::cout << ipVersionToString(ipVersion) << "\n==\n";
+        // Must run cmb as sudo to show all sockets, otherwise some are missed
+        const auto scanStart{std::chrono::steady_clock::now()};
+
+        // Connections are formatted as they're scanned, each process's path
+        // being looked up only once
+        PortFinder::ProcessPaths processPaths;
+        std::size_t connectionCount{0};
+        std::string output;
+        PortFinder::forEachConnectionRecord(*pids, ipVersion, [&](std::span<const PortFinder::ConnectionRecord> records)
+        {
+            for(const auto &record : records)
+            {
+                const auto &path = config.verbose() ? processPaths.path(record.pid()) : processPaths.name(record.pid());
+                socketView.render(record, path, config.verbose(), output);
+            }
+
+            std::cout << output;
+            output.clear();
+            connectionCount += records.size();
+        });
+        const std::chrono::duration<double, std::milli> scanTime{std::chrono::steady_clock::now() - scanStart};
+
+        if(config.verbose())
+        {
+            std::cerr << fmt::format("Scanned {} connections in {:.1f}ms using {} threads\n",
+                connectionCount, scanTime.count(), ThreadPool::shared().threadCount());
+        }
+    };
+
+    if(config.ipVersion() == IPVersion::Both)
+    {
+        showConnectionsForIPVersion(IPv4);
+        showConnectionsForIPVersion(IPv6);
+    }
+    else
+        showConnectionsForIPVersion(config.ipVersion());
+}
+
+void Engine::watchConnections(const Config &config)
+{
+    const std::chrono::seconds interval{config.watchInterval()};
+    const View::Socket<PortFinder::Connection> socketView{config};
+    ProcessSelection processes{config.processes()};
+    ConnectionWatch watch{config.ipVersion()};
+    auto &cgroups = ProcessCgroups::shared();
+    // Without -p, watch every process
+    const auto allProcesses = std::make_shared<const PidSet>();
+
+    while(true)
+    {
+        const auto changes = watch.update(config.processesProvided() ? *processes.snapshot() : *allProcesses);
+
+        // Opened sockets are marked '+' and closed ones '-', whatever the layout
+        PortFinder::ProcessPaths processPaths;
+        std::string output;
+        auto showChange = [&](char change, const PortFinder::Connection &connection, std::string_view details)
+        {
+            const auto &path = config.verbose() ? processPaths.path(connection.pid()) : processPaths.name(connection.pid());
+            output += change;
+            output += ' ';
+            socketView.render(connection, path, config.verbose(), output, details);
+        };
+        for(const auto &connection : changes.opened)
+            showChange('+', connection, " " + connection.stateName());
+        for(const auto &connection : changes.closed)
+            showChange('-', connection, {});
+        std::cout << output;
+
+        if(!changes.empty())
+        {
+            std::string states;
+            for(const auto &[state, count] : watch.stateCounts())
+                states += fmt::format("{}{} {}", states.empty() ? "" : ", ", state, count);
+
+            // Busiest processes (or cgroups) first
+            std::map<std::string, std::size_t> groupCounts;
+            for(const auto &[pid, count] : watch.processCounts())
+            {
+                if(config.groupByCgroup())
+                {
+                    const auto path = cgroups.lookup(pid).path;
+                    groupCounts[path.empty() ? "<unknown>" : path] += count;
+                }
+                else
+                    groupCounts[fmt::format("{}({})", basename(PortFinder::pidToPath(pid)), pid)] += count;
+            }
+
+            std::vector<std::pair<std::string, std::size_t>> busiest{groupCounts.begin(), groupCounts.end()};
+            std::stable_sort(busiest.begin(), busiest.end(), [](const auto &left, const auto &right) {return left.second > right.second;});
+            busiest.resize(std::min(busiest.size(), watchedProcessesShown));
+
+            std::string processCountsString;
+            for(const auto &[group, count] : busiest)
+                processCountsString += fmt::format("{}{} {}", processCountsString.empty() ? "" : ", ", group, count);
+
+            std::cout << fmt::format("== {} sockets (+{} -{}) | {} | {}\n", watch.size(), changes.opened.size(),
+                changes.closed.size(), states, processCountsString);
+        }
+        std::cout << std::flush;
+
+        std::this_thread::sleep_for(interval);
+    }
+}
+
+void Engine::showTraffic(const Config &config)
+{
+    auto captureDevice = createCaptureDevice();
+    auto socketOwners = createSocketOwners(config);
+    LocalAddresses localAddresses;
+    ProcessSelection processes{config.processes()};
+    auto lastStatsTime{SocketOwners::Clock::now()};
+
+    View::Packet<PacketView> packetView{config};
+    View::Packet<PacketRecord> recordView{config};
+    // Deferred packets are shown from the attribution queue's thread
+    std::mutex displayMutex;
+
+    auto showAttributed = [&](const auto &packet, const SocketOwners::Endpoint &endpoint, pid_t pid, bool deferred)
+    {
+        std::string fullPath{pid ? PortFinder::pidToPath(pid) : std::string{}};
+
+        // The process may have exited since it sent the packet, fall back to
+        // whatever the socket owners recorded of it
+        std::optional<ProcessCgroups::Cgroup> cgroup;
+        if(pid && fullPath.empty())
+        {
+            if(auto details = socketOwners->ownerDetails(endpoint))
+            {
+                fullPath = std::move(details->comm);
+                cgroup = ProcessCgroups::Cgroup{details->cgroupPath, ProcessCgroups::containerId(details->cgroupPath)};
+            }
+        }
+
+        std::string path = config.verbose() ? fullPath : basename(fullPath);
+
+        // If we want to observe specific processes (-p)
+        // then limit to showing only packets from those processes
+        if(config.processesProvided())
+        {
+            // Also match on the path, as a process started since the selection
+            // was last reconciled won't be in the selected pids yet
+            if(!pid || !(processes.contains(pid) || processes.matches(pid, fullPath)))
+                return;
+        }
+        // Otherwise show everything, flagging packets whose owner was never found
+        else if(deferred && !pid)
+        {
+            path = "<unresolved>";
+        }
+
+        std::lock_guard lock{displayMutex};
+        if constexpr(std::is_same_v<std::decay_t<decltype(packet)>, PacketView>)
+            packetView.render(packet, path, pid, config.verbose(), cgroup);
+        else
+            recordView.render(packet, path, pid, config.verbose(), cgroup);
+    };
+
+    AttributionQueue attributionQueue{*socketOwners, [&](const PacketRecord &packet, const SocketOwners::Endpoint &endpoint, pid_t pid)
+    {
+        showAttributed(packet, endpoint, pid, true);
+    }};
+
+    captureDevice->onPacketReceived([&](const PacketView &packet)
+    {
+        if(config.ipVersion() != IPVersion::Both)
+        // Skip packets with the unwanted ipVersion
+        if(packet.ipVersion() != config.ipVersion())
+            return;
+
+        // We only care about TCP and UDP
+        if(packet.hasTransport())
+        {
+            const auto endpoint = localEndpoint(packet, localAddresses);
+            const pid_t pid{socketOwners->endpointToPid(endpoint)};
+
+            // The socket may be too short-lived for the index to have caught it yet,
+            // so hold on to the packet while the index catches up
+            if(pid)
+                showAttributed(packet, endpoint, pid, false);
+            else
+                attributionQueue.defer(packet, endpoint);
+        }
+
+        if(config.verbose() && SocketOwners::Clock::now() - lastStatsTime >= statsInterval)
+        {
+            std::cerr << socketOwners->statsString() << "\n"
+                << attributionQueue.stats().toString() << std::endl;
+            lastStatsTime = SocketOwners::Clock::now();
+        }
+    });
+
+    // Infinite loop
+    captureDevice->receive();
+}
+
+void Engine::replayAuditTrail(const Config &config)
+{
+#if defined(RUMI_BSM)
+    Fd trailFd{::open(config.auditTrail().c_str(), O_RDONLY | O_CLOEXEC)};
+    if(!trailFd)
+        throw SystemError("Could not open audit trail " + config.auditTrail());
+
+    BsmReader reader{trailFd.get(), BsmReader::Source::Trail};
+    const View::Exec<BsmReader::ProcessEvent> execView{config, false};
+
+    // The trail is read far faster than it was written, so a summary covers all of it
+    std::optional<ExecSummary> summary;
+    if(config.execSummaryInterval())
+        summary.emplace(std::chrono::seconds{0}, false);
+    // Spans are timed by the trail's records
+    std::optional<Timeline> timeline;
+    if(!config.timelinePath().empty())
+        timeline.emplace(config.timelinePath());
+
+    // The trail's processes are long gone, so rather than scanning for them
+    // the selection is followed through the trail's own events
+    PidSet processes{config.processes().pids()};
+    PidSet parentProcesses{config.parentProcesses().pids()};
+
+    reader.onProcessStarted([&](const auto &event)
+    {
+        if(PortFinder::matchesPath(config.processes().names(), event.path))
+            processes.insert(event.pid);
+        if(PortFinder::matchesPath(config.parentProcesses().names(), event.path))
+            parentProcesses.insert(event.pid);
+
+        // A descendant of a -P process is a parent to its own children too
+        const bool isDescendant = parentProcesses.contains(event.ppid);
+        if(isDescendant)
+            parentProcesses.insert(event.pid);
+
+        if(config.processesProvided() &&
+           !processes.contains(event.pid) &&
+           !isDescendant)
+        {
+            return;
+        }
+
+        if(timeline)
+            timeline->started(event, event.timeUs);
+
+        if(summary)
+            summary->add(event.path, event.ppid);
+        else
+            execView.render(event);
+    });
+
+    reader.onProcessExited([&](const auto &event)
+    {
+        if(!config.processes().pids().contains(event.pid))
+            processes.erase(event.pid);
+        if(!config.parentProcesses().pids().contains(event.pid))
+            parentProcesses.erase(event.pid);
+        if(timeline)
+            timeline->exited(event.pid, event.timeUs);
+    });
+
+    const auto replayStart{std::chrono::steady_clock::now()};
+    try
+    {
+        reader.receive();
+    }
+    catch(const std::runtime_error &ex)
+    {
+        // Not a trail (or a corrupt one)
+        throw cxxopts::OptionParseException{fmt::format("{}: {}", config.auditTrail(), ex.what())};
+    }
+    const std::chrono::duration<double> replayTime{std::chrono::steady_clock::now() - replayStart};
+
+    if(summary)
+        summary->report();
+
+    if(config.verbose())
+    {
+        const auto &stats = reader.stats();
+        std::cerr << fmt::format("{} in {:.3f}s ({:.0f} records/s)\n", stats.toString(), replayTime.count(),
+            stats.records / std::max(replayTime.count(), 1e-9));
+    }
+#else
+    (void)config;
+    throw std::runtime_error{"Replaying audit trails needs OpenBSM (libbsm)"};
+#endif
+}
+
+void Engine::showResources(const Config &config)
 {
-    constexpr const char *ipv6FormatString = "{:.20} {} {}.{} > {}.{}\n";
-    constexpr const char *ipv4FormatString = "{:.20} {} {}:{} > {}:{}\n";
+    if(!config.processesProvided())
+        throw cxxopts::OptionParseException{"--resources needs the processes to sample, with -p or -P"};
+
+    using Clock = std::chrono::steady_clock;
+    const std::chrono::seconds interval{config.resourcesInterval()};
+    ProcessSelection processes{config.processes()};
+    ProcessSelection parentProcesses{config.parentProcesses()};
+    ProcessResources resources;
+    auto &cache = ProcessCache::shared();
+
+    struct Sampled
+    {
+        std::string name;
+        std::uint64_t startTime{};
+        std::uint64_t cpuTimeUs{};
+        // Was it selected in the latest round?
+        bool current{};
+    };
 
-    if(packet.isIpv6())
+    struct Row
     {
-        fmt::print(ipv6FormatString, appPath, packet.transportName(), packet.sourceAddress(), packet.sourcePort(),
-                packet.destAddress(), packet.destPort());
-    } 
-    else 
+        pid_t pid{};
+        // Nothing until the process has been sampled twice
+        std::optional<double> cpuPercent;
+        ProcessResources::Sample sample;
+    };
+
+    std::unordered_map<pid_t, Sampled> sampled;
+    std::vector<pid_t> pids;
+    std::vector<Row> rows;
+    auto lastSampleTime = Clock::now();
+
+    // The first round only gives the CPU times to measure the next one against
+    for(auto nextSample = Clock::now(); ; nextSample += interval)
     {
-        fmt::print(ipv4FormatString, appPath, packet.transportName(), packet.sourceAddress(), packet.sourcePort(),
-                packet.destAddress(), packet.destPort());
+        std::this_thread::sleep_until(nextSample);
+        const auto sampleTime = Clock::now();
+        const double elapsedUs = static_cast<double>(
+            std::chrono::duration_cast<std::chrono::microseconds>(sampleTime - lastSampleTime).count());
+        lastSampleTime = sampleTime;
+
+        const auto selected = processes.snapshot();
+        pids.assign(selected->begin(), selected->end());
+        // There are no process events here, so the process tree is brought up to date
+        // by looking for new and vanished pids
+        if(!config.parentProcesses().empty())
+        {
+            cache.refresh();
+            const auto descendants = cache.descendantsOf(*parentProcesses.snapshot());
+            pids.insert(pids.end(), descendants.begin(), descendants.end());
+            std::sort(pids.begin(), pids.end());
+            pids.erase(std::unique(pids.begin(), pids.end()), pids.end());
+        }
+
+        rows.clear();
+        for(const auto pid : pids)
+        {
+            const auto sample = resources.sample(pid);
+            if(!sample)
+                continue;
+
+            auto [it, inserted] = sampled.try_emplace(pid);
+            auto &process = it->second;
+            Row row{pid, {}, *sample};
+            // The name is kept up to date as the process may exec
+            process.name = sample->name;
+            if(inserted || process.startTime != sample->startTime)
+                process.startTime = sample->startTime;
+            else if(elapsedUs > 0)
+            {
+                row.cpuPercent = static_cast<double>(sample->cpuTimeUs - process.cpuTimeUs) * 100.0 / elapsedUs;
+            }
+            process.cpuTimeUs = sample->cpuTimeUs;
+            process.current = true;
+            rows.push_back(row);
+        }
+
+        // Stop sampling the processes that have gone or are no longer selected
+        for(auto it = sampled.begin(); it != sampled.end();)
+        {
+            if(!it->second.current)
+            {
+                resources.forget(it->first);
+                it = sampled.erase(it);
+                continue;
+            }
+            it->second.current = false;
+            ++it;
+        }
+
+        if(config.verbose())
+        {
+            std::cerr << fmt::format("sampled {} processes in {}us", rows.size(),
+                std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - sampleTime).count()) << std::endl;
+        }
+
+        if(std::none_of(rows.begin(), rows.end(), [](const auto &row) {return row.cpuPercent.has_value();}))
+            continue;
+
+        // Busiest first
+        std::stable_sort(rows.begin(), rows.end(), [](const auto &left, const auto &right)
+        {
+            return left.cpuPercent.value_or(-1) > right.cpuPercent.value_or(-1);
+        });
+
+        fmt::print("{:<24} {:>8} {:>7} {:>10} {:>8} {:>8}\n", "PROCESS", "PID", "CPU %", "RSS KB", "THREADS", "FDS");
+        for(const auto &row : rows)
+        {
+            const auto &name = sampled[row.pid].name;
+            const auto cpu = row.cpuPercent ? fmt::format("{:.1f}", *row.cpuPercent) : std::string{"-"};
+            const auto fds = row.sample.fds ? std::to_string(*row.sample.fds) : std::string{"-"};
+            fmt::print("{:<24} {:>8} {:>7} {:>10} {:>8} {:>8}\n", name.empty() ? "<unknown>" : name, row.pid, cpu,
+                row.sample.rssKb, row.sample.threads, fds);
+        }
+        fmt::print("\n");
+        ::fflush(stdout);
     }
+}
+
+void Engine::showFileAccess(const Config &)
+{
+    throw std::runtime_error{"File access tracing is only supported on Linux"};
+}
 
-    ::fflush(stdout);
+void Engine::showCgroupTraffic(const Config &)
+{
+    throw std::runtime_error{"Per-cgroup traffic accounting is only supported on Linux"};
 }
 
+void Engine::showSocketTraffic(const Config &)
+{
+    throw std::runtime_error{"Per-process socket traffic accounting is only supported on Linux"};
+}
+
+std::unique_ptr<SocketOwners> Engine::createSocketOwners(const Config &) const
+{
+    return std::make_unique<SocketIndex>();
+}
@@ -3,6 +3,8 @@
 #include "common.h"
 #include "packet.h"
 #include "config.h"
+#include "capture_device.h"
+#include "socket_owners.h"
 
 class Config;
 
@@ -15,11 +17,23 @@ public:
     void start(int argc, char **argv);
 
 protected:
-    void displayPacket(const PacketView &packet, const std::string &appPath);
-
-protected:
-    virtual void showTraffic(const Config &config) = 0;
-    virtual void showConnections(const Config &config) = 0;
+    virtual void showTraffic(const Config &config);
+    virtual void showConnections(const Config &config);
+    // showConnections() with --watch: rescan periodically, showing the changes
+    void watchConnections(const Config &config);
     virtual void showExec(const Config &config) = 0;
+    // showExec() with --read: replay the execs in a BSM audit trail
+    void replayAuditTrail(const Config &config);
+    // --resources: sample the selected processes' CPU, memory, threads and fds
+    void showResources(const Config &config);
+    // -F: the files processes open, read and write
+    virtual void showFileAccess(const Config &config);
+    virtual void showCgroupTraffic(const Config &config);
+    virtual void showSocketTraffic(const Config &config);
+
+    // The platform's packet capture mechanism, used by showTraffic()
+    virtual std::unique_ptr<CaptureDevice> createCaptureDevice() const = 0;
+    // How showTraffic() attributes packets to processes (a SocketIndex by default)
+    virtual std::unique_ptr<SocketOwners> createSocketOwners(const Config &config) const;
 };
 
@@ -0,0 +1,133 @@
+#include "exec_summary.h"
+#include "process_cache.h"
+#include <fmt/core.h>
+
+namespace
+{
+    std::string_view basename(std::string_view path)
+    {
+        const auto slash = path.rfind('/');
+        return slash == std::string_view::npos ? path : path.substr(slash + 1);
+    }
+
+    // The topCount largest counts, largest first
+    template <typename MapT, typename CountFuncT>
+    auto top(const MapT &map, std::size_t topCount, CountFuncT countFunc)
+    {
+        std::vector<typename MapT::const_pointer> rows;
+        rows.reserve(map.size());
+        for(const auto &entry : map)
+            rows.push_back(&entry);
+
+        const auto size = std::min(topCount, rows.size());
+        std::partial_sort(rows.begin(), rows.begin() + static_cast<std::ptrdiff_t>(size), rows.end(),
+            [&](const auto *pLeft, const auto *pRight) {return countFunc(*pLeft) > countFunc(*pRight);});
+        rows.resize(size);
+        return rows;
+    }
+}
+
+ExecSummary::ExecSummary(std::chrono::seconds interval, bool live, std::size_t topCount)
+: _interval{interval}
+, _live{live}
+, _topCount{topCount}
+{
+    if(_interval.count())
+        _reportThread = std::thread{[this] { reportLoop(); }};
+}
+
+ExecSummary::~ExecSummary()
+{
+    {
+        std::lock_guard lock{_stopMutex};
+        _stop = true;
+    }
+    _stopCondition.notify_all();
+
+    if(_reportThread.joinable())
+        _reportThread.join();
+}
+
+void ExecSummary::add(std::string_view path, pid_t ppid)
+{
+    const auto command = basename(path);
+
+    std::lock_guard lock{_mutex};
+    ++_execs;
+
+    auto it = _commands.find(command);
+    if(it == _commands.end())
+        it = _commands.emplace(command, 0).first;
+    ++it->second;
+
+    auto [parent, inserted] = _parents.try_emplace(ppid);
+    if(inserted && _live)
+        parent->second.name = basename(ProcessCache::shared().path(ppid));
+    ++parent->second.execs;
+}
+
+void ExecSummary::exited(std::string_view command, const ProcessEvent::Usage &usage)
+{
+    std::lock_guard lock{_mutex};
+
+    auto it = _usage.find(command);
+    if(it == _usage.end())
+        it = _usage.emplace(command, CommandUsage{}).first;
+    ++it->second.exits;
+    it->second.usage += usage;
+}
+
+void ExecSummary::report()
+{
+    std::lock_guard lock{_mutex};
+
+    if(_interval.count())
+        fmt::print("{} execs in the last {}s\n", _execs, _interval.count());
+    else
+        fmt::print("{} execs\n", _execs);
+
+    if(_execs)
+    {
+        fmt::print("{:<32} {:>8}\n", "COMMAND", "EXECS");
+        for(const auto *pCommand : top(_commands, _topCount, [](const auto &entry) {return entry.second;}))
+            fmt::print("{:<32} {:>8}\n", pCommand->first, pCommand->second);
+
+        fmt::print("{:<32} {:>8} {:>8}\n", "PARENT", "PID", "EXECS");
+        for(const auto *pParent : top(_parents, _topCount, [](const auto &entry) {return entry.second.execs;}))
+        {
+            fmt::print("{:<32} {:>8} {:>8}\n", pParent->second.name.empty() ? "<unknown>" : pParent->second.name,
+                pParent->first, pParent->second.execs);
+        }
+    }
+
+    if(!_usage.empty())
+    {
+        // The most CPU hungry commands, their peak RSS the highest of any one process
+        const auto cpuTime = [](const auto &entry) {return entry.second.usage.userTimeUs + entry.second.usage.systemTimeUs;};
+        fmt::print("{:<32} {:>8} {:>10} {:>10} {:>12} {:>12}\n", "COMMAND", "EXITS", "CPU ms", "MAX RSS KB", "READ B", "WRITE B");
+        for(const auto *pCommand : top(_usage, _topCount, cpuTime))
+        {
+            const auto &[exits, usage] = pCommand->second;
+            fmt::print("{:<32} {:>8} {:>10} {:>10} {:>12} {:>12}\n", pCommand->first, exits, cpuTime(*pCommand) / 1000,
+                usage.maxRssKb, usage.readBytes, usage.writeBytes);
+        }
+    }
+    fmt::print("\n");
+    ::fflush(stdout);
+
+    _execs = 0;
+    _commands.clear();
+    _parents.clear();
+    _usage.clear();
+}
+
+void ExecSummary::reportLoop()
+{
+    std::unique_lock lock{_stopMutex};
+    while(!_stopCondition.wait_for(lock, _interval, [this] { return _stop; }))
+    {
+        lock.unlock();
+        report();
+        lock.lock();
+    }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "common.h"
+#include "process_event.h"
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <unordered_map>
+
+// Exec counts per command and per parent, for -e --summary: rather than a line
+// per exec (overwhelming during a large build), the busiest commands and parents
+// are printed every interval and the counts start again.
+//
+// Commands are counted by basename, looked up without copying the path; a parent
+// is counted by pid, with its name looked up once per interval. Exits with their
+// resource usage (from taskstats) are totalled per command too.
+class ExecSummary
+{
+public:
+    // live: the execs are happening now, so parent names can be looked up. With
+    // no interval nothing is printed until report() is called.
+    ExecSummary(std::chrono::seconds interval, bool live, std::size_t topCount = 10);
+    ~ExecSummary();
+
+    ExecSummary(const ExecSummary&) = delete;
+    ExecSummary& operator=(const ExecSummary&) = delete;
+
+public:
+    void add(std::string_view path, pid_t ppid);
+    void exited(std::string_view command, const ProcessEvent::Usage &usage);
+    // Print the busiest commands and parents since the last report, and reset the counts
+    void report();
+
+private:
+    struct StringHash
+    {
+        using is_transparent = void;
+        std::size_t operator()(std::string_view value) const {return std::hash<std::string_view>{}(value);}
+    };
+
+    struct CommandUsage
+    {
+        std::uint64_t exits{};
+        ProcessEvent::Usage usage;
+    };
+
+    struct Parent
+    {
+        std::string name;
+        std::uint64_t execs{};
+    };
+
+private:
+    void reportLoop();
+
+private:
+    const std::chrono::seconds _interval;
+    const bool _live;
+    const std::size_t _topCount;
+
+    std::mutex _mutex;
+    std::uint64_t _execs{};
+    std::unordered_map<std::string, std::uint64_t, StringHash, std::equal_to<>> _commands;
+    std::unordered_map<pid_t, Parent> _parents;
+    std::unordered_map<std::string, CommandUsage, StringHash, std::equal_to<>> _usage;
+
+    std::mutex _stopMutex;
+    std::condition_variable _stopCondition;
+    bool _stop{false};
+    std::thread _reportThread;
+};
@@ -0,0 +1,195 @@
+#include "file_access.h"
+#include "vendor/cxxopts.h"
+#include <sys/fanotify.h>
+#include <sys/statfs.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <climits>
+#include <cstring>
+
+namespace
+{
+    // Exec opens are only wanted to tell when a process becomes another program
+    const std::uint64_t eventMask{FAN_OPEN | FAN_OPEN_EXEC | FAN_ACCESS | FAN_MODIFY};
+    const std::size_t bufferSize{256 * 1024};
+    // Beyond this many interned paths, start again (between intervals)
+    const std::size_t maxPaths{1024 * 1024};
+
+    std::uint64_t toFsid(const void *pFsid)
+    {
+        std::uint64_t fsid{};
+        std::memcpy(&fsid, pFsid, sizeof(fsid));
+        return fsid;
+    }
+}
+
+std::string FileAccess::Stats::toString() const
+{
+    return fmt::format("fanotify: {} events, {} overflows, {} paths", events, overflows, paths);
+}
+
+FileAccess::FileAccess(const std::vector<std::string> &paths)
+: _fanotify{::fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_REPORT_FID, O_RDONLY | O_CLOEXEC)}
+, _buffer(bufferSize)
+, _ownPid{::getpid()}
+{
+    if(!_fanotify)
+        throw SystemError("Could not initialize fanotify (needs CAP_SYS_ADMIN and Linux 5.1)");
+
+    for(const auto &path : paths)
+    {
+        Fd mountFd{::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)};
+        struct statfs info{};
+        if(!mountFd || ::fstatfs(mountFd.get(), &info))
+            throw cxxopts::OptionParseException{fmt::format("-F: {} is not a directory", path)};
+
+        if(::fanotify_mark(_fanotify.get(), FAN_MARK_ADD | FAN_MARK_FILESYSTEM, eventMask, mountFd.get(), nullptr))
+            throw SystemError("Could not watch " + path);
+
+        _filesystems.push_back({toFsid(&info.f_fsid), std::move(mountFd)});
+    }
+}
+
+void FileAccess::receive(std::chrono::milliseconds timeout)
+{
+    if(_resetPaths)
+    {
+        _fileIds.clear();
+        _paths.clear();
+        _resetPaths = false;
+    }
+
+    pollfd pollFd{_fanotify.get(), POLLIN, 0};
+    if(::poll(&pollFd, 1, static_cast<int>(timeout.count())) <= 0)
+        return;
+
+    const auto length = ::read(_fanotify.get(), _buffer.data(), _buffer.size());
+    if(length < 0)
+    {
+        if(errno == EINTR || errno == EAGAIN)
+            return;
+        throw SystemError("Could not read fanotify events");
+    }
+
+    auto remaining = length;
+    for(const auto *pEvent = reinterpret_cast<const fanotify_event_metadata*>(_buffer.data());
+        FAN_EVENT_OK(pEvent, remaining); pEvent = FAN_EVENT_NEXT(pEvent, remaining))
+    {
+        processEvent({reinterpret_cast<const std::uint8_t*>(pEvent), pEvent->event_len});
+    }
+}
+
+void FileAccess::processEvent(std::span<const std::uint8_t> event)
+{
+    fanotify_event_metadata metadata{};
+    std::memcpy(&metadata, event.data(), sizeof(metadata));
+    ++_events;
+
+    if(metadata.mask & FAN_Q_OVERFLOW)
+    {
+        ++_overflows;
+        return;
+    }
+    if(metadata.pid == _ownPid)
+        return;
+
+    auto [selected, inserted] = _selected.try_emplace(metadata.pid);
+    if(inserted)
+        selected->second = _selectedFunc(metadata.pid);
+    const bool wanted = selected->second;
+
+    // The process is about to be another program, so it's asked about again
+    if(metadata.mask & FAN_OPEN_EXEC)
+        _selected.erase(selected);
+    if(!wanted)
+        return;
+
+    // The file's id follows the metadata: an info header, the fsid, then a file_handle
+    for(auto info = event.subspan(metadata.metadata_len); info.size() >= sizeof(fanotify_event_info_header);)
+    {
+        fanotify_event_info_header header{};
+        std::memcpy(&header, info.data(), sizeof(header));
+        if(header.len < sizeof(header) || header.len > info.size())
+            return;
+
+        const auto fidSize = sizeof(fanotify_event_info_fid) + sizeof(file_handle);
+        if(header.info_type == FAN_EVENT_INFO_TYPE_FID && header.len >= fidSize)
+        {
+            const auto *pFid = reinterpret_cast<const fanotify_event_info_fid*>(info.data());
+            file_handle handle{};
+            std::memcpy(&handle, pFid->handle, sizeof(handle));
+
+            const auto keySize = offsetof(fanotify_event_info_fid, handle) - sizeof(header) + sizeof(handle) + handle.handle_bytes;
+            if(sizeof(header) + keySize > header.len)
+                return;
+
+            // The fsid, handle type and handle bytes are the key
+            const std::string_view handleKey{reinterpret_cast<const char*>(info.data() + sizeof(header)), keySize};
+            const auto fileId = intern(toFsid(&pFid->fsid), handleKey, pFid->handle);
+
+            auto &counts = _counts[(static_cast<std::uint64_t>(metadata.pid) << 32) | fileId];
+            if(metadata.mask & FAN_OPEN)
+                ++counts.opens;
+            if(metadata.mask & FAN_ACCESS)
+                ++counts.reads;
+            if(metadata.mask & FAN_MODIFY)
+                ++counts.writes;
+            break;
+        }
+
+        info = info.subspan(header.len);
+    }
+}
+
+std::uint32_t FileAccess::intern(std::uint64_t fsid, std::string_view handleKey, const void *pHandle)
+{
+    auto it = _fileIds.find(handleKey);
+    if(it != _fileIds.end())
+        return it->second;
+
+    const auto fileId = static_cast<std::uint32_t>(_paths.size());
+    _paths.push_back(resolve(fsid, pHandle));
+    _fileIds.emplace(handleKey, fileId);
+    return fileId;
+}
+
+std::string FileAccess::resolve(std::uint64_t fsid, const void *pHandle) const
+{
+    auto filesystem = std::find_if(_filesystems.begin(), _filesystems.end(),
+        [&](const Filesystem &candidate) {return candidate.fsid == fsid;});
+    if(filesystem == _filesystems.end())
+        return "<unknown>";
+
+    // The handle in the event isn't aligned, and its size is only known from its header
+    file_handle header{};
+    std::memcpy(&header, pHandle, sizeof(header));
+    std::vector<std::uint8_t> handleBuffer(sizeof(file_handle) + header.handle_bytes);
+    std::memcpy(handleBuffer.data(), pHandle, handleBuffer.size());
+
+    Fd fileFd{::open_by_handle_at(filesystem->mountFd.get(), reinterpret_cast<file_handle*>(handleBuffer.data()),
+        O_PATH | O_CLOEXEC)};
+    if(!fileFd)
+        return "<deleted>";
+
+    char link[32]{};
+    ::snprintf(link, sizeof(link), "/proc/self/fd/%d", fileFd.get());
+    char path[PATH_MAX];
+    const auto length = ::readlink(link, path, sizeof(path));
+    return length > 0 ? std::string{path, static_cast<std::size_t>(length)} : std::string{"<unknown>"};
+}
+
+std::vector<FileAccess::Row> FileAccess::takeCounts()
+{
+    std::vector<Row> rows;
+    rows.reserve(_counts.size());
+    for(const auto &[key, counts] : _counts)
+        rows.push_back({static_cast<pid_t>(key >> 32), static_cast<std::uint32_t>(key), counts});
+
+    _counts.clear();
+    // Processes are asked again, in case they've exec'd (or their pid was reused)
+    _selected.clear();
+
+    // The rows' paths are needed until the next receive()
+    _resetPaths = _paths.size() >= maxPaths;
+    return rows;
+}
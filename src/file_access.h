@@ -0,0 +1,104 @@
+#pragma once
+
+#include "util.h"
+#include "fd.h"
+#include <unordered_map>
+#include <deque>
+
+// The files each process opens, reads and writes, from fanotify (-F). Needs
+// CAP_SYS_ADMIN and Linux 5.1 (for FAN_REPORT_FID).
+//
+// Whole filesystems are marked, and events identify files by handle rather than
+// with an open fd, so an event costs no syscalls of ours. The kernel also merges
+// repeated reads or writes of a file by a process while they're queued. A handle
+// is resolved to a path the first time it's seen and interned, so the counts are
+// keyed by (pid, file id) and a path is only stored once however many processes
+// use it.
+class FileAccess
+{
+public:
+    struct Counts
+    {
+        std::uint64_t opens{};
+        std::uint64_t reads{};
+        std::uint64_t writes{};
+
+        std::uint64_t total() const {return opens + reads + writes;}
+    };
+
+    struct Row
+    {
+        pid_t pid{};
+        std::uint32_t fileId{};
+        Counts counts;
+    };
+
+    struct Stats
+    {
+        std::uint64_t events{};
+        // Times the kernel's queue overflowed, losing events
+        std::uint64_t overflows{};
+        std::size_t paths{};
+
+        std::string toString() const;
+    };
+
+private:
+    using SelectedFuncT = std::function<bool(pid_t)>;
+
+public:
+    // paths: anything on each of the filesystems to watch, e.g "/"
+    explicit FileAccess(const std::vector<std::string> &paths);
+
+public:
+    // Which processes to count - asked once per pid between takeCounts(), and
+    // again after the pid execs
+    void onSelect(SelectedFuncT func) { _selectedFunc = std::move(func); }
+    // Count the events that arrive within timeout
+    void receive(std::chrono::milliseconds timeout);
+    // The counts so far, which start again. Their file ids are valid until the
+    // next receive().
+    std::vector<Row> takeCounts();
+    const std::string &path(std::uint32_t fileId) const {return _paths[fileId];}
+
+    Stats stats() const {return {_events, _overflows, _paths.size()};}
+
+private:
+    struct Filesystem
+    {
+        std::uint64_t fsid{};
+        // To open handles with
+        Fd mountFd;
+    };
+
+    struct StringHash
+    {
+        using is_transparent = void;
+        std::size_t operator()(std::string_view value) const {return std::hash<std::string_view>{}(value);}
+    };
+
+private:
+    void processEvent(std::span<const std::uint8_t> event);
+    // The id of the file with this fsid and handle, resolving it if it's new
+    std::uint32_t intern(std::uint64_t fsid, std::string_view handleKey, const void *pHandle);
+    std::string resolve(std::uint64_t fsid, const void *pHandle) const;
+
+private:
+    Fd _fanotify;
+    std::vector<Filesystem> _filesystems;
+    std::vector<std::uint8_t> _buffer;
+    const pid_t _ownPid;
+
+    // fsid + handle -> file id, an index into _paths
+    std::unordered_map<std::string, std::uint32_t, StringHash, std::equal_to<>> _fileIds;
+    std::deque<std::string> _paths;
+    bool _resetPaths{false};
+
+    // (pid << 32 | file id) -> counts
+    std::unordered_map<std::uint64_t, Counts> _counts;
+    std::unordered_map<pid_t, bool> _selected;
+    SelectedFuncT _selectedFunc=[](pid_t){return true;};
+
+    std::uint64_t _events{};
+    std::uint64_t _overflows{};
+};
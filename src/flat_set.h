@@ -0,0 +1,74 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <iterator>
+
+// A set stored as a sorted vector. Lookups are a binary search over contiguous
+// memory rather than a pointer-chasing tree walk, and building one is a single
+// allocation instead of one per element. Insertion is O(n), so this is meant for
+// sets that are read far more often than they are modified (e.g selected pids).
+template <typename T>
+class FlatSet
+{
+public:
+    using value_type = T;
+    using const_iterator = typename std::vector<T>::const_iterator;
+
+public:
+    FlatSet() = default;
+    FlatSet(std::initializer_list<T> values) : FlatSet(std::vector<T>(values)) {}
+    explicit FlatSet(std::vector<T> values)
+    : _values{std::move(values)}
+    {
+        std::sort(_values.begin(), _values.end());
+        _values.erase(std::unique(_values.begin(), _values.end()), _values.end());
+    }
+
+    template <typename InputIt>
+    FlatSet(InputIt first, InputIt last) : FlatSet(std::vector<T>(first, last)) {}
+
+public:
+    bool contains(const T &value) const {return std::binary_search(_values.begin(), _values.end(), value);}
+    std::size_t count(const T &value) const {return contains(value) ? 1 : 0;}
+
+    bool insert(const T &value)
+    {
+        auto it = std::lower_bound(_values.begin(), _values.end(), value);
+        if(it != _values.end() && *it == value)
+            return false;
+
+        _values.insert(it, value);
+        return true;
+    }
+
+    bool erase(const T &value)
+    {
+        auto it = std::lower_bound(_values.begin(), _values.end(), value);
+        if(it == _values.end() || *it != value)
+            return false;
+
+        _values.erase(it);
+        return true;
+    }
+
+    // Union with another set (named after std::set::merge)
+    void merge(const FlatSet &other)
+    {
+        std::vector<T> merged;
+        merged.reserve(_values.size() + other._values.size());
+        std::set_union(_values.begin(), _values.end(), other._values.begin(), other._values.end(),
+            std::back_inserter(merged));
+        _values = std::move(merged);
+    }
+
+    std::size_t size() const {return _values.size();}
+    bool empty() const {return _values.empty();}
+    const_iterator begin() const {return _values.begin();}
+    const_iterator end() const {return _values.end();}
+
+    bool operator==(const FlatSet&) const = default;
+
+private:
+    std::vector<T> _values;
+};
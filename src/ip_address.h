@@ -1,6 +1,10 @@
 #pragma once
 #include "util.h"
 
+// Raw (network order) address bytes of either IP version, used as a lookup key.
+// IPv4 addresses take the first 4 bytes and the rest are zero.
+using IPAddressBytes = std::array<std::uint8_t, 16>;
+
 class IPv4Address
 {
 public:
@@ -0,0 +1,450 @@
+#include "linux_engine.h"
+#include "packet_socket.h"
+#include "ebpf_socket_owners.h"
+#include "cgroup_traffic.h"
+#include "socket_traffic.h"
+#include "process_selection.h"
+#include "tcp_health.h"
+#include "process_cgroups.h"
+#include "process_cache.h"
+#include "exec_summary.h"
+#include "proc_connector.h"
+#include "task_stats.h"
+#include "timeline.h"
+#include "file_access.h"
+#include "proc.h"
+#include "view.h"
+#include <thread>
+#include <map>
+#include <mutex>
+#include <sys/wait.h>
+
+namespace fs = std::filesystem;
+namespace
+{
+    std::string basename(const std::string& path)
+    {
+        return static_cast<std::string>(fs::path(path).filename());
+    }
+
+    // How often to report proc connector statistics in verbose mode
+    const auto execStatsInterval{std::chrono::seconds{10}};
+    // -F reports without --summary, and how many rows they show without -v
+    const auto fileAccessInterval{std::chrono::seconds{5}};
+    const std::size_t fileAccessRows{25};
+
+    std::string exitStatusToString(std::uint32_t status)
+    {
+        if(WIFSIGNALED(status))
+            return fmt::format("signal {}", WTERMSIG(status));
+        return fmt::format("exit {}", WEXITSTATUS(status));
+    }
+
+    // path: the process's path, event.path being only its comm
+    void printExit(const ProcessEvent &event, const std::string &path)
+    {
+        const auto &usage = *event.usage;
+        fmt::print("exit pid: {} ppid: {} - {} ({}) user: {:.1f}ms sys: {:.1f}ms rss: {}KB read: {}B write: {}B",
+            event.pid, event.ppid, path, exitStatusToString(event.exitStatus), usage.userTimeUs / 1000.0,
+            usage.systemTimeUs / 1000.0, usage.maxRssKb, usage.readBytes, usage.writeBytes);
+
+        // Delays are only counted with delay accounting on
+        if(usage.cpuDelayNs || usage.blockIoDelayNs)
+            fmt::print(" cpu delay: {:.1f}ms io delay: {:.1f}ms", usage.cpuDelayNs / 1e6, usage.blockIoDelayNs / 1e6);
+        fmt::print("\n");
+        ::fflush(stdout);
+    }
+}
+
+std::unique_ptr<CaptureDevice> LinuxEngine::createCaptureDevice() const
+{
+    // Capture on all interfaces
+    return std::make_unique<PacketSocket>();
+}
+
+std::unique_ptr<SocketOwners> LinuxEngine::createSocketOwners(const Config &config) const
+{
+    if(config.ebpf())
+        return std::make_unique<EbpfSocketOwners>(config.verbose());
+
+    return Engine::createSocketOwners(config);
+}
+
+void LinuxEngine::showConnections(const Config &config)
+{
+    if(!config.tcpInfo() || config.watchInterval())
+    {
+        Engine::showConnections(config);
+        return;
+    }
+
+    // Parse everything up front so a typo fails before the dump
+    std::optional<TcpHealth::Metric> sortMetric;
+    std::optional<TcpHealth::Filter> filter;
+    try
+    {
+        if(!config.sortMetric().empty())
+            sortMetric = TcpHealth::parseMetric(config.sortMetric());
+        filter.emplace(config.whereExpression());
+    }
+    catch(const std::invalid_argument &ex)
+    {
+        throw cxxopts::OptionParseException{ex.what()};
+    }
+
+    ProcessSelection processes{config.processes()};
+    const auto pids = processes.snapshot();
+
+    // A single dump (with tcp_info) serves both IP versions
+    const auto allConnections = PortFinder::allConnections(true);
+    const View::Socket<PortFinder::Connection> socketView{config};
+    PortFinder::ProcessPaths processPaths;
+
+    auto showConnectionsForIPVersion = [&](IPVersion ipVersion)
+    {
+        std::vector<const PortFinder::Connection*> connections;
+        for(const auto &connection : allConnections)
+        {
+            // Without -p, show the health of every socket in the system
+            if(config.processesProvided() && !pids->contains(connection.pid()))
+                continue;
+            if(PortFinder::matchesIpVersion(connection, ipVersion) && filter->matches(connection))
+                connections.push_back(&connection);
+        }
+
+        if(sortMetric)
+        {
+            std::stable_sort(connections.begin(), connections.end(), [&](const auto *pLeft, const auto *pRight)
+            {
+                return TcpHealth::value(*pLeft, *sortMetric) > TcpHealth::value(*pRight, *sortMetric);
+            });
+        }
+
+        std::string output{ipVersionToString(ipVersion) + "\n==\n"};
+        for(const auto *pConnection : connections)
+        {
+            const auto &path = config.verbose() ? processPaths.path(pConnection->pid()) : processPaths.name(pConnection->pid());
+            socketView.render(*pConnection, path, config.verbose(), output, " " + TcpHealth::columns(*pConnection));
+        }
+        std::cout << output;
+    };
+
+    if(config.ipVersion() == IPVersion::Both)
+    {
+        showConnectionsForIPVersion(IPv4);
+        showConnectionsForIPVersion(IPv6);
+    }
+    else
+        showConnectionsForIPVersion(config.ipVersion());
+}
+
+void LinuxEngine::showExec(const Config &config)
+{
+    ProcConnector procConnector;
+    ProcessSelection processes{config.processes()};
+    ProcessSelection parentProcesses{config.parentProcesses()};
+    auto lastStatsTime{std::chrono::steady_clock::now()};
+    std::optional<ExecSummary> summary;
+    if(config.execSummaryInterval())
+        summary.emplace(std::chrono::seconds{config.execSummaryInterval()}, true);
+    std::mutex outputMutex;
+    const View::Exec<ProcessEvent> execView{config};
+    std::optional<Timeline> timeline;
+    if(!config.timelinePath().empty())
+        timeline.emplace(config.timelinePath());
+    // taskstats only knows an exiting process by its comm, the proc connector's
+    // exit knows its path. Whichever of the two arrives first leaves an entry here
+    // (the path, or an empty marker) for the second to remove. Guarded by outputMutex.
+    std::unordered_map<pid_t, std::string> exitPaths;
+    // Exits come from taskstats, on a thread of its own - declared after everything
+    // its callback uses, so that thread is stopped before any of it is destroyed
+    std::optional<TaskStats> taskStats;
+    if(config.execExits())
+        taskStats.emplace();
+
+    // -P selects whole subtrees, so the process tree is needed from the start
+    // (the events keep it current from here on)
+    if(!config.parentProcesses().empty())
+        ProcessCache::shared().seed();
+
+    auto showStats = [&]
+    {
+        if(config.verbose() && std::chrono::steady_clock::now() - lastStatsTime >= execStatsInterval)
+        {
+            std::cerr << procConnector.stats().toString() << std::endl;
+            std::cerr << ProcessCache::shared().stats().toString() << std::endl;
+            if(taskStats)
+                std::cerr << taskStats->stats().toString() << std::endl;
+            if(timeline)
+                std::cerr << timeline->stats().toString() << std::endl;
+            lastStatsTime = std::chrono::steady_clock::now();
+        }
+    };
+
+    procConnector.onProcessStarted([&](const auto &event)
+    {
+        // Whatever's left of an earlier process with this pid (one of its exit
+        // notifications was lost)
+        if(taskStats)
+        {
+            std::lock_guard lock{outputMutex};
+            exitPaths.erase(event.pid);
+        }
+
+        // Keep the selections current - the process may be too new for a rescan to have found it
+        processes.processStarted(event.pid, event.path);
+        parentProcesses.processStarted(event.pid, event.path);
+        showStats();
+
+        if(config.processesProvided() &&
+           !processes.contains(event.pid) &&
+           !parentProcesses.containsAncestorOf(event.pid))
+        {
+            return;
+        }
+
+        if(timeline)
+            timeline->started(event, Timeline::now());
+
+        std::lock_guard lock{outputMutex};
+        if(summary)
+            summary->add(event.path, event.ppid);
+        else
+            execView.render(event);
+    });
+
+    procConnector.onProcessExited([&](const auto &event)
+    {
+        processes.processExited(event.pid);
+        parentProcesses.processExited(event.pid);
+        if(timeline)
+            timeline->exited(event.pid, Timeline::now());
+
+        if(taskStats)
+        {
+            std::lock_guard lock{outputMutex};
+            if(!exitPaths.erase(event.pid))
+                exitPaths.emplace(event.pid, event.path);
+        }
+    });
+
+    if(taskStats)
+    {
+        taskStats->onProcessExited([&](const auto &event)
+        {
+            std::lock_guard lock{outputMutex};
+
+            // Until the proc connector's exit the process is still cached
+            std::string path;
+            if(auto node = exitPaths.extract(event.pid))
+                path = std::move(node.mapped());
+            else
+            {
+                path = ProcessCache::shared().path(event.pid);
+                exitPaths.emplace(event.pid, std::string{});
+            }
+            if(path.empty())
+                path = event.path;
+
+            // The proc connector may have seen the exit first and dropped the
+            // process from the selections, so its parent and name are checked too
+            if(config.processesProvided() &&
+               !processes.contains(event.pid) && !processes.matchesName(path) &&
+               !parentProcesses.contains(event.ppid) && !parentProcesses.containsAncestorOf(event.ppid))
+            {
+                return;
+            }
+
+            if(summary)
+                summary->exited(path, *event.usage);
+            else
+                printExit(event, path);
+        });
+        taskStats->start();
+    }
+
+    // Infinite loop
+    procConnector.receive();
+}
+
+void LinuxEngine::showFileAccess(const Config &config)
+{
+    FileAccess fileAccess{config.fileAccessPaths()};
+    ProcessSelection processes{config.processes()};
+    ProcessSelection parentProcesses{config.parentProcesses()};
+    const std::chrono::seconds interval{config.execSummaryInterval() ? std::chrono::seconds{config.execSummaryInterval()} :
+        fileAccessInterval};
+
+    // There are no process events to keep the process tree current here, so it's
+    // refreshed every interval instead (new pids are otherwise looked up as needed)
+    auto &cache = ProcessCache::shared();
+    if(!config.parentProcesses().empty())
+        cache.seed();
+
+    // Processes are named when they're selected, as they may be gone by the report
+    std::unordered_map<pid_t, std::string> names;
+    fileAccess.onSelect([&](pid_t pid)
+    {
+        if(config.processesProvided() && !processes.contains(pid) && !parentProcesses.containsAncestorOf(pid))
+            return false;
+
+        names.insert_or_assign(pid, basename(Proc::pidToPath(pid)));
+        return true;
+    });
+
+    auto nextReport = std::chrono::steady_clock::now() + interval;
+    while(true)
+    {
+        const auto now = std::chrono::steady_clock::now();
+        if(now < nextReport)
+        {
+            fileAccess.receive(std::chrono::duration_cast<std::chrono::milliseconds>(nextReport - now));
+            continue;
+        }
+        nextReport += interval;
+
+        // Busiest first
+        auto rows = fileAccess.takeCounts();
+        std::sort(rows.begin(), rows.end(), [](const auto &left, const auto &right)
+        {
+            return left.counts.total() > right.counts.total();
+        });
+        if(!config.verbose() && rows.size() > fileAccessRows)
+            rows.resize(fileAccessRows);
+
+        fmt::print("{:<24} {:>8} {:>8} {:>8} {:>8}  {}\n", "PROCESS", "PID", "OPENS", "READS", "WRITES", "PATH");
+        for(const auto &row : rows)
+        {
+            const auto &name = names[row.pid];
+            fmt::print("{:<24} {:>8} {:>8} {:>8} {:>8}  {}\n", name.empty() ? "<unknown>" : name, row.pid,
+                row.counts.opens, row.counts.reads, row.counts.writes, fileAccess.path(row.fileId));
+        }
+        fmt::print("\n");
+        ::fflush(stdout);
+
+        if(config.verbose())
+            std::cerr << fileAccess.stats().toString() << std::endl;
+
+        names.clear();
+        if(!config.parentProcesses().empty())
+            cache.refresh();
+    }
+}
+
+void LinuxEngine::showCgroupTraffic(const Config &config)
+{
+    const std::chrono::seconds interval{config.cgroupTrafficInterval()};
+    CgroupTraffic traffic;
+    auto previous = traffic.totals();
+
+    // --cgroup narrows down the cgroups shown
+    const auto &selectedCgroups = config.processes().cgroups();
+    auto isSelected = [&](const std::string &path)
+    {
+        return selectedCgroups.empty() || std::any_of(selectedCgroups.begin(), selectedCgroups.end(),
+            [&](const std::string &cgroup) {return path.find(cgroup) != std::string::npos;});
+    };
+
+    while(true)
+    {
+        std::this_thread::sleep_for(interval);
+        auto current = traffic.totals();
+
+        // Only cgroups with traffic this interval, busiest first
+        std::vector<std::pair<std::uint64_t, CgroupTraffic::Counters>> rows;
+        std::vector<std::uint64_t> idle;
+        for(const auto &[cgroupId, counters] : current)
+        {
+            auto it = previous.find(cgroupId);
+            const auto delta = it == previous.end() ? counters : counters - it->second;
+            if(delta.empty())
+                idle.push_back(cgroupId);
+            else if(isSelected(traffic.cgroupPath(cgroupId)))
+                rows.emplace_back(cgroupId, delta);
+        }
+
+        // Deleted cgroups can only be idle ones
+        traffic.removeDeleted(idle);
+
+        std::sort(rows.begin(), rows.end(), [](const auto &left, const auto &right)
+        {
+            return left.second.rxBytes + left.second.txBytes > right.second.rxBytes + right.second.txBytes;
+        });
+
+        const auto perSecond = [&](std::uint64_t value) {return value / interval.count();};
+        fmt::print("{:<48} {:>12} {:>10} {:>12} {:>10}\n", "CGROUP", "RX B/s", "RX pkt/s", "TX B/s", "TX pkt/s");
+        for(const auto &[cgroupId, delta] : rows)
+        {
+            const auto &path = traffic.cgroupPath(cgroupId);
+            fmt::print("{:<48} {:>12} {:>10} {:>12} {:>10}\n", path.empty() ? fmt::format("<{}>", cgroupId) : path,
+                perSecond(delta.rxBytes), perSecond(delta.rxPackets), perSecond(delta.txBytes), perSecond(delta.txPackets));
+        }
+        fmt::print("\n");
+        ::fflush(stdout);
+
+        previous = std::move(current);
+    }
+}
+
+void LinuxEngine::showSocketTraffic(const Config &config)
+{
+    const std::chrono::seconds interval{config.socketTrafficInterval()};
+    ProcessSelection processes{config.processes()};
+    SocketTraffic traffic;
+
+    if(!traffic.tracksClosedSockets())
+        std::cerr << "Warning: can't see sockets being closed (needs CAP_NET_ADMIN), their final traffic is missed\n";
+
+    while(true)
+    {
+        traffic.waitFor(interval);
+
+        // Busiest first
+        std::vector<std::pair<pid_t, SocketTraffic::Counters>> rows;
+        for(const auto &[pid, counters] : traffic.sample())
+        {
+            if(!config.processesProvided() || (pid && processes.contains(pid)))
+                rows.emplace_back(pid, counters);
+        }
+
+        const auto byTotal = [](const auto &left, const auto &right)
+        {
+            return left.second.sent + left.second.received > right.second.sent + right.second.received;
+        };
+        const auto perSecond = [&](std::uint64_t value) {return value / interval.count();};
+
+        if(config.groupByCgroup())
+        {
+            std::map<std::string, SocketTraffic::Counters> cgroupTotals;
+            for(const auto &[pid, delta] : rows)
+            {
+                cgroupTotals[ProcessCgroups::shared().lookup(pid).path] += delta;
+            }
+
+            std::vector<std::pair<std::string, SocketTraffic::Counters>> cgroupRows{cgroupTotals.begin(), cgroupTotals.end()};
+            std::stable_sort(cgroupRows.begin(), cgroupRows.end(), byTotal);
+
+            fmt::print("{:<48} {:>12} {:>12}\n", "CGROUP", "SENT B/s", "RECV B/s");
+            for(const auto &[path, delta] : cgroupRows)
+            {
+                fmt::print("{:<48} {:>12} {:>12}\n", path.empty() ? "<unknown>" : path,
+                    perSecond(delta.sent), perSecond(delta.received));
+            }
+        }
+        else
+        {
+            std::sort(rows.begin(), rows.end(), byTotal);
+
+            fmt::print("{:<32} {:>8} {:>12} {:>12}\n", "PROCESS", "PID", "SENT B/s", "RECV B/s");
+            for(const auto &[pid, delta] : rows)
+            {
+                const auto path = pid ? PortFinder::pidToPath(pid) : std::string{};
+                const auto name = config.verbose() ? path : basename(path);
+                fmt::print("{:<32} {:>8} {:>12} {:>12}\n", name.empty() ? "<unknown>" : name,
+                    pid, perSecond(delta.sent), perSecond(delta.received));
+            }
+        }
+        fmt::print("\n");
+        ::fflush(stdout);
+    }
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "common.h"
+#include "engine.h"
+
+class LinuxEngine : public Engine
+{
+protected:
+    virtual void showConnections(const Config &config) override;
+    virtual void showExec(const Config &config) override;
+    virtual void showFileAccess(const Config &config) override;
+    virtual void showCgroupTraffic(const Config &config) override;
+    virtual void showSocketTraffic(const Config &config) override;
+    virtual std::unique_ptr<CaptureDevice> createCaptureDevice() const override;
+    virtual std::unique_ptr<SocketOwners> createSocketOwners(const Config &config) const override;
+};
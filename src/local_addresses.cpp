@@ -0,0 +1,210 @@
+#include "local_addresses.h"
+#include <ifaddrs.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#if defined(RUMI_MACOS)
+#include <net/route.h>
+#elif defined(RUMI_LINUX)
+#include "net_namespace.h"
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#endif
+
+namespace
+{
+    // How often the watch thread checks whether it should stop
+    const int stopPollIntervalMs{500};
+#if defined(RUMI_LINUX)
+    // How often to look for new (or gone) network namespaces and their addresses
+    const auto namespaceRescanInterval{std::chrono::seconds{5}};
+#endif
+
+    Fd openChangeSocket()
+    {
+#if defined(RUMI_MACOS)
+        Fd fd{::socket(PF_ROUTE, SOCK_RAW, AF_UNSPEC)};
+        if(!fd)
+            throw SystemError("Could not open routing socket");
+#elif defined(RUMI_LINUX)
+        Fd fd{::socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)};
+        if(!fd)
+            throw SystemError("Could not open rtnetlink socket");
+
+        sockaddr_nl address{};
+        address.nl_family = AF_NETLINK;
+        address.nl_groups = RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+        if(::bind(fd.get(), reinterpret_cast<sockaddr*>(&address), sizeof(address)))
+            throw SystemError("Could not bind rtnetlink socket");
+#endif
+        return fd;
+    }
+}
+
+LocalAddresses::LocalAddresses()
+#if defined(RUMI_LINUX)
+: _ownNamespace{NetNamespace::current()}
+#else
+: _ownNamespace{0}
+#endif
+, _changeSocket{openChangeSocket()}
+{
+    refresh();
+    _watchThread = std::thread{[this] { watchLoop(); }};
+}
+
+LocalAddresses::~LocalAddresses()
+{
+    _stop = true;
+    _watchThread.join();
+}
+
+std::optional<std::uint32_t> LocalAddresses::namespaceOf(IPVersion ipVersion, const IPAddressBytes &address) const
+{
+    std::shared_lock lock{_mutex};
+    const auto &addresses = ipVersion == IPv4 ? _ipv4Addresses : _ipv6Addresses;
+
+    // Entries are sorted by address then namespace, and our own namespace's
+    // entry is the only one for an address it has
+    auto it = std::lower_bound(addresses.begin(), addresses.end(), AddressTable::value_type{address, 0});
+    if(it == addresses.end() || it->first != address)
+        return {};
+
+    return it->second;
+}
+
+void LocalAddresses::refresh()
+{
+    std::vector<AddressTable::value_type> ipv4Addresses;
+    std::vector<AddressTable::value_type> ipv6Addresses;
+
+#if defined(RUMI_LINUX)
+    NetNamespace::forEach(NetNamespace::list(), [&](const NetNamespace::Info &ns)
+    {
+        addInterfaceAddresses(ns.inode, ipv4Addresses, ipv6Addresses);
+    });
+
+    // Every namespace has its own loopback addresses, and containers can reuse
+    // ours: an address we have ourselves is always ours
+    for(auto *pAddresses : {&ipv4Addresses, &ipv6Addresses})
+    {
+        FlatSet<IPAddressBytes> own;
+        for(const auto &[address, netns] : *pAddresses)
+        {
+            if(netns == _ownNamespace)
+                own.insert(address);
+        }
+
+        std::erase_if(*pAddresses, [&](const auto &entry)
+        {
+            return entry.second != _ownNamespace && own.contains(entry.first);
+        });
+    }
+#else
+    addInterfaceAddresses(_ownNamespace, ipv4Addresses, ipv6Addresses);
+#endif
+
+    AddressTable ipv4Table{std::move(ipv4Addresses)};
+    AddressTable ipv6Table{std::move(ipv6Addresses)};
+
+    std::unique_lock lock{_mutex};
+    _ipv4Addresses = std::move(ipv4Table);
+    _ipv6Addresses = std::move(ipv6Table);
+}
+
+void LocalAddresses::addInterfaceAddresses(std::uint32_t netns, std::vector<AddressTable::value_type> &ipv4Addresses,
+    std::vector<AddressTable::value_type> &ipv6Addresses)
+{
+    ifaddrs *pAddresses{nullptr};
+    if(::getifaddrs(&pAddresses))
+        throw SystemError("Could not list interface addresses");
+
+    auto freeAddresses = scopeGuard([&] { ::freeifaddrs(pAddresses); });
+
+    for(const ifaddrs *pAddress = pAddresses; pAddress; pAddress = pAddress->ifa_next)
+    {
+        if(!pAddress->ifa_addr)
+            continue;
+
+        IPAddressBytes bytes{};
+        if(pAddress->ifa_addr->sa_family == AF_INET)
+        {
+            const auto &address = reinterpret_cast<const sockaddr_in*>(pAddress->ifa_addr)->sin_addr;
+            std::memcpy(bytes.data(), &address, sizeof(address));
+            ipv4Addresses.emplace_back(bytes, netns);
+        }
+        else if(pAddress->ifa_addr->sa_family == AF_INET6)
+        {
+            const auto &address = reinterpret_cast<const sockaddr_in6*>(pAddress->ifa_addr)->sin6_addr;
+            std::memcpy(bytes.data(), &address, bytes.size());
+            // macOS embeds the scope id of link-local addresses in bytes 2-3,
+            // it never appears on the wire
+            if(IN6_IS_ADDR_LINKLOCAL(&address))
+                bytes[2] = bytes[3] = 0;
+            ipv6Addresses.emplace_back(bytes, netns);
+        }
+    }
+}
+
+void LocalAddresses::watchLoop()
+{
+    std::vector<std::uint8_t> buffer(64 * 1024);
+#if defined(RUMI_LINUX)
+    auto lastRefresh = std::chrono::steady_clock::now();
+#endif
+
+    while(!_stop)
+    {
+        bool changed{false};
+
+        pollfd pollFd{_changeSocket.get(), POLLIN, 0};
+        if(::poll(&pollFd, 1, stopPollIntervalMs) <= 0)
+        {
+#if defined(RUMI_LINUX)
+            changed = std::chrono::steady_clock::now() - lastRefresh >= namespaceRescanInterval;
+#endif
+            if(!changed)
+                continue;
+        }
+
+        // Drain everything queued, refreshing once if any of it was an address change
+        ssize_t length{0};
+        while((length = ::recv(_changeSocket.get(), buffer.data(), buffer.size(), MSG_DONTWAIT)) > 0)
+            changed = changed || isAddressChange({buffer.data(), static_cast<std::size_t>(length)});
+
+        // We may have missed notifications if the socket buffer overflowed, so refresh anyway
+        if(length < 0 && errno == ENOBUFS)
+            changed = true;
+
+        if(changed)
+        {
+            try
+            {
+                refresh();
+#if defined(RUMI_LINUX)
+                lastRefresh = std::chrono::steady_clock::now();
+#endif
+            }
+            catch(const SystemError &error)
+            {
+                // Keep the previous table
+                std::cerr << error.what() << std::endl;
+            }
+        }
+    }
+}
+
+bool LocalAddresses::isAddressChange(std::span<const std::uint8_t> message)
+{
+#if defined(RUMI_MACOS)
+    // The routing socket also reports route and link changes, which we don't care about
+    if(message.size() < sizeof(rt_msghdr))
+        return false;
+
+    const auto type = reinterpret_cast<const rt_msghdr*>(message.data())->rtm_type;
+    return type == RTM_NEWADDR || type == RTM_DELADDR;
+#elif defined(RUMI_LINUX)
+    // We're only subscribed to the address groups
+    return !message.empty();
+#endif
+}
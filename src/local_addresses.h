@@ -0,0 +1,57 @@
+#pragma once
+
+#include "common.h"
+#include "ip_address.h"
+#include "fd.h"
+#include <shared_mutex>
+#include <mutex>
+#include <thread>
+#include <atomic>
+
+// The addresses of this machine's interfaces, used to tell which side of a
+// captured packet is local. The table is a getifaddrs() snapshot, taken again
+// whenever the kernel announces an address change (rtnetlink on Linux, the
+// routing socket on macOS). On Linux it covers every network namespace, so
+// that container addresses are local too (and we know whose they are); as
+// containers come and go without telling us, the namespaces are also rescanned
+// periodically.
+class LocalAddresses
+{
+public:
+    LocalAddresses();
+    ~LocalAddresses();
+
+    LocalAddresses(const LocalAddresses&) = delete;
+    LocalAddresses& operator=(const LocalAddresses&) = delete;
+
+public:
+    bool contains(IPVersion ipVersion, const IPAddressBytes &address) const {return namespaceOf(ipVersion, address).has_value();}
+    // The network namespace the address belongs to, empty if it isn't local. On
+    // macOS, and for addresses of our own namespace, that's ownNamespace().
+    std::optional<std::uint32_t> namespaceOf(IPVersion ipVersion, const IPAddressBytes &address) const;
+    std::uint32_t ownNamespace() const {return _ownNamespace;}
+
+private:
+    // Address -> the namespace it belongs to
+    using AddressTable = FlatSet<std::pair<IPAddressBytes, std::uint32_t>>;
+
+private:
+    void refresh();
+    // Add the interface addresses of the namespace we're running in
+    static void addInterfaceAddresses(std::uint32_t netns, std::vector<AddressTable::value_type> &ipv4Addresses,
+        std::vector<AddressTable::value_type> &ipv6Addresses);
+    void watchLoop();
+    // Is the message read from the change socket an address change?
+    static bool isAddressChange(std::span<const std::uint8_t> message);
+
+private:
+    const std::uint32_t _ownNamespace;
+    mutable std::shared_mutex _mutex;
+    AddressTable _ipv4Addresses;
+    AddressTable _ipv6Addresses;
+
+    // Delivers address change notifications
+    Fd _changeSocket;
+    std::atomic<bool> _stop{false};
+    std::thread _watchThread;
+};
@@ -7,7 +7,6 @@
 class MacEngine : public Engine
 {
 protected:
-    virtual void showTraffic(const Config &config) override;
-    virtual void showConnections(const Config &config) override;
     virtual void showExec(const Config &config) override;
+    virtual std::unique_ptr<CaptureDevice> createCaptureDevice() const override;
 };
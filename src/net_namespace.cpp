@@ -0,0 +1,155 @@
+#include "net_namespace.h"
+#include "fd.h"
+#include "util.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+
+namespace
+{
+    std::string nsPath(pid_t pid)
+    {
+        return fmt::format("/proc/{}/ns/net", pid);
+    }
+
+    std::optional<std::uint32_t> namespaceInode(const std::string &path)
+    {
+        struct stat info{};
+        if(::stat(path.c_str(), &info))
+            return {};
+
+        return static_cast<std::uint32_t>(info.st_ino);
+    }
+
+    // How long list() reuses its last /proc scan - namespaces come and go with
+    // containers, far less often than the sockets in them are dumped
+    const auto rescanInterval{std::chrono::seconds{5}};
+
+    // list()'s last scan, shared by all its callers
+    struct ListCache
+    {
+        std::mutex mutex;
+        std::vector<NetNamespace::Info> namespaces;
+        std::chrono::steady_clock::time_point scanned;
+        bool stale{true};
+    };
+
+    ListCache &listCache()
+    {
+        static ListCache cache;
+        return cache;
+    }
+
+    // Stat every process for the namespace it's in
+    std::vector<NetNamespace::Info> scan()
+    {
+        std::vector<NetNamespace::Info> namespaces{{NetNamespace::current(), ::getpid()}};
+        std::unordered_set<std::uint32_t> seen{NetNamespace::current()};
+
+        DIR *pDir = ::opendir("/proc");
+        if(!pDir)
+            throw SystemError("Could not open /proc");
+
+        auto closeDir = scopeGuard([&] { ::closedir(pDir); });
+        while(const dirent *pEntry = ::readdir(pDir))
+        {
+            char *pEnd{nullptr};
+            const auto pid = static_cast<pid_t>(std::strtol(pEntry->d_name, &pEnd, 10));
+            if(pid <= 0 || *pEnd != '\0')
+                continue;
+
+            // One stat() per process; the namespaces themselves are only visited once each
+            const auto inode = namespaceInode(nsPath(pid));
+            if(inode && seen.insert(*inode).second)
+                namespaces.push_back({*inode, pid});
+        }
+
+        return namespaces;
+    }
+}
+
+namespace NetNamespace
+{
+std::uint32_t current()
+{
+    static const std::uint32_t inode = namespaceInode("/proc/self/ns/net").value_or(0);
+    return inode;
+}
+
+std::vector<Info> list()
+{
+    auto &cache = listCache();
+    std::lock_guard lock{cache.mutex};
+
+    const auto now = std::chrono::steady_clock::now();
+    if(cache.stale || now - cache.scanned >= rescanInterval)
+    {
+        cache.namespaces = scan();
+        cache.scanned = now;
+        cache.stale = false;
+    }
+
+    return cache.namespaces;
+}
+
+void invalidate()
+{
+    auto &cache = listCache();
+    std::lock_guard lock{cache.mutex};
+    cache.stale = true;
+}
+
+void forEach(const std::vector<Info> &namespaces, const std::function<void(const Info&)> &func)
+{
+    std::vector<const Info*> others;
+    for(const auto &ns : namespaces)
+    {
+        if(ns.inode == current())
+            func(ns);
+        else
+            others.push_back(&ns);
+    }
+
+    if(others.empty())
+        return;
+
+    // The worker is discarded afterwards, so it never has to find its way back.
+    // Exceptions are passed on to the caller.
+    std::exception_ptr pException;
+    std::thread worker{[&]
+    {
+        try
+        {
+            for(const auto *pNs : others)
+            {
+                // The pid may have exited, or been reused by a process in another
+                // namespace - the next list() then looks for the namespace again
+                Fd nsFd{::open(nsPath(pNs->pid).c_str(), O_RDONLY | O_CLOEXEC)};
+                struct stat info{};
+                if(!nsFd || ::fstat(nsFd.get(), &info) || info.st_ino != pNs->inode)
+                {
+                    invalidate();
+                    continue;
+                }
+
+                if(::setns(nsFd.get(), CLONE_NEWNET))
+                    continue;
+
+                func(*pNs);
+            }
+        }
+        catch(...)
+        {
+            pException = std::current_exception();
+        }
+    }};
+    worker.join();
+
+    if(pException)
+        std::rethrow_exception(pException);
+}
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "common.h"
+
+// Network namespaces, for seeing the sockets and addresses of containers. A
+// namespace is identified by the inode of /proc/<pid>/ns/net.
+namespace NetNamespace
+{
+    struct Info
+    {
+        std::uint32_t inode{};
+        // One of the namespace's processes, used to enter it
+        pid_t pid{};
+    };
+
+    // Our own namespace
+    std::uint32_t current();
+    // The distinct namespaces of all (visible) processes, ours first. Finding
+    // them stats every process, so the result is reused for a few seconds.
+    std::vector<Info> list();
+    // Make the next list() look for namespaces again, e.g because one of them
+    // couldn't be entered
+    void invalidate();
+    // Call func for each namespace, from inside it: ours on the calling thread, the
+    // rest in turn on a worker thread that setns()s into them, so the calling
+    // thread never leaves its namespace. Namespaces we can't enter (not root, or
+    // every process in them exited) are skipped.
+    void forEach(const std::vector<Info> &namespaces, const std::function<void(const Info&)> &func);
+}
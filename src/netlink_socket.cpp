@@ -0,0 +1,122 @@
+#include "netlink_socket.h"
+#include <sys/socket.h>
+
+namespace
+{
+    // Large enough for any single netlink datagram the kernel sends us
+    const std::size_t bufferSize{64 * 1024};
+}
+
+NetlinkSocket::NetlinkSocket(int protocol, std::uint32_t groups)
+: _fd{::socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, protocol)}
+, _buffer(bufferSize)
+{
+    if(!_fd)
+        throw SystemError("Could not open netlink socket");
+
+    sockaddr_nl address{};
+    address.nl_family = AF_NETLINK;
+    address.nl_groups = groups;
+    if(::bind(_fd.get(), reinterpret_cast<sockaddr*>(&address), sizeof(address)))
+        throw SystemError("Could not bind netlink socket");
+}
+
+void NetlinkSocket::send(std::uint16_t type, std::uint16_t flags, std::span<const std::uint8_t> payload)
+{
+    std::vector<std::uint8_t> message(NLMSG_SPACE(payload.size()));
+    nlmsghdr *pHeader = reinterpret_cast<nlmsghdr*>(message.data());
+    pHeader->nlmsg_len = NLMSG_LENGTH(payload.size());
+    pHeader->nlmsg_type = type;
+    pHeader->nlmsg_flags = flags;
+    pHeader->nlmsg_seq = ++_sequence;
+    std::copy(payload.begin(), payload.end(), static_cast<std::uint8_t*>(NLMSG_DATA(pHeader)));
+
+    // Address the kernel
+    sockaddr_nl kernel{};
+    kernel.nl_family = AF_NETLINK;
+    if(::sendto(_fd.get(), message.data(), pHeader->nlmsg_len, 0,
+        reinterpret_cast<sockaddr*>(&kernel), sizeof(kernel)) < 0)
+    {
+        throw SystemError("Could not send netlink request");
+    }
+}
+
+std::size_t NetlinkSocket::read(int flags)
+{
+    while(true)
+    {
+        ssize_t length = ::recv(_fd.get(), _buffer.data(), _buffer.size(), flags);
+        if(length >= 0)
+            return static_cast<std::size_t>(length);
+
+        if((flags & MSG_DONTWAIT) && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+
+        // Multicast messages were dropped because we didn't keep up, carry on with the rest
+        if(errno == ENOBUFS)
+            continue;
+
+        if(errno != EINTR)
+            throw SystemError("Could not read from netlink socket");
+    }
+}
+
+void NetlinkSocket::receiveReply(const MsgCallbackT &func)
+{
+    while(true)
+    {
+        int length = static_cast<int>(read());
+        for(auto *pMsg = reinterpret_cast<const nlmsghdr*>(_buffer.data()); NLMSG_OK(pMsg, length);
+            pMsg = NLMSG_NEXT(pMsg, length))
+        {
+            // Left over from an earlier request
+            if(pMsg->nlmsg_seq != _sequence)
+                continue;
+
+            if(pMsg->nlmsg_type == NLMSG_DONE)
+                return;
+
+            if(pMsg->nlmsg_type == NLMSG_ERROR)
+            {
+                const auto *pError = static_cast<const nlmsgerr*>(NLMSG_DATA(pMsg));
+                // An error of 0 is just an ack
+                if(pError->error == 0)
+                    return;
+
+                errno = -pError->error;
+                throw SystemError("Netlink request failed");
+            }
+
+            func(*pMsg);
+
+            // Single part replies are complete after the first message
+            if(!(pMsg->nlmsg_flags & NLM_F_MULTI))
+                return;
+        }
+    }
+}
+
+void NetlinkSocket::receive(const MsgCallbackT &func)
+{
+    while(true)
+    {
+        int length = static_cast<int>(read());
+        for(auto *pMsg = reinterpret_cast<const nlmsghdr*>(_buffer.data()); NLMSG_OK(pMsg, length);
+            pMsg = NLMSG_NEXT(pMsg, length))
+        {
+            func(*pMsg);
+        }
+    }
+}
+
+void NetlinkSocket::receivePending(const MsgCallbackT &func)
+{
+    while(int length = static_cast<int>(read(MSG_DONTWAIT)))
+    {
+        for(auto *pMsg = reinterpret_cast<const nlmsghdr*>(_buffer.data()); NLMSG_OK(pMsg, length);
+            pMsg = NLMSG_NEXT(pMsg, length))
+        {
+            func(*pMsg);
+        }
+    }
+}
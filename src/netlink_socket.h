@@ -0,0 +1,47 @@
+#pragma once
+
+#include "util.h"
+#include "fd.h"
+#include <linux/netlink.h>
+
+// Thin wrapper around an AF_NETLINK socket - sends requests and walks the
+// (possibly multi-part) replies
+class NetlinkSocket
+{
+    using MsgCallbackT = std::function<void(const nlmsghdr&)>;
+
+public:
+    // groups: the multicast groups to subscribe to (if any)
+    NetlinkSocket(int protocol, std::uint32_t groups = 0);
+
+public:
+    // Send a dump request and invoke func for every message in the reply
+    template <typename RequestT>
+    void dump(std::uint16_t type, const RequestT &request, const MsgCallbackT &func)
+    {
+        send(type, NLM_F_REQUEST | NLM_F_DUMP,
+            {reinterpret_cast<const std::uint8_t*>(&request), sizeof(request)});
+        receiveReply(func);
+    }
+
+    // Send a request with an arbitrary payload (no reply is read)
+    void send(std::uint16_t type, std::uint16_t flags, std::span<const std::uint8_t> payload);
+    // Read messages until NLMSG_DONE (or an error) for the last request sent
+    void receiveReply(const MsgCallbackT &func);
+    // Read (multicast) messages forever - every message is passed on, whatever its type
+    void receive(const MsgCallbackT &func);
+    // As above, but only the messages already queued - returns once there are none left
+    void receivePending(const MsgCallbackT &func);
+
+    int fd() const {return _fd.get();}
+
+private:
+    // Read a single datagram into _buffer, returning its length (0 if flags
+    // has MSG_DONTWAIT and nothing is queued)
+    std::size_t read(int flags = 0);
+
+private:
+    Fd _fd;
+    std::uint32_t _sequence{0};
+    std::vector<std::uint8_t> _buffer;
+};
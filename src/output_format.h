@@ -0,0 +1,135 @@
+#pragma once
+
+#include "common.h"
+#include "vendor/cxxopts.h"
+#include <charconv>
+
+// A -f/--format or -c/--cols output template, compiled once up front into its
+// literal text and the emitters of its fields. Rendering an item is then a walk
+// down that list - no parsing or name comparisons per item - and a field that
+// needs looking up (e.g a parent's path) is only looked up if the template
+// uses it.
+//
+// A format is text with field names in braces, e.g "{pid} {name} {args}", with
+// "{{" and "}}" for literal braces. Columns are field names, rendered separated
+// by spaces.
+template <typename ItemT>
+class OutputFormat
+{
+public:
+    // Appends the field's text for the item to output
+    using EmitFuncT = void(*)(const ItemT &item, std::string &output);
+
+    struct Field
+    {
+        std::string_view name;
+        EmitFuncT emit;
+    };
+
+public:
+    // --format if given, otherwise --cols (empty if neither is). fields: those
+    // the template can use, an unknown one is an error.
+    OutputFormat(const std::string &format, const std::vector<std::string> &columns, std::span<const Field> fields)
+    : _fields{fields}
+    {
+        if(!format.empty())
+        {
+            compile(format);
+        }
+        else
+        {
+            for(const auto &column : columns)
+            {
+                if(!_parts.empty())
+                    _literal += ' ';
+                addField(column);
+            }
+        }
+
+        if(!_literal.empty())
+            _parts.push_back({std::move(_literal), nullptr});
+    }
+
+public:
+    bool empty() const {return _parts.empty();}
+
+    void render(const ItemT &item, std::string &output) const
+    {
+        for(const auto &part : _parts)
+        {
+            output += part.literal;
+            if(part.emit)
+                part.emit(item, output);
+        }
+    }
+
+private:
+    void compile(std::string_view format)
+    {
+        for(std::size_t index = 0; index < format.size(); ++index)
+        {
+            const char ch = format[index];
+            if((ch == '{' || ch == '}') && index + 1 < format.size() && format[index + 1] == ch)
+            {
+                _literal += ch;
+                ++index;
+            }
+            else if(ch == '{')
+            {
+                const auto end = format.find('}', index);
+                if(end == std::string_view::npos)
+                    throw cxxopts::OptionParseException{fmt::format("Unterminated field in --format '{}'", format)};
+
+                addField(format.substr(index + 1, end - index - 1));
+                index = end;
+            }
+            else if(ch == '}')
+            {
+                throw cxxopts::OptionParseException{fmt::format("Unmatched '}}' in --format '{}'", format)};
+            }
+            else
+            {
+                _literal += ch;
+            }
+        }
+    }
+
+    // The field ends the literal text before it
+    void addField(std::string_view name)
+    {
+        const auto it = std::find_if(_fields.begin(), _fields.end(), [&](const auto &field) {return field.name == name;});
+        if(it == _fields.end())
+        {
+            std::string known;
+            for(const auto &field : _fields)
+                known += fmt::format("{}{}", known.empty() ? "" : ", ", field.name);
+            throw cxxopts::OptionParseException{fmt::format("Unknown field '{}', expected one of: {}", name, known)};
+        }
+
+        _parts.push_back({std::move(_literal), it->emit});
+        _literal.clear();
+    }
+
+private:
+    struct Part
+    {
+        // Comes before the field
+        std::string literal;
+        // Nothing for the text after the last field
+        EmitFuncT emit{};
+    };
+
+    std::span<const Field> _fields;
+    std::vector<Part> _parts;
+    // The text since the last field, while compiling
+    std::string _literal;
+};
+
+// For field emitters - appends a number without a temporary string
+template <typename NumberT>
+void appendNumber(std::string &output, NumberT number)
+{
+    char buffer[24];
+    const auto result = std::to_chars(buffer, buffer + sizeof(buffer), number);
+    output.append(buffer, result.ptr);
+}
@@ -286,6 +286,34 @@ std::string PacketView::destAddress() const
         return IPv6Address{std::get<Packet6>(_packet).destAddress()}.toString();
 }
 
+IPAddressBytes PacketView::sourceAddressBytes() const
+{
+    IPAddressBytes bytes{};
+    if(std::holds_alternative<Packet4>(_packet))
+    {
+        const auto &address = std::get<Packet4>(_packet).toRaw()->ip_src;
+        std::memcpy(bytes.data(), &address, sizeof(address));
+    }
+    else
+        std::memcpy(bytes.data(), &std::get<Packet6>(_packet).sourceAddress(), bytes.size());
+
+    return bytes;
+}
+
+IPAddressBytes PacketView::destAddressBytes() const
+{
+    IPAddressBytes bytes{};
+    if(std::holds_alternative<Packet4>(_packet))
+    {
+        const auto &address = std::get<Packet4>(_packet).toRaw()->ip_dst;
+        std::memcpy(bytes.data(), &address, sizeof(address));
+    }
+    else
+        std::memcpy(bytes.data(), &std::get<Packet6>(_packet).destAddress(), bytes.size());
+
+    return bytes;
+}
+
 bool PacketView::isIpv4() const
 {
     return std::holds_alternative<Packet4>(_packet) ? true : false;
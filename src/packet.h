@@ -5,6 +5,7 @@
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include "util.h"
+#include "ip_address.h"
 
 // Both TCP and UDP are supported - this is the source/dest port part that's
 // common to both headers.
@@ -129,6 +130,8 @@ public:
     std::uint16_t destPort() const;
     std::string sourceAddress() const;
     std::string destAddress() const;
+    IPAddressBytes sourceAddressBytes() const;
+    IPAddressBytes destAddressBytes() const;
     std::string toString() const;
     bool isIpv4() const;
     bool isIpv6() const;
@@ -140,3 +143,37 @@ public:
 private:
     std::variant<Packet4, Packet6> _packet;
 };
+
+// An owning copy of the parts of a packet we display. PacketView only points into
+// the capture buffer, so use this for packets that are kept around after capture.
+class PacketRecord
+{
+public:
+    explicit PacketRecord(const PacketView &packet)
+    : _ipVersion{packet.ipVersion()}
+    , _transportProtocol{packet.transportProtocol()}
+    , _sourcePort{packet.sourcePort()}
+    , _destPort{packet.destPort()}
+    , _sourceAddress{packet.sourceAddress()}
+    , _destAddress{packet.destAddress()}
+    {}
+
+public:
+    std::uint16_t sourcePort() const {return _sourcePort;}
+    std::uint16_t destPort() const {return _destPort;}
+    const std::string &sourceAddress() const {return _sourceAddress;}
+    const std::string &destAddress() const {return _destAddress;}
+    bool isIpv4() const {return _ipVersion == IPv4;}
+    bool isIpv6() const {return _ipVersion == IPv6;}
+    std::uint8_t transportProtocol() const {return _transportProtocol;}
+    std::string transportName() const {return _transportProtocol == IPPROTO_UDP ? "UDP" : "TCP";}
+    IPVersion ipVersion() const {return _ipVersion;}
+
+private:
+    IPVersion _ipVersion;
+    std::uint8_t _transportProtocol;
+    std::uint16_t _sourcePort;
+    std::uint16_t _destPort;
+    std::string _sourceAddress;
+    std::string _destAddress;
+};
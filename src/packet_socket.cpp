@@ -0,0 +1,73 @@
+#include "packet_socket.h"
+#include <sys/socket.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+
+namespace
+{
+    // Large enough for any packet (including GRO/GSO aggregated ones)
+    const std::size_t bufferSize{64 * 1024};
+}
+
+PacketSocket::PacketSocket(const std::string &interfaceName)
+: _fd{::socket(AF_PACKET, SOCK_DGRAM | SOCK_CLOEXEC, htons(ETH_P_ALL))}
+, _loopbackIndex{::if_nametoindex("lo")}
+{
+    if(!_fd)
+        throw SystemError("Could not open packet socket");
+
+    if(interfaceName.empty())
+        return;
+
+    sockaddr_ll address{};
+    address.sll_family = AF_PACKET;
+    address.sll_protocol = htons(ETH_P_ALL);
+    address.sll_ifindex = static_cast<int>(::if_nametoindex(interfaceName.c_str()));
+    if(address.sll_ifindex == 0)
+        throw SystemError("Could not find interface " + interfaceName);
+
+    if(::bind(_fd.get(), reinterpret_cast<sockaddr*>(&address), sizeof(address)))
+        throw SystemError("Could not set interface");
+}
+
+void PacketSocket::receive() const
+{
+    std::vector<unsigned char> buf(bufferSize);
+
+    while(true)
+    {
+        sockaddr_ll address{};
+        socklen_t addressLength{sizeof(address)};
+        ssize_t length = ::recvfrom(_fd.get(), buf.data(), buf.size(), 0,
+            reinterpret_cast<sockaddr*>(&address), &addressLength);
+
+        if(length < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            throw SystemError("Could not read from packet socket");
+        }
+
+        if(address.sll_pkttype == PACKET_OUTGOING && address.sll_ifindex == static_cast<int>(_loopbackIndex))
+            continue;
+
+        std::span<unsigned char> data(buf.data(), static_cast<std::size_t>(length));
+        if(ntohs(address.sll_protocol) == ETH_P_IP)
+        {
+            auto packet4 = Packet4::createFromData(data, 0);
+            if(!packet4)
+                continue;
+
+            _packetReceivedFunc(PacketView{std::move(*packet4)});
+        }
+        else if(ntohs(address.sll_protocol) == ETH_P_IPV6)
+        {
+            auto packet6 = Packet6::createFromData(data, 0);
+            if(!packet6)
+                continue;
+
+            _packetReceivedFunc(PacketView{std::move(*packet6)});
+        }
+    }
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "util.h"
+#include "fd.h"
+#include "packet.h"
+#include "capture_device.h"
+
+// Linux packet capture via an AF_PACKET socket. The socket is SOCK_DGRAM so the
+// kernel strips the link layer for us, which also covers non-ethernet interfaces
+// (tun devices, wireguard etc).
+class PacketSocket : public CaptureDevice
+{
+public:
+    // An empty interface name captures on all interfaces
+    PacketSocket(const std::string &interfaceName = {});
+
+public:
+    virtual void receive() const override;
+
+private:
+    Fd _fd;
+    // On loopback every packet is seen twice (outgoing and incoming), we skip the outgoing copy
+    unsigned _loopbackIndex{0};
+};
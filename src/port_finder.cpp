@@ -5,187 +5,147 @@
 
 namespace fs = std::filesystem;
 
-bool PortFinder::Connection::isIpv6AnyAddress() const
+IPAddressBytes PortFinder::Connection::localAddressBytes() const
 {
-    if(isIpv4()) return false;
+    IPAddressBytes address{};
+    if(isIpv4())
+    {
+        const std::uint32_t ip{htonl(localIp4())};
+        std::memcpy(address.data(), &ip, sizeof(ip));
+    }
+    else if(isIpv6())
+        std::memcpy(address.data(), &localIp6()[0], address.size());
+
+    return address;
+}
 
-    const auto &in6addr{inetInfo().insi_laddr.ina_6.s6_addr};
-    return std::all_of(std::begin(in6addr), std::end(in6addr), [](auto val)
+IPAddressBytes PortFinder::Connection::remoteAddressBytes() const
+{
+    IPAddressBytes address{};
+    if(isIpv4())
     {
-        return val == 0;
-    });
+        const std::uint32_t ip{htonl(remoteIp4())};
+        std::memcpy(address.data(), &ip, sizeof(ip));
+    }
+    else if(isIpv6())
+        std::memcpy(address.data(), &remoteIp6()[0], address.size());
+
+    return address;
 }
 
 std::string PortFinder::Connection::buildString(bool verbose) const
+{
+    return ConnectionRecord{*this}.toString(verbose ? path() : static_cast<std::string>(fs::path(path()).filename()));
+}
+
+PortFinder::ConnectionRecord::ConnectionRecord(const Connection &connection)
+: _localAddress{connection.localAddressBytes()}
+, _remoteAddress{connection.remoteAddressBytes()}
+, _pid{connection.pid()}
+#if defined(RUMI_LINUX)
+, _inode{connection.inode()}
+#endif
+, _localPort{connection.localPort()}
+, _remotePort{static_cast<std::uint16_t>(connection.remotePort())}
+, _protocol{static_cast<std::uint8_t>(connection.protocol())}
+, _ipVersion{static_cast<std::uint8_t>(connection.isIpv4() ? 4 : connection.isIpv6() ? 6 : 0)}
+{
+    static_assert(sizeof(ConnectionRecord) == 48);
+}
+
+bool PortFinder::ConnectionRecord::isIpv6AnyAddress() const
+{
+    return isIpv6() && _localAddress == IPAddressBytes{};
+}
+
+std::string PortFinder::ConnectionRecord::toString(const std::string &filePath) const
 {
     constexpr const char *formatStringIpv4 = "{} {}:{} -> {}:{} {}";
     constexpr const char *formatStringIpv6 = "{} {}.{} -> {}.{} {}";
 
-    const std::string protocol = this->protocol() == IPPROTO_TCP ? "TCP" : "UDP";
-    const std::string filePath = verbose ? path() : static_cast<std::string>(fs::path(path()).filename());
+    const char *protocol = _protocol == IPPROTO_TCP ? "TCP" : "UDP";
+
+    // inet_ntop() straight from the network order bytes
+    char local[INET6_ADDRSTRLEN]{};
+    char remote[INET6_ADDRSTRLEN]{};
+    const int family = isIpv4() ? AF_INET : AF_INET6;
+    inet_ntop(family, _localAddress.data(), local, sizeof(local));
+    inet_ntop(family, _remoteAddress.data(), remote, sizeof(remote));
 
     if(isIpv4())
-    {
-        return fmt::format(formatStringIpv4, protocol, IPv4Address{localIp4()}.toString(),
-            localPort(), IPv4Address{remoteIp4()}.toString(), remotePort(), filePath);
-    }
+        return fmt::format(formatStringIpv4, protocol, local, _localPort, remote, _remotePort, filePath);
     else
+        return fmt::format(formatStringIpv6, protocol, local, _localPort, remote, _remotePort, filePath);
+}
+
+const std::pair<std::string, std::string> &PortFinder::ProcessPaths::entry(pid_t pid)
+{
+    auto it = _entries.find(pid);
+    if(it == _entries.end())
     {
-        return fmt::format(formatStringIpv6, protocol, IPv6Address{localIp6()}.toString(),
-            localPort(), IPv6Address{remoteIp6()}.toString(), remotePort(), filePath);
+        std::string path{pidToPath(pid)};
+        std::string name{static_cast<std::string>(fs::path(path).filename())};
+        it = _entries.emplace(pid, std::pair{std::move(path), std::move(name)}).first;
     }
+
+    return it->second;
 }
 
 namespace
 {
-template <typename Func_T>
-void connectionsForPid(pid_t pid, IPVersion ipVersion, Func_T func)
-{
-    // Get the buffer size needed
-    int size = proc_pidinfo(pid, PROC_PIDLISTFDS, 0, nullptr, 0);
-    if(size <= 0)
-        return;
-
-    std::vector<proc_fdinfo> fds;
-    fds.resize(size / sizeof(proc_fdinfo));
-    // Get the file descriptors
-    size = proc_pidinfo(pid, PROC_PIDLISTFDS, 0, fds.data(), fds.size() * sizeof(proc_fdinfo));
-    fds.resize(size / sizeof(proc_fdinfo));
-
-    for(const auto &fd : fds)
+    template <typename Connection_T>
+    bool matchesIpVersionImpl(const Connection_T &connection, IPVersion ipVersion)
     {
-        if(fd.proc_fdtype != PROX_FDTYPE_SOCKET)
-            continue;   // Don't care about anything besides sockets
-
-        socket_fdinfo socketFdInfo{};
-        size = proc_pidfdinfo(pid, fd.proc_fd, PROC_PIDFDSOCKETINFO,
-                              &socketFdInfo, sizeof(socketFdInfo));
-        if(size != sizeof(socketFdInfo))
-        {
-/*             qWarning() << "Failed to inspect descriptor" << fd.proc_fd << "of"
-                << pid << "- got size" << size << "- expected" << sizeof(socketFdInfo);
- */            continue;
-        }
-
-        // Use an OOP wrapper for convenience
-        const PortFinder::Connection connection{socketFdInfo.psi, pid};
-
-        // Don't care about anything other than TCP/UDP.
-        // It seems that TCP sockets may sometimes be indicated with
-        // soi_kind==SOCKINFO_IN instead of SOCKINFO_TCP.
-        // we don't use anything from the TCP-specific socket info so this is
-        // fine, identify sockets by checking the IP protocol.
-        if(!(connection.protocol() == IPPROTO_TCP || connection.protocol() == IPPROTO_UDP))
-            continue;
+        if(ipVersion == IPVersion::Both)
+            return (connection.isIpv4() || connection.isIpv6()) && connection.localPort() > 0;
 
         if(ipVersion == IPv4 && connection.isIpv4())
         {
             // The local address can be 0, but the port must be valid
-            if(connection.localPort() > 0)
-                func(connection);
+            return connection.localPort() > 0;
         }
         else if(connection.isIpv6())
         {
-            // Store an IPv6 socket if it's the "any" address (and has a valid
+            // Include an IPv6 socket if it's the "any" address (and has a valid
             // port)
             if(ipVersion == IPv4)
-            {
-                if(connection.isIpv6AnyAddress() && connection.localPort() > 0)
-                    func(connection);
-            }
+                return connection.isIpv6AnyAddress() && connection.localPort() > 0;
             else if(ipVersion == IPv6)
-            {
-                if(connection.localPort() > 0)
-                    func(connection);
-            }
+                return connection.localPort() > 0;
         }
-    }
-}
-}
-
-bool PortFinder::matchesPath(const std::set<std::string> &paths, pid_t pid)
-{
-    std::string appPath = pidToPath(pid);
-
-    return std::any_of(paths.begin(), paths.end(),
-        [&appPath](const std::string &prefix) {
-            return appPath.find(prefix) != std::string::npos;
-        });
-}
-
-std::string PortFinder::pidToPath(pid_t pid)
-{
-    char path[PATH_MAX]{};
-    proc_pidpath(pid, path, sizeof(path));
-
-    // Wrap in std::string for convenience
-    return std::string{path};
-}
-
-pid_t PortFinder::portToPid(std::uint16_t port, IPVersion ipVersion)
-{
-    return pidFor([&](const auto &pid) {
-        std::set<std::uint16_t> ports;
-        connectionsForPid(pid, ipVersion, [&](const auto &connection) {
-            ports.insert(connection.localPort());
-        });
-        return ports.contains(port);
-    });
-}
-
-std::set<pid_t> PortFinder::pids(const std::set<std::string>& paths)
-{
-    return pidsFor([&](const auto &pid) { return matchesPath(paths, pid); });
-}
 
-PortSet PortFinder::ports(const std::set<pid_t> &pids, IPVersion ipVersion)
-{
-    std::set<std::uint16_t> ports;
-    for(const auto &pid : pids)
-        connectionsForPid(pid, ipVersion, [&](const auto &connection) {
-            if(connection.isIpv4())
-                ports.insert(connection.localPort());
-            else if(connection.isIpv6())
-                ports.insert(connection.localPort());
-        });
-
-    return ports;
+        return false;
+    }
 }
 
-PortSet PortFinder::ports(const std::set<std::string>& paths, IPVersion ipVersion)
+bool PortFinder::matchesIpVersion(const Connection &connection, IPVersion ipVersion)
 {
-    return ports(pids(paths), ipVersion);
+    return matchesIpVersionImpl(connection, ipVersion);
 }
 
-std::set<PortFinder::AddressAndPort> PortFinder::addresses4(const std::set<std::string> &paths)
+bool PortFinder::matchesIpVersion(const ConnectionRecord &record, IPVersion ipVersion)
 {
-    std::set<AddressAndPort> addresses;
-    for(const auto &pid : pids(paths))
-        connectionsForPid(pid, IPv4, [&addresses](const auto &connection) {
-            addresses.insert({static_cast<std::uint32_t>(connection.localIp4()), connection.localPort()});
-        });
-
-    return addresses;
+    return matchesIpVersionImpl(record, ipVersion);
 }
 
-std::vector<PortFinder::Connection> PortFinder::connections(const std::set<std::string> &paths, IPVersion ipVersion)
+bool PortFinder::matchesPath(const std::set<std::string> &paths, pid_t pid)
 {
-    return connections(pids(paths), ipVersion);
+    return matchesPath(paths, pidToPath(pid));
 }
 
-std::vector<PortFinder::Connection> PortFinder::connections(const std::set<pid_t> &pids, IPVersion ipVersion)
+bool PortFinder::matchesPath(const std::set<std::string> &names, std::string_view path)
 {
-    std::vector<Connection> connections;
-    for(const auto &pid : pids)
-        connectionsForPid(pid, ipVersion, [&](const auto &connection) {
-            connections.push_back(connection);
-        });
+    const auto slash = path.rfind('/');
+    const auto programName = slash == std::string_view::npos ? path : path.substr(slash + 1);
 
-    return connections;
+    return std::any_of(names.begin(), names.end(), [&](const std::string &name)
+    {
+        const auto searched = name.find('/') == std::string::npos ? programName : path;
+        return searched.find(name) != std::string_view::npos;
+    });
 }
 
-std::string PortFinder::portToPath(std::uint16_t port, IPVersion ipVersion)
+PidSet PortFinder::pids(const std::set<std::string>& paths)
 {
-    return pidToPath(portToPid(port, ipVersion));
+    return pidsFor([&](const auto &pid) { return matchesPath(paths, pid); });
 }
-
@@ -1,35 +1,24 @@
 #pragma once
 
-#include <libproc.h>  // for proc_pidpath()
 #include <set>
+#include <span>
+#include <unordered_map>
 #include "common.h"
+#include "thread_pool.h"
+#include "ip_address.h"
+#if defined(RUMI_MACOS)
+#include <libproc.h>  // for proc_pidpath()
+#elif defined(RUMI_LINUX)
+#include <linux/netlink.h>
+#include <linux/inet_diag.h>
+#endif
 
 namespace PortFinder
 {
 
-class AddressAndPort
-{
-public:
-    AddressAndPort(std::uint32_t ip, std::uint16_t port)
-    : _ip{ip}
-    , _port{port}
-    {}
-
-    AddressAndPort(const AddressAndPort &other)
-    : AddressAndPort(other._ip, other._port)
-    {}
-
-    auto operator<=>(const AddressAndPort&) const = default;
-public:
-    std::uint32_t ip() const {return _ip;}
-    std::uint16_t port() const {return _port;}
-private:
-    std::uint32_t _ip;
-    std::uint16_t _port;
-};
-
 std::string pidToPath(pid_t);
 
+#if defined(RUMI_MACOS)
 // Thin wrapper around socket_info for convenience
 class Connection
 {
@@ -64,6 +53,8 @@ public:
     const auto& localIp6() const {return isIpv6() ? inetInfo().insi_laddr.ina_6.s6_addr : _nullIpv6Address;}
     const auto& remoteIp6() const {return isIpv6() ? inetInfo().insi_faddr.ina_6.s6_addr : _nullIpv6Address;}
     bool isIpv6AnyAddress() const;
+    IPAddressBytes localAddressBytes() const;
+    IPAddressBytes remoteAddressBytes() const;
     std::uint16_t localPort() const {return ntohs(inetInfo().insi_lport);}
     std::uint32_t remotePort() const {return ntohs(inetInfo().insi_fport);}
     int protocol() const {return _socketInfo.soi_protocol;}
@@ -71,6 +62,8 @@ public:
     bool isIpv6() const {return isIpVersion(INI_IPV6);}
     pid_t pid() const {return _pid;}
     std::string path() const {return pidToPath(_pid);}
+    // The TCP state (e.g ESTABLISHED), or UDP for UDP sockets
+    std::string stateName() const;
 
     std::string toString() const {return buildString(false);}
     std::string toVerboseString() const {return buildString(true);}
@@ -85,68 +78,209 @@ private:
     std::uint8_t isIpVersion(std::uint8_t flag) const {return inetInfo().insi_vflag & flag;}
     const in_sockinfo& inetInfo() const {return _socketInfo.soi_proto.pri_in;}
 private:
-    unsigned char _nullIpv6Address[16]{};
+    static constexpr unsigned char _nullIpv6Address[16]{};
     socket_info _socketInfo;
     pid_t _pid;
 };
-    // The maximum number of PIDs we support
-enum { maxPids = 16384 };
-
-std::set<pid_t> pids(const std::set<std::string> &paths);
-PortSet ports(const std::set<pid_t> &pids, IPVersion ipVersion);
-PortSet ports(const std::set<std::string> &paths, IPVersion ipVersion);
-std::set<AddressAndPort> addresses4(const std::set<std::string> &paths);
-pid_t portToPid(std::uint16_t port, IPVersion ipVersion=IPv4);
-std::string pidToPath(pid_t);
-std::string portToPath(std::uint16_t port, IPVersion ipVersion);
-std::vector<Connection> connections(const std::set<pid_t> &pids, IPVersion ipVersion);
-std::vector<Connection> connections(const std::set<std::string> &paths, IPVersion ipVersion);
-bool matchesPath(const std::set<std::string> &paths, pid_t pid);
+#elif defined(RUMI_LINUX)
+// The parts of the kernel's tcp_info (and socket memory info) we use
+struct TcpInfo
+{
+    // Bytes sent (and acknowledged by the peer) and received over the connection's lifetime
+    std::uint64_t bytesAcked{};
+    std::uint64_t bytesReceived{};
+    // Smoothed round trip time and its variance
+    std::uint32_t rttUs{};
+    std::uint32_t rttVarUs{};
+    // Congestion window, in segments
+    std::uint32_t congestionWindow{};
+    // Segments retransmitted over the connection's lifetime
+    std::uint32_t retransmits{};
+    // Bytes queued for sending (including unacknowledged ones) and the send buffer size
+    std::uint32_t sendQueued{};
+    std::uint32_t sendBuffer{};
+};
 
-template <typename Func_T>
-pid_t pidFor(Func_T func)
+// Thin wrapper around a sock_diag inet_diag_msg for convenience
+class Connection
 {
-    int totalPidCount = 0;
-    std::vector<pid_t> allPidVector;
-    allPidVector.resize(maxPids);
+public:
+    explicit Connection(const inet_diag_msg &diagMsg, std::uint8_t protocol, pid_t pid,
+        std::optional<TcpInfo> tcpInfo = {}, std::uint32_t netns = 0)
+    : _diagMsg{diagMsg}
+    , _protocol{protocol}
+    , _pid{pid}
+    , _tcpInfo{std::move(tcpInfo)}
+    , _netns{netns}
+    {}
 
-    // proc_listallpids() returns the total number of PIDs in the system
-    // (assuming that maxPids is > than the total PIDs, otherwise it returns maxPids)
-    totalPidCount = proc_listallpids(allPidVector.data(), maxPids * sizeof(pid_t));
+    //Ipv4
+    std::uint32_t localIp4() const {return isIpv4() ? ntohl(_diagMsg.id.idiag_src[0]) : 0;}
+    std::uint32_t remoteIp4() const {return isIpv4() ? ntohl(_diagMsg.id.idiag_dst[0]) : 0;}
+    // Ipv6
+    const std::uint8_t *localIp6() const {return isIpv6() ? reinterpret_cast<const std::uint8_t*>(_diagMsg.id.idiag_src) : _nullIpv6Address;}
+    const std::uint8_t *remoteIp6() const {return isIpv6() ? reinterpret_cast<const std::uint8_t*>(_diagMsg.id.idiag_dst) : _nullIpv6Address;}
+    bool isIpv6AnyAddress() const;
+    IPAddressBytes localAddressBytes() const;
+    IPAddressBytes remoteAddressBytes() const;
+    std::uint16_t localPort() const {return ntohs(_diagMsg.id.idiag_sport);}
+    std::uint32_t remotePort() const {return ntohs(_diagMsg.id.idiag_dport);}
+    int protocol() const {return _protocol;}
+    bool isIpv4() const {return _diagMsg.idiag_family == AF_INET;}
+    bool isIpv6() const {return _diagMsg.idiag_family == AF_INET6;}
+    pid_t pid() const {return _pid;}
+    std::string path() const {return pidToPath(_pid);}
+    // The TCP state (e.g ESTABLISHED), or UDP for UDP sockets
+    std::string stateName() const;
+    // The socket inode; 0 for sockets no longer attached to a file (e.g TIME_WAIT)
+    std::uint32_t inode() const {return _diagMsg.idiag_inode;}
+    // Unique for the lifetime of the system, unlike inodes
+    std::uint64_t cookie() const {return _diagMsg.id.idiag_cookie[0] | (static_cast<std::uint64_t>(_diagMsg.id.idiag_cookie[1]) << 32);}
+    // Only for TCP sockets, and only if requested
+    const std::optional<TcpInfo> &tcpInfo() const {return _tcpInfo;}
+    // For TCP: bytes not yet read by the process / not yet acknowledged by the peer
+    // (for listening sockets: the accept queue length / its limit)
+    std::uint32_t receiveQueue() const {return _diagMsg.idiag_rqueue;}
+    std::uint32_t sendQueue() const {return _diagMsg.idiag_wqueue;}
+    const inet_diag_msg &diagMsg() const {return _diagMsg;}
+    // The inode of the socket's network namespace (0 if unknown)
+    std::uint32_t netns() const {return _netns;}
 
-    for (int i = 0; i != totalPidCount; ++i)
-    {
-        pid_t pid = allPidVector[i];
+    std::string toString() const {return buildString(false);}
+    std::string toVerboseString() const {return buildString(true);}
 
-        // Add the PID to our set if matches one of the paths
-        if(func(pid))
-            return pid;
+    friend std::ostream& operator<<(std::ostream& os, const Connection &conn)
+    {
+        os << conn.toString();
+        return os;
     }
+private:
+    std::string buildString(bool verbose) const;
+private:
+    static constexpr std::uint8_t _nullIpv6Address[16]{};
+    inet_diag_msg _diagMsg;
+    std::uint8_t _protocol;
+    pid_t _pid;
+    std::optional<TcpInfo> _tcpInfo;
+    std::uint32_t _netns;
+};
+#endif
 
-    return 0;
-}
+// A compact (48 byte) copy of what -s shows of a connection, so that scans of
+// hundreds of thousands of sockets stay small
+class ConnectionRecord
+{
+public:
+    explicit ConnectionRecord(const Connection &connection);
 
-template <typename Func_T>
-std::set<pid_t> pidsFor(Func_T func)
+public:
+    const IPAddressBytes &localAddress() const {return _localAddress;}
+    const IPAddressBytes &remoteAddress() const {return _remoteAddress;}
+    std::uint16_t localPort() const {return _localPort;}
+    std::uint16_t remotePort() const {return _remotePort;}
+    int protocol() const {return _protocol;}
+    bool isIpv4() const {return _ipVersion == 4;}
+    bool isIpv6() const {return _ipVersion == 6;}
+    bool isIpv6AnyAddress() const;
+    pid_t pid() const {return _pid;}
+    void setPid(pid_t pid) {_pid = pid;}
+    // The socket inode on Linux (0 on macOS)
+    std::uint32_t inode() const {return _inode;}
+
+    // As Connection::toString(), with the given process path (or name)
+    std::string toString(const std::string &filePath) const;
+
+private:
+    IPAddressBytes _localAddress{};
+    IPAddressBytes _remoteAddress{};
+    pid_t _pid{};
+    std::uint32_t _inode{};
+    std::uint16_t _localPort{};
+    std::uint16_t _remotePort{};
+    std::uint8_t _protocol{};
+    std::uint8_t _ipVersion{};
+};
+
+// pid -> path and name, looked up once per pid. Meant for the lifetime of a single
+// scan (pids are reused), and not thread safe.
+class ProcessPaths
 {
-    int totalPidCount = 0;
-    std::set<pid_t> pidsForPaths;
-    std::vector<pid_t> allPidVector;
-    allPidVector.resize(maxPids);
+public:
+    const std::string &path(pid_t pid) {return entry(pid).first;}
+    // The basename of the path
+    const std::string &name(pid_t pid) {return entry(pid).second;}
 
-    // proc_listallpids() returns the total number of PIDs in the system
-    // (assuming that maxPids is > than the total PIDs, otherwise it returns maxPids)
-    totalPidCount = proc_listallpids(allPidVector.data(), maxPids * sizeof(pid_t));
+private:
+    const std::pair<std::string, std::string> &entry(pid_t pid);
 
-    for(int i = 0; i != totalPidCount; ++i)
-    {
-        pid_t pid = allPidVector[i];
+private:
+    std::unordered_map<pid_t, std::pair<std::string, std::string>> _entries;
+};
+
+std::vector<pid_t> allPids();
+#if defined(RUMI_MACOS)
+// The fd numbers of all sockets open in the given process
+std::vector<int> socketFds(pid_t pid);
+// The TCP/UDP connection behind a socket fd (empty if the fd is gone or not TCP/UDP)
+std::optional<Connection> connectionForFd(pid_t pid, int fd);
+#elif defined(RUMI_LINUX)
+// Every TCP/UDP socket in the system (both IP versions), dumped in bulk via sock_diag -
+// once per network namespace. Sockets with no owning process (e.g TIME_WAIT) have a pid of 0.
+// withTcpInfo: also fetch the tcp_info and memory info of TCP sockets (in the same dump)
+std::vector<Connection> allConnections(bool withTcpInfo = false);
+// Parse a sock_diag message (from a dump or a destroy notification) into a connection
+// with no owning process (empty if it isn't one)
+std::optional<Connection> connectionFromMessage(const nlmsghdr &msg, std::uint8_t protocol, std::uint32_t netns = 0);
+#endif
+
+// Should the connection be listed when looking at the given IP version(s)?
+// IPv6 sockets bound to the "any" address also receive IPv4 traffic.
+bool matchesIpVersion(const Connection &connection, IPVersion ipVersion);
+bool matchesIpVersion(const ConnectionRecord &record, IPVersion ipVersion);
+
+PidSet pids(const std::set<std::string> &paths);
+// The connections of the given processes, passed to func in batches as they're scanned
+// rather than collected first. func is never called concurrently, but on Linux it's
+// called from within the socket dump - on a worker thread for other network namespaces.
+using RecordBatchFuncT = std::function<void(std::span<const ConnectionRecord>)>;
+void forEachConnectionRecord(const PidSet &pids, IPVersion ipVersion, const RecordBatchFuncT &func);
+bool matchesPath(const std::set<std::string> &paths, pid_t pid);
+// How processes are selected by name everywhere: a name with a '/' in it matches
+// anywhere in the process's path, any other name matches within its program name
+// (the path's basename)
+bool matchesPath(const std::set<std::string> &names, std::string_view path);
+
+// All pids for which func(pid) is true. The pids are checked in parallel,
+// func must be safe to call concurrently.
+template <typename Func_T>
+PidSet pidsFor(Func_T func)
+{
+    const auto allPidVector = allPids();
+    auto &pool = ThreadPool::shared();
+    std::vector<WorkerBuffer<std::vector<pid_t>>> matches(pool.threadCount());
 
+    pool.parallelFor(allPidVector.size(), [&](std::size_t index, unsigned worker)
+    {
         // Add the PID to our set if matches one of the paths
-        if(func(pid))
-            pidsForPaths.insert(pid);
-    }
+        if(func(allPidVector[index]))
+            matches[worker].value.push_back(allPidVector[index]);
+    });
+
+    std::vector<pid_t> pidsForPaths;
+    for(const auto &workerMatches : matches)
+        pidsForPaths.insert(pidsForPaths.end(), workerMatches.value.begin(), workerMatches.value.end());
+
+    return PidSet{std::move(pidsForPaths)};
+}
 
-    return pidsForPaths;
+// Invoke func(pid, worker) for each of the pids in parallel
+template <typename Func_T>
+void forEachPid(const PidSet &pids, Func_T func)
+{
+    const std::vector<pid_t> pidVector(pids.begin(), pids.end());
+    ThreadPool::shared().parallelFor(pidVector.size(), [&](std::size_t index, unsigned worker)
+    {
+        func(pidVector[index], worker);
+    });
 }
 }
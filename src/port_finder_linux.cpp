@@ -0,0 +1,436 @@
+#include "common.h"
+#include "port_finder.h"
+#include "netlink_socket.h"
+#include "thread_pool.h"
+#include "fd.h"
+#include "net_namespace.h"
+#include <linux/sock_diag.h>
+#include <linux/tcp.h>
+#include <linux/rtnetlink.h>
+#include <netinet/in.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    // Connections scanned (and so resolved and passed to a forEachConnectionRecord()
+    // callback) at a time
+    const std::size_t recordBatchSize{4096};
+
+    // The sockets we care about - a sock_diag dump covers a single family and protocol
+    const std::pair<std::uint8_t, std::uint8_t> socketKinds[]{
+        {AF_INET, IPPROTO_TCP}, {AF_INET, IPPROTO_UDP},
+        {AF_INET6, IPPROTO_TCP}, {AF_INET6, IPPROTO_UDP}};
+
+    // Is the directory entry a pid (i.e all digits)?
+    std::optional<pid_t> toPid(const char *name)
+    {
+        if(*name == '\0')
+            return {};
+
+        pid_t pid{0};
+        for(; *name; ++name)
+        {
+            if(*name < '0' || *name > '9')
+                return {};
+            pid = pid * 10 + (*name - '0');
+        }
+
+        return pid;
+    }
+
+
+    // Socket inode -> owning pid, built by walking /proc/<pid>/fd.
+    //
+    // The index is maintained incrementally: an update only walks /proc at all if
+    // a socket inode we need is unknown, and then only reads the links of fds a
+    // process didn't have last time (new processes have all of theirs read).
+    // Only if that still leaves inodes unresolved (an fd number was closed and
+    // reused for a new socket) are all links read again.
+    class InodeIndex
+    {
+        // fd -> socket inode (0 for fds that aren't sockets)
+        using FdTable = std::unordered_map<int, std::uint32_t>;
+
+    public:
+        // A resolution spread over several resolve() calls, e.g the batches of a
+        // socket dump
+        struct Pass
+        {
+            // /proc is walked at most once of each kind per pass
+            bool updated{};
+            bool fullyUpdated{};
+            // Every inode the pass resolved
+            std::unordered_set<std::uint32_t> inodes;
+        };
+
+    public:
+        // Resolve the given inodes to pids (those which can't be resolved map to 0)
+        std::unordered_map<std::uint32_t, pid_t> resolve(const std::unordered_set<std::uint32_t> &inodes)
+        {
+            Pass pass;
+            auto pids = resolve(inodes, pass);
+            finish(pass);
+            return pids;
+        }
+
+        // As above, as part of a pass
+        std::unordered_map<std::uint32_t, pid_t> resolve(const std::unordered_set<std::uint32_t> &inodes, Pass &pass)
+        {
+            std::lock_guard lock{_mutex};
+            pass.inodes.insert(inodes.begin(), inodes.end());
+
+            auto isKnown = [&](auto inode) { return _inodes.contains(inode) || _unresolvable.contains(inode); };
+            bool fullyUpdated{false};
+            if(!pass.updated && !std::all_of(inodes.begin(), inodes.end(), isKnown))
+            {
+                update(false);
+                pass.updated = true;
+            }
+            if(!pass.fullyUpdated && !std::all_of(inodes.begin(), inodes.end(), isKnown))
+            {
+                update(true);
+                pass.fullyUpdated = fullyUpdated = true;
+            }
+
+            std::unordered_map<std::uint32_t, pid_t> pids;
+            for(const auto &inode : inodes)
+            {
+                auto it = _inodes.find(inode);
+                if(it != _inodes.end())
+                    pids.emplace(inode, it->second);
+                else
+                {
+                    // Most likely owned by a process we can't inspect, don't
+                    // walk /proc for it again while it exists. Sockets that are
+                    // just newer than this pass's walk are left for the next pass.
+                    if(fullyUpdated)
+                        _unresolvable.insert(inode);
+                    pids.emplace(inode, 0);
+                }
+            }
+
+            return pids;
+        }
+
+        // Forget the unresolvable sockets the pass didn't see, they've gone away
+        void finish(const Pass &pass)
+        {
+            std::lock_guard lock{_mutex};
+            std::erase_if(_unresolvable, [&](auto inode) { return !pass.inodes.contains(inode); });
+        }
+
+    private:
+        // A full update re-reads every fd link rather than just the new ones
+        void update(bool full)
+        {
+            // Read the fd tables in parallel, each process into its own slot
+            const auto allPids = PortFinder::allPids();
+            std::vector<FdTable> newFdTables(allPids.size());
+
+            Fd procFd{::open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC)};
+            ThreadPool::shared().parallelFor(allPids.size(), [&](std::size_t index, unsigned)
+            {
+                auto previous = full ? _fdTables.end() : _fdTables.find(allPids[index]);
+                newFdTables[index] = readFdTable(procFd.get(), allPids[index],
+                    previous == _fdTables.end() ? nullptr : &previous->second);
+            });
+
+            // Rebuild the inode -> pid map; processes that exited drop out here
+            _inodes.clear();
+            std::unordered_map<pid_t, FdTable> fdTables;
+            for(std::size_t index = 0; index < allPids.size(); ++index)
+            {
+                for(const auto &[fd, inode] : newFdTables[index])
+                {
+                    if(inode)
+                        _inodes.try_emplace(inode, allPids[index]);
+                }
+
+                fdTables.emplace(allPids[index], std::move(newFdTables[index]));
+            }
+
+            _fdTables = std::move(fdTables);
+        }
+
+        static FdTable readFdTable(int procFd, pid_t pid, const FdTable *pPrevious)
+        {
+            FdTable fdTable;
+
+            const std::string fdDirPath{std::to_string(pid) + "/fd"};
+            int fdDirFd = ::openat(procFd, fdDirPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if(fdDirFd < 0)
+                return fdTable;
+
+            // fdopendir() takes ownership of fdDirFd
+            DIR *pFdDir = ::fdopendir(fdDirFd);
+            if(!pFdDir)
+            {
+                ::close(fdDirFd);
+                return fdTable;
+            }
+
+            auto closeFdDir = scopeGuard([&] { ::closedir(pFdDir); });
+            while(const dirent *pEntry = ::readdir(pFdDir))
+            {
+                auto fd = toPid(pEntry->d_name);
+                if(!fd)
+                    continue;
+
+                // Only read links we haven't already seen
+                if(pPrevious)
+                {
+                    auto it = pPrevious->find(*fd);
+                    if(it != pPrevious->end())
+                    {
+                        fdTable.emplace(*fd, it->second);
+                        continue;
+                    }
+                }
+
+                fdTable.emplace(*fd, socketInode(::dirfd(pFdDir), pEntry->d_name));
+            }
+
+            return fdTable;
+        }
+
+        // Socket fd links look like "socket:[12345]"
+        static std::uint32_t socketInode(int fdDirFd, const char *name)
+        {
+            constexpr std::string_view prefix{"socket:["};
+
+            char link[64]{};
+            ssize_t length = ::readlinkat(fdDirFd, name, link, sizeof(link) - 1);
+            if(length <= 0)
+                return 0;
+
+            std::string_view target{link, static_cast<std::size_t>(length)};
+            if(!target.starts_with(prefix))
+                return 0;
+
+            std::uint32_t inode{0};
+            for(auto ch : target.substr(prefix.size()))
+            {
+                if(ch < '0' || ch > '9')
+                    break;
+                inode = inode * 10 + (ch - '0');
+            }
+
+            return inode;
+        }
+
+    private:
+        std::mutex _mutex;
+        std::unordered_map<pid_t, FdTable> _fdTables;
+        std::unordered_map<std::uint32_t, pid_t> _inodes;
+        std::unordered_set<std::uint32_t> _unresolvable;
+    };
+
+    InodeIndex &inodeIndex()
+    {
+        static InodeIndex index;
+        return index;
+    }
+
+    // Dump every TCP/UDP socket of every network namespace, invoking
+    // func(msg, protocol, netns) for each. A sock_diag socket only sees the
+    // namespace it was created in, so it's created inside each one.
+    template <typename Func_T>
+    void dumpSockets(bool withTcpInfo, Func_T func)
+    {
+        NetNamespace::forEach(NetNamespace::list(), [&](const NetNamespace::Info &ns)
+        {
+            NetlinkSocket netlink{NETLINK_SOCK_DIAG};
+
+            for(const auto &[family, protocol] : socketKinds)
+            {
+                inet_diag_req_v2 request{};
+                request.sdiag_family = family;
+                request.sdiag_protocol = protocol;
+                // All states
+                request.idiag_states = ~0U;
+                if(withTcpInfo && protocol == IPPROTO_TCP)
+                    request.idiag_ext |= (1 << (INET_DIAG_INFO - 1)) | (1 << (INET_DIAG_SKMEMINFO - 1));
+
+                netlink.dump(SOCK_DIAG_BY_FAMILY, request, [&, protocol = protocol](const nlmsghdr &msg)
+                {
+                    func(msg, protocol, ns.inode);
+                });
+            }
+        });
+    }
+
+    std::optional<PortFinder::TcpInfo> parseTcpInfo(const nlmsghdr &msg)
+    {
+        std::optional<PortFinder::TcpInfo> tcpInfo;
+        std::uint32_t memInfo[SK_MEMINFO_VARS]{};
+
+        const auto *pDiagMsg = static_cast<const inet_diag_msg*>(NLMSG_DATA(&msg));
+        int length = static_cast<int>(msg.nlmsg_len - NLMSG_LENGTH(sizeof(*pDiagMsg)));
+        for(auto *pAttr = reinterpret_cast<const rtattr*>(pDiagMsg + 1); RTA_OK(pAttr, length);
+            pAttr = RTA_NEXT(pAttr, length))
+        {
+            if(pAttr->rta_type == INET_DIAG_INFO)
+            {
+                // Older kernels have a shorter tcp_info, the fields they lack stay zero
+                tcp_info info{};
+                std::memcpy(&info, RTA_DATA(pAttr), std::min<std::size_t>(RTA_PAYLOAD(pAttr), sizeof(info)));
+                tcpInfo = PortFinder::TcpInfo{info.tcpi_bytes_acked, info.tcpi_bytes_received,
+                    info.tcpi_rtt, info.tcpi_rttvar, info.tcpi_snd_cwnd, info.tcpi_total_retrans};
+            }
+            else if(pAttr->rta_type == INET_DIAG_SKMEMINFO)
+            {
+                std::memcpy(memInfo, RTA_DATA(pAttr), std::min<std::size_t>(RTA_PAYLOAD(pAttr), sizeof(memInfo)));
+            }
+        }
+
+        if(tcpInfo)
+        {
+            tcpInfo->sendQueued = memInfo[SK_MEMINFO_WMEM_QUEUED];
+            tcpInfo->sendBuffer = memInfo[SK_MEMINFO_SNDBUF];
+        }
+
+        return tcpInfo;
+    }
+}
+
+std::optional<PortFinder::Connection> PortFinder::connectionFromMessage(const nlmsghdr &msg, std::uint8_t protocol,
+    std::uint32_t netns)
+{
+    if(msg.nlmsg_type != SOCK_DIAG_BY_FAMILY || msg.nlmsg_len < NLMSG_LENGTH(sizeof(inet_diag_msg)))
+        return {};
+
+    return Connection{*static_cast<const inet_diag_msg*>(NLMSG_DATA(&msg)), protocol, 0, parseTcpInfo(msg), netns};
+}
+
+std::string PortFinder::Connection::stateName() const
+{
+    // Indexed by the kernel's TCP_* states
+    static const char *stateNames[]{"UNKNOWN", "ESTABLISHED", "SYN_SENT", "SYN_RECV", "FIN_WAIT1", "FIN_WAIT2",
+        "TIME_WAIT", "CLOSE", "CLOSE_WAIT", "LAST_ACK", "LISTEN", "CLOSING", "NEW_SYN_RECV"};
+
+    if(_protocol == IPPROTO_UDP)
+        return "UDP";
+
+    return _diagMsg.idiag_state < std::size(stateNames) ? stateNames[_diagMsg.idiag_state] : stateNames[0];
+}
+
+bool PortFinder::Connection::isIpv6AnyAddress() const
+{
+    if(isIpv4()) return false;
+
+    const auto &in6addr{_diagMsg.id.idiag_src};
+    return std::all_of(std::begin(in6addr), std::end(in6addr), [](auto val)
+    {
+        return val == 0;
+    });
+}
+
+std::vector<pid_t> PortFinder::allPids()
+{
+    std::vector<pid_t> allPidVector;
+
+    DIR *pProcDir = ::opendir("/proc");
+    if(!pProcDir)
+        return allPidVector;
+
+    auto closeProcDir = scopeGuard([&] { ::closedir(pProcDir); });
+    while(const dirent *pEntry = ::readdir(pProcDir))
+    {
+        if(auto pid = toPid(pEntry->d_name))
+            allPidVector.push_back(*pid);
+    }
+
+    return allPidVector;
+}
+
+std::string PortFinder::pidToPath(pid_t pid)
+{
+    char path[PATH_MAX]{};
+    const std::string exeLink{"/proc/" + std::to_string(pid) + "/exe"};
+    if(::readlink(exeLink.c_str(), path, sizeof(path) - 1) < 0)
+        return {};
+
+    // Wrap in std::string for convenience
+    return std::string{path};
+}
+
+std::vector<PortFinder::Connection> PortFinder::allConnections(bool withTcpInfo)
+{
+    std::vector<Connection> sockets;
+    std::unordered_set<std::uint32_t> inodes;
+
+    dumpSockets(withTcpInfo, [&](const nlmsghdr &msg, std::uint8_t protocol, std::uint32_t netns)
+    {
+        if(auto connection = connectionFromMessage(msg, protocol, netns))
+        {
+            if(connection->inode())
+                inodes.insert(connection->inode());
+            sockets.push_back(std::move(*connection));
+        }
+    });
+
+    const auto pids = inodeIndex().resolve(inodes);
+
+    std::vector<Connection> connections;
+    connections.reserve(sockets.size());
+    for(const auto &socket : sockets)
+    {
+        auto it = pids.find(socket.inode());
+        connections.emplace_back(socket.diagMsg(), static_cast<std::uint8_t>(socket.protocol()),
+            it == pids.end() ? 0 : it->second, socket.tcpInfo(), socket.netns());
+    }
+
+    return connections;
+}
+
+void PortFinder::forEachConnectionRecord(const PidSet &pids, IPVersion ipVersion, const RecordBatchFuncT &func)
+{
+    std::vector<ConnectionRecord> records;
+    std::unordered_set<std::uint32_t> inodes;
+    InodeIndex::Pass pass;
+
+    // Keep just the selected processes' connections (in place) and pass them on
+    auto flush = [&]
+    {
+        const auto owners = inodeIndex().resolve(inodes, pass);
+        std::size_t selectedCount{0};
+        for(auto &record : records)
+        {
+            auto it = owners.find(record.inode());
+            if(it != owners.end() && pids.contains(it->second))
+            {
+                record.setPid(it->second);
+                records[selectedCount++] = record;
+            }
+        }
+        records.erase(records.begin() + static_cast<std::ptrdiff_t>(selectedCount), records.end());
+
+        if(!records.empty())
+            func(records);
+        records.clear();
+        inodes.clear();
+    };
+
+    dumpSockets(false, [&](const nlmsghdr &msg, std::uint8_t protocol, std::uint32_t netns)
+    {
+        // Sockets without an inode have no owner, so can't be one of the processes'
+        auto connection = connectionFromMessage(msg, protocol, netns);
+        if(connection && connection->inode() && matchesIpVersion(*connection, ipVersion))
+        {
+            inodes.insert(connection->inode());
+            records.emplace_back(*connection);
+            if(records.size() >= recordBatchSize)
+                flush();
+        }
+    });
+    flush();
+
+    inodeIndex().finish(pass);
+}
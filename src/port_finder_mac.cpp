@@ -0,0 +1,145 @@
+#include "common.h"
+#include "port_finder.h"
+#include <mutex>
+
+bool PortFinder::Connection::isIpv6AnyAddress() const
+{
+    if(isIpv4()) return false;
+
+    const auto &in6addr{inetInfo().insi_laddr.ina_6.s6_addr};
+    return std::all_of(std::begin(in6addr), std::end(in6addr), [](auto val)
+    {
+        return val == 0;
+    });
+}
+
+std::string PortFinder::Connection::stateName() const
+{
+    // Indexed by the TSI_S_* states, named as on Linux
+    static const char *stateNames[]{"CLOSE", "LISTEN", "SYN_SENT", "SYN_RECV", "ESTABLISHED", "CLOSE_WAIT",
+        "FIN_WAIT1", "CLOSING", "LAST_ACK", "FIN_WAIT2", "TIME_WAIT"};
+
+    if(protocol() == IPPROTO_UDP)
+        return "UDP";
+
+    // Only sockets reported as SOCKINFO_TCP carry the TCP state
+    const auto state = _socketInfo.soi_proto.pri_tcp.tcpsi_state;
+    if(_socketInfo.soi_kind != SOCKINFO_TCP || state < 0 || state >= static_cast<int>(std::size(stateNames)))
+        return "UNKNOWN";
+
+    return stateNames[state];
+}
+
+namespace
+{
+template <typename Func_T>
+void connectionsForPid(pid_t pid, IPVersion ipVersion, Func_T func)
+{
+    for(const auto &fd : PortFinder::socketFds(pid))
+    {
+        const auto connection = PortFinder::connectionForFd(pid, fd);
+        if(!connection)
+            continue;
+
+        if(PortFinder::matchesIpVersion(*connection, ipVersion))
+            func(*connection);
+    }
+}
+}
+
+std::vector<pid_t> PortFinder::allPids()
+{
+    // Called with no buffer, proc_listallpids() returns the current number of pids
+    int totalPidCount = proc_listallpids(nullptr, 0);
+    std::vector<pid_t> allPidVector;
+
+    while(totalPidCount > 0)
+    {
+        // Leave some headroom for processes started in the meantime
+        allPidVector.resize(totalPidCount + totalPidCount / 8 + 16);
+        totalPidCount = proc_listallpids(allPidVector.data(), allPidVector.size() * sizeof(pid_t));
+
+        // If the buffer was filled, the list may have been truncated - try again with a bigger one
+        if(totalPidCount < static_cast<int>(allPidVector.size()))
+            break;
+    }
+
+    allPidVector.resize(std::max(totalPidCount, 0));
+    return allPidVector;
+}
+
+std::vector<int> PortFinder::socketFds(pid_t pid)
+{
+    std::vector<int> socketFds;
+
+    // Get the buffer size needed
+    int size = proc_pidinfo(pid, PROC_PIDLISTFDS, 0, nullptr, 0);
+    if(size <= 0)
+        return socketFds;
+
+    std::vector<proc_fdinfo> fds;
+    fds.resize(size / sizeof(proc_fdinfo));
+    // Get the file descriptors
+    size = proc_pidinfo(pid, PROC_PIDLISTFDS, 0, fds.data(), fds.size() * sizeof(proc_fdinfo));
+    fds.resize(std::max(size, 0) / sizeof(proc_fdinfo));
+
+    for(const auto &fd : fds)
+    {
+        // Don't care about anything besides sockets
+        if(fd.proc_fdtype == PROX_FDTYPE_SOCKET)
+            socketFds.push_back(fd.proc_fd);
+    }
+
+    return socketFds;
+}
+
+std::optional<PortFinder::Connection> PortFinder::connectionForFd(pid_t pid, int fd)
+{
+    socket_fdinfo socketFdInfo{};
+    int size = proc_pidfdinfo(pid, fd, PROC_PIDFDSOCKETINFO,
+                              &socketFdInfo, sizeof(socketFdInfo));
+    if(size != sizeof(socketFdInfo))
+        return {};
+
+    // Use an OOP wrapper for convenience
+    Connection connection{socketFdInfo.psi, pid};
+
+    // Don't care about anything other than TCP/UDP.
+    // It seems that TCP sockets may sometimes be indicated with
+    // soi_kind==SOCKINFO_IN instead of SOCKINFO_TCP.
+    // we don't use anything from the TCP-specific socket info so this is
+    // fine, identify sockets by checking the IP protocol.
+    if(!(connection.protocol() == IPPROTO_TCP || connection.protocol() == IPPROTO_UDP))
+        return {};
+
+    return connection;
+}
+
+std::string PortFinder::pidToPath(pid_t pid)
+{
+    char path[PATH_MAX]{};
+    proc_pidpath(pid, path, sizeof(path));
+
+    // Wrap in std::string for convenience
+    return std::string{path};
+}
+
+void PortFinder::forEachConnectionRecord(const PidSet &pids, IPVersion ipVersion, const RecordBatchFuncT &func)
+{
+    // Each process's connections are passed on as soon as it's been scanned
+    std::mutex funcMutex;
+    std::vector<WorkerBuffer<std::vector<ConnectionRecord>>> workerRecords(ThreadPool::shared().threadCount());
+    forEachPid(pids, [&](pid_t pid, unsigned worker) {
+        auto &records = workerRecords[worker].value;
+        connectionsForPid(pid, ipVersion, [&](const auto &connection) {
+            records.emplace_back(connection);
+        });
+
+        if(!records.empty())
+        {
+            std::lock_guard lock{funcMutex};
+            func(records);
+        }
+        records.clear();
+    });
+}
@@ -3,6 +3,18 @@
 
 namespace Proc
 {
+    struct ProcessInfo
+    {
+        pid_t ppid{};
+        uid_t uid{};
+        // Ticks since boot on Linux, microseconds since the epoch on macOS
+        std::uint64_t startTime{};
+    };
+
+    // What a single query of the kernel tells us about the process (nothing if it doesn't exist)
+    std::optional<ProcessInfo> processInfo(pid_t pid);
     pid_t getppid(pid_t pid);
     std::string pidToPath(pid_t pid);
+    // As above, reusing path's storage
+    void pidToPath(pid_t pid, std::string &path);
 }
@@ -0,0 +1,252 @@
+#include "proc_connector.h"
+#include "process_cache.h"
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <climits>
+#include <charconv>
+#include <cstring>
+#include <cstddef>
+
+namespace
+{
+    // Room for bursts of thousands of events (e.g a parallel build) while we're
+    // busy reading /proc - SO_RCVBUFFORCE lets root go past rmem_max
+    const int receiveBufferSize{16 * 1024 * 1024};
+    // Datagrams read per recvmmsg(), each one a single (small) event
+    const std::size_t batchSize{64};
+    const std::size_t datagramSize{1024};
+    // Arguments are read with a single pread(), anything past this is cut off
+    const std::size_t maxArgumentsSize{64 * 1024};
+
+    // Newer kernel headers moved the event types out of struct proc_event
+#if defined(PROC_EVENT_ALL)
+    const auto forkEvent{PROC_EVENT_FORK};
+    const auto execEvent{PROC_EVENT_EXEC};
+    const auto exitEvent{PROC_EVENT_EXIT};
+#else
+    const auto forkEvent{proc_event::PROC_EVENT_FORK};
+    const auto execEvent{proc_event::PROC_EVENT_EXEC};
+    const auto exitEvent{proc_event::PROC_EVENT_EXIT};
+#endif
+
+    void subscribe(int fd)
+    {
+        const proc_cn_mcast_op op{PROC_CN_MCAST_LISTEN};
+        std::array<std::uint8_t, NLMSG_SPACE(sizeof(cn_msg) + sizeof(op))> message{};
+
+        auto *pHeader = reinterpret_cast<nlmsghdr*>(message.data());
+        pHeader->nlmsg_len = NLMSG_LENGTH(sizeof(cn_msg) + sizeof(op));
+        pHeader->nlmsg_type = NLMSG_DONE;
+        pHeader->nlmsg_pid = static_cast<std::uint32_t>(::getpid());
+
+        auto *pMessage = static_cast<cn_msg*>(NLMSG_DATA(pHeader));
+        pMessage->id.idx = CN_IDX_PROC;
+        pMessage->id.val = CN_VAL_PROC;
+        pMessage->len = sizeof(op);
+        std::memcpy(pMessage->data, &op, sizeof(op));
+
+        if(::send(fd, message.data(), pHeader->nlmsg_len, 0) < 0)
+            throw SystemError("Could not subscribe to process events");
+    }
+}
+
+std::string ProcConnector::Stats::toString() const
+{
+    return fmt::format("proc connector: {} execs, {} exits, {} lost races, {} overflows",
+        execs, exits, lostRaces, overflows);
+}
+
+ProcConnector::ProcConnector()
+: _socket{::socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR)}
+, _procDir{::open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC)}
+, _argumentBuffer(maxArgumentsSize)
+{
+    if(!_socket)
+        throw SystemError("Could not open proc connector socket");
+    if(!_procDir)
+        throw SystemError("Could not open /proc");
+
+    if(::setsockopt(_socket.get(), SOL_SOCKET, SO_RCVBUFFORCE, &receiveBufferSize, sizeof(receiveBufferSize)))
+        ::setsockopt(_socket.get(), SOL_SOCKET, SO_RCVBUF, &receiveBufferSize, sizeof(receiveBufferSize));
+
+    sockaddr_nl address{};
+    address.nl_family = AF_NETLINK;
+    address.nl_groups = CN_IDX_PROC;
+    if(::bind(_socket.get(), reinterpret_cast<sockaddr*>(&address), sizeof(address)))
+        throw SystemError("Could not bind proc connector socket");
+
+    subscribe(_socket.get());
+}
+
+void ProcConnector::receive()
+{
+    std::vector<std::uint8_t> buffer(batchSize * datagramSize);
+    std::array<iovec, batchSize> vectors{};
+    std::array<mmsghdr, batchSize> messages{};
+    for(std::size_t index = 0; index < batchSize; ++index)
+    {
+        vectors[index] = {buffer.data() + index * datagramSize, datagramSize};
+        messages[index].msg_hdr.msg_iov = &vectors[index];
+        messages[index].msg_hdr.msg_iovlen = 1;
+    }
+
+    std::vector<ProcessEvent> events;
+    while(true)
+    {
+        // Block for the first datagram, then take whatever else is queued
+        const int count = ::recvmmsg(_socket.get(), messages.data(), batchSize, MSG_WAITFORONE, nullptr);
+        if(count < 0)
+        {
+            // Events were dropped because we didn't keep up, carry on with the rest
+            // (but without trusting what they would have told the cache)
+            if(errno == ENOBUFS)
+            {
+                ++_stats.overflows;
+                ProcessCache::shared().clear();
+            }
+            else if(errno != EINTR)
+                throw SystemError("Could not read from proc connector socket");
+            continue;
+        }
+
+        for(int index = 0; index < count; ++index)
+        {
+            int length = static_cast<int>(messages[index].msg_len);
+            for(auto *pMsg = reinterpret_cast<const nlmsghdr*>(vectors[index].iov_base); NLMSG_OK(pMsg, length);
+                pMsg = NLMSG_NEXT(pMsg, length))
+            {
+                const auto *pMessage = static_cast<const cn_msg*>(NLMSG_DATA(pMsg));
+                if(pMsg->nlmsg_len < NLMSG_LENGTH(sizeof(cn_msg)) ||
+                    pMessage->id.idx != CN_IDX_PROC || pMessage->id.val != CN_VAL_PROC)
+                {
+                    continue;
+                }
+
+                // Older kernels send a smaller event (the union has grown over time)
+                const auto eventSize = std::min<std::size_t>({pMessage->len, sizeof(proc_event),
+                    pMsg->nlmsg_len - NLMSG_LENGTH(sizeof(cn_msg))});
+                if(eventSize < offsetof(proc_event, event_data))
+                    continue;
+
+                proc_event event{};
+                std::memcpy(&event, pMessage->data, eventSize);
+                processEvent(event, events);
+            }
+        }
+
+        // Every exec in the batch has been read from /proc before any of them
+        // are passed on, so slow callbacks (output) don't cost us races
+        for(const auto &event : events)
+        {
+            if(event.mode == ProcessEvent::Starting)
+                _procStartedFunc(event);
+            else
+                _procExitedFunc(event);
+        }
+        events.clear();
+    }
+}
+
+void ProcConnector::processEvent(const proc_event &event, std::vector<ProcessEvent> &events)
+{
+    switch(event.what)
+    {
+    case forkEvent:
+    {
+        // New threads are reported as forks too
+        const auto &fork = event.event_data.fork;
+        if(fork.child_pid == fork.child_tgid)
+            ProcessCache::shared().forked(fork.child_tgid, fork.parent_tgid);
+        break;
+    }
+    case execEvent:
+    {
+        const pid_t pid = event.event_data.exec.process_tgid;
+        ProcessEvent processEvent;
+        processEvent.mode = ProcessEvent::Starting;
+        processEvent.type = static_cast<std::uint16_t>(event.what);
+        processEvent.pid = pid;
+
+        ++_stats.execs;
+        if(!readProcess(pid, processEvent))
+        {
+            ++_stats.lostRaces;
+            break;
+        }
+
+        auto &cache = ProcessCache::shared();
+        cache.executed(pid, processEvent.path,
+            processEvent.arguments.empty() ? std::string_view{} : processEvent.arguments.front(), processEvent.uid);
+        processEvent.ppid = cache.ppid(pid);
+        events.push_back(std::move(processEvent));
+        break;
+    }
+    case exitEvent:
+    {
+        // Only the exit of the process itself, not of each of its threads
+        const auto &exit = event.event_data.exit;
+        if(exit.process_pid != exit.process_tgid)
+            break;
+
+        ProcessEvent processEvent;
+        processEvent.mode = ProcessEvent::Exiting;
+        processEvent.type = static_cast<std::uint16_t>(event.what);
+        processEvent.pid = exit.process_tgid;
+        processEvent.ppid = exit.parent_tgid;
+        processEvent.exitStatus = exit.exit_code;
+
+        ++_stats.exits;
+        auto &cache = ProcessCache::shared();
+        processEvent.path = cache.path(exit.process_tgid);
+        cache.exited(exit.process_tgid);
+        events.push_back(std::move(processEvent));
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+bool ProcConnector::readProcess(pid_t pid, ProcessEvent &event)
+{
+    char pidString[16]{};
+    std::to_chars(pidString, pidString + sizeof(pidString) - 1, pid);
+
+    Fd pidDir{::openat(_procDir.get(), pidString, O_RDONLY | O_DIRECTORY | O_CLOEXEC)};
+    if(!pidDir)
+        return false;
+
+    // exe can't be read once the process is a zombie
+    char path[PATH_MAX];
+    const auto pathLength = ::readlinkat(pidDir.get(), "exe", path, sizeof(path));
+    if(pathLength <= 0)
+        return false;
+    event.path.assign(path, static_cast<std::size_t>(pathLength));
+
+    // /proc/<pid> is owned by the process's effective uid
+    struct stat info{};
+    if(::fstat(pidDir.get(), &info) == 0)
+        event.uid = info.st_uid;
+
+    Fd cmdline{::openat(pidDir.get(), "cmdline", O_RDONLY | O_CLOEXEC)};
+    if(!cmdline)
+        return false;
+
+    const auto length = ::pread(cmdline.get(), _argumentBuffer.data(), _argumentBuffer.size(), 0);
+    if(length < 0)
+        return false;
+
+    // The arguments are NUL separated (and terminated)
+    for(std::string_view arguments{_argumentBuffer.data(), static_cast<std::size_t>(length)}; !arguments.empty();)
+    {
+        const auto end = std::min(arguments.find('\0'), arguments.size());
+        event.arguments.emplace_back(arguments.substr(0, end));
+        arguments.remove_prefix(std::min(end + 1, arguments.size()));
+    }
+
+    return true;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "util.h"
+#include "fd.h"
+#include "process_event.h"
+
+struct proc_event;
+
+// Process fork/exec/exit events from the kernel's proc connector (CN_PROC) - the
+// Linux counterpart of AuditPipe. Needs CAP_NET_ADMIN.
+//
+// The kernel only tells us the pid of an exec, so its path and arguments are read
+// from /proc/<pid>/exe and cmdline straight away, through a /proc dirfd opened up
+// front. A process that exits before we get there has lost its /proc entry: that
+// exec is counted as a lost race rather than reported. Every fork, exec and exit
+// is also fed to the ProcessCache, which is where exec parents come from (exec
+// events don't carry them), and exits their path.
+class ProcConnector
+{
+public:
+    using ProcessEvent = ::ProcessEvent;
+
+    struct Stats
+    {
+        std::uint64_t execs{};
+        std::uint64_t exits{};
+        // Execs whose process exited before its path could be read
+        std::uint64_t lostRaces{};
+        // Times the socket buffer overflowed, losing an unknown number of events
+        std::uint64_t overflows{};
+
+        std::string toString() const;
+    };
+
+private:
+    using ProcCallbackT = std::function<void(const ProcessEvent&)>;
+
+public:
+    ProcConnector();
+
+public:
+    void onProcessStarted(ProcCallbackT proc) { _procStartedFunc = std::move(proc); }
+    void onProcessExited(ProcCallbackT proc) { _procExitedFunc = std::move(proc); }
+    // Read events forever
+    void receive();
+
+    const Stats &stats() const {return _stats;}
+
+private:
+    // Handle a raw event, adding the execs and exits to events
+    void processEvent(const proc_event &event, std::vector<ProcessEvent> &events);
+    // Fill in the path, arguments and uid of a process that just exec'd,
+    // false if it's already gone
+    bool readProcess(pid_t pid, ProcessEvent &event);
+
+private:
+    Fd _socket;
+    Fd _procDir;
+    std::vector<char> _argumentBuffer;
+    Stats _stats;
+    ProcCallbackT _procStartedFunc=[](auto&){};
+    ProcCallbackT _procExitedFunc=[](auto&){};
+};
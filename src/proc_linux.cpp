@@ -0,0 +1,81 @@
+#include "common.h"
+#include "proc.h"
+#include "util.h"
+#include <fcntl.h>
+#include <climits>
+#include <sys/stat.h>
+
+std::optional<Proc::ProcessInfo> Proc::processInfo(pid_t pid)
+{
+    char statPath[32]{};
+    ::snprintf(statPath, sizeof(statPath), "/proc/%d/stat", pid);
+    AutoCloseFile statFile{::fopen(statPath, "re")};
+    if(statFile == nullptr)
+        return {};
+
+    char buf[1024]{};
+    const auto length = ::fread(buf, 1, sizeof(buf) - 1, statFile);
+    const std::string_view stat{buf, length};
+
+    // Parsed from the last ')' as in getppid(): ppid is field 4, the start time field 22
+    const auto commEnd = stat.rfind(')');
+    if(commEnd == std::string_view::npos)
+        return {};
+
+    ProcessInfo info;
+    unsigned long long startTime{};
+    if(::sscanf(buf + commEnd + 1, " %*c %d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u"
+        " %*d %*d %*d %*d %*d %*d %llu", &info.ppid, &startTime) != 2)
+    {
+        return {};
+    }
+    info.startTime = startTime;
+
+    // The process's files in /proc belong to its effective uid
+    struct stat fileInfo{};
+    if(::fstat(::fileno(statFile), &fileInfo) == 0)
+        info.uid = fileInfo.st_uid;
+
+    return info;
+}
+
+pid_t Proc::getppid(pid_t pid)
+{
+    // /proc/<pid>/stat looks like "pid (comm) state ppid ..." - comm
+    // may itself contain spaces or parens, so parse from the last ')'
+    const std::string statPath{"/proc/" + std::to_string(pid) + "/stat"};
+    AutoCloseFile statFile{::fopen(statPath.c_str(), "re")};
+    if(statFile == nullptr)
+        return 0;
+
+    char buf[512]{};
+    const auto length = ::fread(buf, 1, sizeof(buf) - 1, statFile);
+    const std::string_view stat{buf, length};
+
+    const auto commEnd = stat.rfind(')');
+    if(commEnd == std::string_view::npos)
+        return 0;
+
+    pid_t ppid{};
+    char state{};
+    if(::sscanf(buf + commEnd + 1, " %c %d", &state, &ppid) != 2)
+        return 0;
+
+    return ppid;
+}
+
+std::string Proc::pidToPath(pid_t pid)
+{
+    std::string path;
+    pidToPath(pid, path);
+    return path;
+}
+
+void Proc::pidToPath(pid_t pid, std::string &path)
+{
+    path.resize(PATH_MAX);
+    char exeLink[32]{};
+    ::snprintf(exeLink, sizeof(exeLink), "/proc/%d/exe", pid);
+    auto realSize = ::readlink(exeLink, path.data(), path.size());
+    path.resize(realSize < 0 ? 0 : realSize);
+}
@@ -4,6 +4,16 @@
 #include <sys/types.h>
 #include <sys/sysctl.h>
 
+std::optional<Proc::ProcessInfo> Proc::processInfo(pid_t pid)
+{
+    proc_bsdinfo bsdInfo{};
+    if(proc_pidinfo(pid, PROC_PIDTBSDINFO, 0, &bsdInfo, sizeof(bsdInfo)) != sizeof(bsdInfo))
+        return {};
+
+    return ProcessInfo{static_cast<pid_t>(bsdInfo.pbi_ppid), bsdInfo.pbi_uid,
+        bsdInfo.pbi_start_tvsec * 1000000 + bsdInfo.pbi_start_tvusec};
+}
+
 pid_t Proc::getppid(pid_t pid)
 {
     pid_t ppid{};
@@ -23,10 +33,15 @@ pid_t Proc::getppid(pid_t pid)
 std::string Proc::pidToPath(pid_t pid)
 {
     std::string path;
+    pidToPath(pid, path);
+    return path;
+}
+
+void Proc::pidToPath(pid_t pid, std::string &path)
+{
     path.resize(PROC_PIDPATHINFO_MAXSIZE);
     auto realSize = proc_pidpath(pid, path.data(), path.size());
-    path.resize(realSize);
-    return path;
+    path.resize(realSize < 0 ? 0 : realSize);
 }
 
 // // std::vector<std::string> Proc::getProcessArgs(pid_t pid)
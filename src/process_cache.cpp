@@ -0,0 +1,286 @@
+#include "process_cache.h"
+#include "proc.h"
+#include "port_finder.h"
+#include <fmt/core.h>
+
+namespace
+{
+    // More entries than this means exits are being missed, start again
+    const std::size_t maxEntries{65536};
+    // How long an entry is trusted before its start time is checked again
+    const auto revalidateInterval{std::chrono::seconds{1}};
+    // Deeper than any real process tree - a guard against a parent loop from a
+    // reused pid
+    const std::size_t maxDepth{1024};
+}
+
+std::string ProcessCache::Stats::toString() const
+{
+    return fmt::format("process cache: {} hits, {} misses, {} entries", hits, misses, entries);
+}
+
+ProcessCache &ProcessCache::shared()
+{
+    static ProcessCache cache;
+    return cache;
+}
+
+void ProcessCache::forked(pid_t pid, pid_t ppid)
+{
+    std::lock_guard lock{_mutex};
+
+    // The child is running its parent's image until it execs
+    Entry entry;
+    auto parent = _entries.find(ppid);
+    if(parent != _entries.end())
+        entry = parent->second;
+    entry.info.ppid = ppid;
+    // Filled in by the first check, rather than a syscall per fork
+    entry.info.startTime = 0;
+
+    insert(pid, std::move(entry));
+}
+
+void ProcessCache::executed(pid_t pid, std::string_view path, std::string_view argv0, uid_t uid)
+{
+    std::lock_guard lock{_mutex};
+
+    auto it = _entries.find(pid);
+    if(it == _entries.end())
+    {
+        // We missed the fork (or it was before we started), the parent has to be looked up
+        ++_stats.misses;
+        const auto info = Proc::processInfo(pid);
+        if(!info)
+            return;
+
+        Entry entry;
+        entry.info.ppid = info->ppid;
+        entry.info.startTime = info->startTime;
+        entry.checked = Clock::now();
+        it = _entries.insert_or_assign(pid, std::move(entry)).first;
+    }
+
+    auto &entry = it->second;
+    entry.info.path = path;
+    entry.info.argv0 = argv0;
+    entry.info.uid = uid;
+    entry.hasPath = true;
+}
+
+void ProcessCache::exited(pid_t pid)
+{
+    std::lock_guard lock{_mutex};
+    _entries.erase(pid);
+}
+
+void ProcessCache::clear()
+{
+    std::lock_guard lock{_mutex};
+    _entries.clear();
+}
+
+void ProcessCache::seed()
+{
+    const auto pids = PortFinder::allPids();
+
+    std::lock_guard lock{_mutex};
+    addMissing(pids);
+}
+
+void ProcessCache::refresh()
+{
+    auto pids = PortFinder::allPids();
+    std::sort(pids.begin(), pids.end());
+
+    std::lock_guard lock{_mutex};
+    std::erase_if(_entries, [&](const auto &entry)
+    {
+        return !std::binary_search(pids.begin(), pids.end(), entry.first);
+    });
+    addMissing(pids);
+}
+
+pid_t ProcessCache::ppid(pid_t pid)
+{
+    std::lock_guard lock{_mutex};
+    return parentOf(pid);
+}
+
+std::string ProcessCache::path(pid_t pid)
+{
+    std::lock_guard lock{_mutex};
+    const auto *pEntry = find(pid);
+    return pEntry ? pEntry->info.path : std::string{};
+}
+
+std::optional<ProcessCache::Info> ProcessCache::lookup(pid_t pid)
+{
+    std::lock_guard lock{_mutex};
+    const auto *pEntry = find(pid);
+    if(!pEntry)
+        return {};
+    return pEntry->info;
+}
+
+bool ProcessCache::descendsFrom(pid_t pid, const PidSet &ancestors)
+{
+    if(ancestors.empty())
+        return false;
+
+    std::lock_guard lock{_mutex};
+    for(std::size_t depth = 0; depth < maxDepth; ++depth)
+    {
+        const auto parent = parentOf(pid);
+        if(parent <= 0 || parent == pid)
+            return false;
+        if(ancestors.contains(parent))
+            return true;
+
+        pid = parent;
+    }
+
+    return false;
+}
+
+std::vector<pid_t> ProcessCache::descendantsOf(const PidSet &ancestors)
+{
+    std::vector<pid_t> descendants;
+    if(ancestors.empty())
+        return descendants;
+
+    std::lock_guard lock{_mutex};
+    for(const auto &[pid, entry] : _entries)
+    {
+        // Only walking what's cached, so nothing is inserted while iterating
+        pid_t parent = entry.info.ppid;
+        for(std::size_t depth = 0; depth < maxDepth && parent > 0; ++depth)
+        {
+            if(ancestors.contains(parent))
+            {
+                descendants.push_back(pid);
+                break;
+            }
+
+            const auto it = _entries.find(parent);
+            if(it == _entries.end() || it->second.info.ppid == parent)
+                break;
+            parent = it->second.info.ppid;
+        }
+    }
+
+    return descendants;
+}
+
+ProcessCache::Stats ProcessCache::stats()
+{
+    std::lock_guard lock{_mutex};
+    auto stats = _stats;
+    stats.entries = _entries.size();
+    return stats;
+}
+
+const ProcessCache::Entry *ProcessCache::find(pid_t pid)
+{
+    if(pid <= 0)
+        return nullptr;
+
+    auto it = _entries.find(pid);
+    if(it != _entries.end() && !isCurrent(pid, it->second))
+    {
+        _entries.erase(it);
+        it = _entries.end();
+    }
+
+    if(it != _entries.end() && it->second.hasPath)
+    {
+        ++_stats.hits;
+        return &it->second;
+    }
+
+    ++_stats.misses;
+    if(it != _entries.end())
+    {
+        // We saw the fork, just not the parent
+        Proc::pidToPath(pid, it->second.info.path);
+        it->second.hasPath = true;
+        return &it->second;
+    }
+
+    const auto info = Proc::processInfo(pid);
+    if(!info)
+        return nullptr;
+
+    Entry entry;
+    entry.info.ppid = info->ppid;
+    entry.info.uid = info->uid;
+    entry.info.startTime = info->startTime;
+    entry.hasPath = true;
+    Proc::pidToPath(pid, entry.info.path);
+
+    insert(pid, std::move(entry));
+    return &_entries.at(pid);
+}
+
+pid_t ProcessCache::parentOf(pid_t pid)
+{
+    if(pid <= 0)
+        return 0;
+
+    // A ppid is known even when the path isn't
+    auto it = _entries.find(pid);
+    if(it != _entries.end())
+    {
+        if(isCurrent(pid, it->second))
+        {
+            ++_stats.hits;
+            return it->second.info.ppid;
+        }
+        _entries.erase(it);
+    }
+
+    ++_stats.misses;
+    const auto info = Proc::processInfo(pid);
+    if(!info)
+        return 0;
+
+    insert(pid, Entry{{info->ppid, info->uid, info->startTime, {}, {}}, false, {}});
+    return info->ppid;
+}
+
+bool ProcessCache::isCurrent(pid_t pid, Entry &entry)
+{
+    const auto now = Clock::now();
+    if(now - entry.checked < revalidateInterval)
+        return true;
+
+    const auto info = Proc::processInfo(pid);
+    if(!info || (entry.info.startTime && entry.info.startTime != info->startTime))
+        return false;
+
+    entry.info.startTime = info->startTime;
+    entry.checked = now;
+    return true;
+}
+
+void ProcessCache::addMissing(const std::vector<pid_t> &pids)
+{
+    for(const auto pid : pids)
+    {
+        if(_entries.contains(pid))
+            continue;
+
+        if(const auto info = Proc::processInfo(pid))
+            insert(pid, Entry{{info->ppid, info->uid, info->startTime, {}, {}}, false, {}});
+    }
+}
+
+void ProcessCache::insert(pid_t pid, Entry entry)
+{
+    // Whatever the entry came from (an event or the kernel), it's current now
+    entry.checked = Clock::now();
+    if(_entries.size() >= maxEntries)
+        _entries.clear();
+
+    _entries.insert_or_assign(pid, std::move(entry));
+}
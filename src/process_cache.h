@@ -0,0 +1,107 @@
+#pragma once
+
+#include "common.h"
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+
+// What we know about each running process - parent, path, argv[0], uid and start
+// time - so the exec tracers don't need a syscall or two per event.
+//
+// Entries are fed by the process events themselves: a fork adds the child (with
+// its parent's image, which it shares until it execs), an exec updates the path
+// and argv[0] and an exit drops the entry. As a fork always replaces whatever was
+// cached for the pid, a reused pid can't inherit its predecessor's details - an
+// entry is only as current as the event stream though, so whoever feeds it must
+// clear() it after losing events. Lookups of pids we have no events for (processes
+// that were running before we started) fall back to querying the kernel, and the
+// result is cached along with the process's start time. A process is identified by
+// its pid and start time: a looked up entry is checked against the kernel at most
+// once a second (a fork's entry only gets its start time at its first check), and
+// is replaced if the pid has been reused.
+//
+// As every entry knows its parent, the cache doubles as the process tree: seed()
+// fills it from a single scan of all processes, and from then on the events keep
+// it current, so finding whether a process descends from another is a walk up
+// its ancestors in memory.
+class ProcessCache
+{
+public:
+    struct Info
+    {
+        pid_t ppid{};
+        uid_t uid{};
+        // From Proc::processInfo(), 0 if it hasn't been checked since the fork
+        std::uint64_t startTime{};
+        std::string path;
+        // Empty if the process hasn't exec'd while we've been watching
+        std::string argv0;
+    };
+
+    struct Stats
+    {
+        std::uint64_t hits{};
+        std::uint64_t misses{};
+        std::size_t entries{};
+
+        std::string toString() const;
+    };
+
+public:
+    // The cache used by the engines
+    static ProcessCache &shared();
+
+public:
+    void forked(pid_t pid, pid_t ppid);
+    void executed(pid_t pid, std::string_view path, std::string_view argv0, uid_t uid);
+    void exited(pid_t pid);
+    // Events were lost, nothing cached can be trusted
+    void clear();
+    // Add the parent of every running process (not their paths, which are
+    // looked up as needed)
+    void seed();
+    // Keep a seed()ed cache current without process events: drop the processes
+    // that have gone and add those started since - only the new pids are queried
+    void refresh();
+
+    // 0 / empty / nothing if the process doesn't exist
+    pid_t ppid(pid_t pid);
+    std::string path(pid_t pid);
+    std::optional<Info> lookup(pid_t pid);
+    // Is one of the process's ancestors (not the process itself) in ancestors?
+    bool descendsFrom(pid_t pid, const PidSet &ancestors);
+    // The cached processes that descend from one of ancestors - all of them once seed()ed
+    std::vector<pid_t> descendantsOf(const PidSet &ancestors);
+
+    Stats stats();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry
+    {
+        Info info;
+        // A fork of a process we know nothing about hasn't got a path yet
+        bool hasPath{};
+        // When the entry was last known to be the pid's current process
+        Clock::time_point checked;
+    };
+
+private:
+    // The entry for pid, querying the kernel if it's missing (or incomplete).
+    // Called with the lock held, nullptr if the process is gone.
+    const Entry *find(pid_t pid);
+    // As above, but only the parent is needed - 0 if the process is gone
+    pid_t parentOf(pid_t pid);
+    // Is the entry still the pid's process? Asks the kernel if it hasn't been
+    // checked for a while, false if the process is gone or the pid was reused
+    bool isCurrent(pid_t pid, Entry &entry);
+    void insert(pid_t pid, Entry entry);
+    // Add entries for those of pids that aren't cached, called with the lock held
+    void addMissing(const std::vector<pid_t> &pids);
+
+private:
+    std::mutex _mutex;
+    std::unordered_map<pid_t, Entry> _entries;
+    Stats _stats;
+};
@@ -0,0 +1,156 @@
+#include "process_cgroups.h"
+#include "util.h"
+#include "proc.h"
+#include <fmt/core.h>
+
+namespace
+{
+    // Docker abbreviates container ids to this many digits
+    const std::size_t shortIdLength{12};
+    const std::size_t idLength{64};
+
+#if defined(RUMI_LINUX)
+    // How long a cached cgroup is trusted before the pid's start time is checked again
+    const auto revalidateInterval{std::chrono::seconds{1}};
+    // Beyond this many entries, ones that haven't been looked up for a while are dropped
+    const std::size_t maxEntries{16384};
+    const auto expireAfter{std::chrono::seconds{30}};
+
+    // The process's start time in clock ticks since boot, 0 if it's gone
+    std::uint64_t startTime(pid_t pid)
+    {
+        const auto info = Proc::processInfo(pid);
+        return info ? info->startTime : 0;
+    }
+
+    // The process's cgroup v2 path, or its systemd hierarchy path on a v1-only system
+    std::string readCgroupPath(pid_t pid)
+    {
+        AutoCloseFile cgroupFile{::fopen(fmt::format("/proc/{}/cgroup", pid).c_str(), "re")};
+        if(cgroupFile == nullptr)
+            return {};
+
+        // Lines look like "hierarchy-id:controllers:path"
+        std::string fallback;
+        char line[4096]{};
+        while(::fgets(line, sizeof(line), cgroupFile))
+        {
+            std::string_view entry{line};
+            if(!entry.empty() && entry.back() == '\n')
+                entry.remove_suffix(1);
+
+            const auto controllersEnd = entry.find(':', entry.find(':') + 1);
+            if(controllersEnd == std::string_view::npos)
+                continue;
+
+            const auto path = entry.substr(controllersEnd + 1);
+            if(entry.starts_with("0::"))
+                return std::string{path};
+            if(fallback.empty() || entry.find(":name=systemd:") != std::string_view::npos)
+                fallback = path;
+        }
+
+        return fallback;
+    }
+#endif
+}
+
+ProcessCgroups &ProcessCgroups::shared()
+{
+    static ProcessCgroups cgroups;
+    return cgroups;
+}
+
+std::string ProcessCgroups::containerId(std::string_view cgroupPath)
+{
+    // Runtimes name a container's cgroup after its id, e.g docker-<id>.scope,
+    // cri-containerd-<id>.scope or kubepods/.../pod<uid>/<id> - the last run of
+    // exactly 64 hex digits is it
+    std::string_view id;
+    std::size_t runStart{0};
+    for(std::size_t index = 0; index <= cgroupPath.size(); ++index)
+    {
+        const bool isHex = index < cgroupPath.size() &&
+            ((cgroupPath[index] >= '0' && cgroupPath[index] <= '9') || (cgroupPath[index] >= 'a' && cgroupPath[index] <= 'f'));
+        if(isHex)
+            continue;
+
+        if(index - runStart == idLength)
+            id = cgroupPath.substr(runStart, idLength);
+        runStart = index + 1;
+    }
+
+    return std::string{id};
+}
+
+ProcessCgroups::Cgroup ProcessCgroups::lookup(pid_t pid)
+{
+#if defined(RUMI_LINUX)
+    if(pid <= 0)
+        return {};
+
+    const auto now = Clock::now();
+    std::optional<std::uint64_t> cachedStartTime;
+    {
+        std::lock_guard lock{_mutex};
+        auto it = _entries.find(pid);
+        if(it != _entries.end())
+        {
+            if(now - it->second.checked < revalidateInterval)
+                return it->second.cgroup;
+            cachedStartTime = it->second.startTime;
+        }
+    }
+
+    // The /proc reads are done without holding the lock
+    const auto pidStartTime = startTime(pid);
+    if(!pidStartTime)
+    {
+        std::lock_guard lock{_mutex};
+        _entries.erase(pid);
+        return {};
+    }
+
+    if(cachedStartTime == pidStartTime)
+    {
+        std::lock_guard lock{_mutex};
+        auto it = _entries.find(pid);
+        if(it != _entries.end() && it->second.startTime == pidStartTime)
+        {
+            it->second.checked = now;
+            return it->second.cgroup;
+        }
+    }
+
+    // A new process, or the pid was reused
+    Entry entry{pidStartTime, now, {}};
+    entry.cgroup.path = readCgroupPath(pid);
+    entry.cgroup.containerId = containerId(entry.cgroup.path);
+
+    std::lock_guard lock{_mutex};
+    if(_entries.size() >= maxEntries)
+        std::erase_if(_entries, [&](const auto &pair) {return now - pair.second.checked >= expireAfter;});
+
+    _entries.insert_or_assign(pid, entry);
+    return entry.cgroup;
+#else
+    (void)pid;
+    return {};
+#endif
+}
+
+std::string ProcessCgroups::columns(pid_t pid, bool verbose)
+{
+    return columns(lookup(pid), verbose);
+}
+
+std::string ProcessCgroups::columns(const Cgroup &cgroup, bool verbose)
+{
+    std::string result;
+    if(!cgroup.containerId.empty())
+        result = fmt::format(" container={}", cgroup.containerId.substr(0, shortIdLength));
+    if(verbose && !cgroup.path.empty())
+        result += fmt::format(" cgroup={}", cgroup.path);
+
+    return result;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "common.h"
+#include <mutex>
+#include <unordered_map>
+
+// The cgroup (and container, if any) of each process, so events can be attributed
+// to a container rather than just a path - on a Kubernetes node every container
+// may well be running /usr/bin/java.
+//
+// A pid's cgroup is read from /proc/<pid>/cgroup once and cached along with the
+// process's start time. Cached entries are revalidated by start time now and then,
+// so a reused pid is never given its predecessor's cgroup. Processes aren't
+// expected to change cgroups once running. macOS has no cgroups, so everything
+// is empty there.
+class ProcessCgroups
+{
+public:
+    struct Cgroup
+    {
+        // e.g "/system.slice/docker-<id>.scope", empty if unknown
+        std::string path;
+        // The full container id, empty if the process isn't in a container
+        std::string containerId;
+    };
+
+public:
+    // The cache used by the engines
+    static ProcessCgroups &shared();
+
+    // The container id in a cgroup path, if there is one
+    static std::string containerId(std::string_view cgroupPath);
+
+public:
+    Cgroup lookup(pid_t pid);
+    // Extra output columns for the pid: " container=<short id>", plus
+    // " cgroup=<path>" if verbose (empty if there's nothing to show)
+    std::string columns(pid_t pid, bool verbose);
+    // As above, for a cgroup that's already known (e.g that of an exited process)
+    static std::string columns(const Cgroup &cgroup, bool verbose);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry
+    {
+        std::uint64_t startTime{};
+        Clock::time_point checked;
+        Cgroup cgroup;
+    };
+
+private:
+    std::mutex _mutex;
+    std::unordered_map<pid_t, Entry> _entries;
+};
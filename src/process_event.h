@@ -0,0 +1,54 @@
+#pragma once
+
+#include "common.h"
+
+// A process starting (exec) or exiting, as reported by the proc connector (or
+// taskstats, for exits with their resource usage) on Linux. BsmReader::ProcessEvent
+// is the BSM (macOS) equivalent, which views its read buffer rather than owning
+// copies - View::Exec renders either.
+struct ProcessEvent
+{
+    // What an exited process used over its lifetime, summed over its threads
+    struct Usage
+    {
+        std::uint64_t userTimeUs{};
+        std::uint64_t systemTimeUs{};
+        // The RSS high-water mark
+        std::uint64_t maxRssKb{};
+        // Storage I/O, rather than all reads and writes
+        std::uint64_t readBytes{};
+        std::uint64_t writeBytes{};
+        // Time spent waiting for a CPU and for block I/O (only counted with
+        // delay accounting enabled, the kernel.task_delayacct sysctl)
+        std::uint64_t cpuDelayNs{};
+        std::uint64_t blockIoDelayNs{};
+
+        Usage &operator+=(const Usage &other);
+    };
+
+    enum Mode {Unknown, Starting, Exiting};
+    Mode mode{Mode::Unknown};
+
+    // The platform's own event type (a BSM event on macOS, a PROC_EVENT_* on Linux)
+    uint16_t type{};
+    pid_t pid{};
+    pid_t ppid{};
+    uid_t uid{};
+    uint32_t exitStatus{};
+    std::string path;
+    std::vector<std::string> arguments;
+    // Only for exits from taskstats
+    std::optional<Usage> usage;
+};
+
+inline ProcessEvent::Usage &ProcessEvent::Usage::operator+=(const Usage &other)
+{
+    userTimeUs += other.userTimeUs;
+    systemTimeUs += other.systemTimeUs;
+    maxRssKb = std::max(maxRssKb, other.maxRssKb);
+    readBytes += other.readBytes;
+    writeBytes += other.writeBytes;
+    cpuDelayNs += other.cpuDelayNs;
+    blockIoDelayNs += other.blockIoDelayNs;
+    return *this;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "common.h"
+#include <unordered_map>
+#if defined(RUMI_LINUX)
+#include "fd.h"
+#endif
+
+// The CPU time, memory, threads and fds of processes, sampled cheaply enough to
+// watch thousands of them every second.
+//
+// On Linux each process's /proc stat file and fd directory are opened once and
+// kept open, a sample being a pread() of stat (parsed in place, without
+// allocating) and an fstat() of the fd directory, whose size is its number of
+// entries. The open files belong to the process rather than to its pid, so a
+// reused pid can't be mistaken for the process we were sampling. On macOS a
+// sample is a proc_pidinfo() for the task and one for its fd list.
+class ProcessResources
+{
+public:
+    struct Sample
+    {
+        // The kernel's (truncated) name for the process, valid until the next sample()
+        std::string_view name;
+        // User plus system CPU time over the process's life
+        std::uint64_t cpuTimeUs{};
+        std::uint64_t rssKb{};
+        std::uint32_t threads{};
+        // Nothing if we're not allowed to see them
+        std::optional<std::uint32_t> fds;
+        // Tells a reused pid apart from the process that had it before
+        std::uint64_t startTime{};
+    };
+
+public:
+    ProcessResources();
+
+public:
+    // Nothing if the process is gone (or we're not allowed to look at it)
+    std::optional<Sample> sample(pid_t pid);
+    // Stop sampling the process, releasing what was kept open for it
+    void forget(pid_t pid);
+
+private:
+#if defined(RUMI_LINUX)
+    struct Files
+    {
+        Fd stat;
+        Fd fdDirectory;
+    };
+
+    Files open(pid_t pid) const;
+    std::optional<std::uint32_t> countFds(int fdDirectory);
+
+private:
+    Fd _procDirectory;
+    std::unordered_map<pid_t, Files> _files;
+    // Past this many processes, files are opened for each sample rather than kept
+    std::size_t _maxKeptFiles{};
+    // Before Linux 6.2 an fd directory's size is 0, so its entries are counted
+    bool _fdCountInSize{};
+    std::uint64_t _ticksPerSecond{};
+    std::uint64_t _pageSizeKb{};
+    std::array<char, 1024> _statBuffer{};
+    std::vector<std::uint8_t> _directoryBuffer;
+#elif defined(RUMI_MACOS)
+    // Converts Mach absolute time to nanoseconds
+    std::uint32_t _timebaseNumer{1};
+    std::uint32_t _timebaseDenom{1};
+    // Backs Sample::name
+    std::array<char, 33> _name{};
+    std::vector<std::uint8_t> _fdBuffer;
+#endif
+};
@@ -0,0 +1,185 @@
+#include "process_resources.h"
+#include "util.h"
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <charconv>
+
+namespace
+{
+    // fds left for everything else once the per-process files are counted
+    const rlim_t reservedFds{256};
+    const std::size_t directoryBufferSize{32 * 1024};
+
+    // The proc(5) fields of /proc/<pid>/stat we want
+    struct StatFields
+    {
+        std::string_view comm;
+        std::uint64_t utime{};
+        std::uint64_t stime{};
+        std::uint64_t threads{};
+        std::uint64_t startTime{};
+        std::uint64_t rssPages{};
+    };
+
+    // /proc/<pid>/stat looks like "pid (comm) state ppid ..." - comm may itself
+    // contain spaces or parens, so the fields are counted from the last ')'
+    bool parseStat(std::string_view stat, StatFields &fields)
+    {
+        const auto commStart = stat.find('(');
+        const auto commEnd = stat.rfind(')');
+        if(commStart == std::string_view::npos || commEnd == std::string_view::npos || commEnd < commStart)
+            return false;
+        fields.comm = stat.substr(commStart + 1, commEnd - commStart - 1);
+
+        // Fields are numbered from 1 as in proc(5), state being 3
+        const char *pPos = stat.data() + commEnd + 1;
+        const char *pEnd = stat.data() + stat.size();
+        for(int field = 3; field <= 24; ++field)
+        {
+            while(pPos < pEnd && *pPos == ' ')
+                ++pPos;
+            const char *pFieldEnd = pPos;
+            while(pFieldEnd < pEnd && *pFieldEnd != ' ' && *pFieldEnd != '\n')
+                ++pFieldEnd;
+            if(pPos == pFieldEnd)
+                return false;
+
+            std::uint64_t *pValue{};
+            switch(field)
+            {
+            case 14: pValue = &fields.utime; break;
+            case 15: pValue = &fields.stime; break;
+            case 20: pValue = &fields.threads; break;
+            case 22: pValue = &fields.startTime; break;
+            case 24: pValue = &fields.rssPages; break;
+            default: break;
+            }
+            if(pValue && std::from_chars(pPos, pFieldEnd, *pValue).ptr != pFieldEnd)
+                return false;
+
+            pPos = pFieldEnd;
+        }
+
+        return true;
+    }
+}
+
+ProcessResources::ProcessResources()
+: _procDirectory{::open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC)}
+, _ticksPerSecond{static_cast<std::uint64_t>(::sysconf(_SC_CLK_TCK))}
+, _pageSizeKb{static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE)) / 1024}
+, _directoryBuffer(directoryBufferSize)
+{
+    if(!_procDirectory)
+        throw SystemError("Could not open /proc");
+
+    // Two files are kept open per process, so make room for as many as we can
+    rlimit limit{};
+    if(::getrlimit(RLIMIT_NOFILE, &limit) == 0)
+    {
+        if(limit.rlim_cur < limit.rlim_max)
+        {
+            limit.rlim_cur = limit.rlim_max;
+            ::setrlimit(RLIMIT_NOFILE, &limit);
+            ::getrlimit(RLIMIT_NOFILE, &limit);
+        }
+        if(limit.rlim_cur > reservedFds)
+            _maxKeptFiles = (limit.rlim_cur - reservedFds) / 2;
+    }
+
+    // We have fds open ourselves, so a size of 0 means it isn't the count
+    struct stat info{};
+    _fdCountInSize = ::fstatat(_procDirectory.get(), "self/fd", &info, 0) == 0 && info.st_size > 0;
+}
+
+std::optional<ProcessResources::Sample> ProcessResources::sample(pid_t pid)
+{
+    auto it = _files.find(pid);
+    Files unkept;
+    if(it == _files.end())
+    {
+        auto files = open(pid);
+        if(!files.stat)
+            return {};
+
+        if(_files.size() < _maxKeptFiles)
+            it = _files.emplace(pid, std::move(files)).first;
+        else
+            unkept = std::move(files);
+    }
+    auto &files = it != _files.end() ? it->second : unkept;
+
+    // Reads fail once the process has gone, even if its pid has been reused
+    StatFields fields;
+    const auto length = ::pread(files.stat.get(), _statBuffer.data(), _statBuffer.size(), 0);
+    if(length <= 0 || !parseStat({_statBuffer.data(), static_cast<std::size_t>(length)}, fields))
+    {
+        if(it != _files.end())
+            _files.erase(it);
+        return {};
+    }
+
+    Sample sample;
+    sample.name = fields.comm;
+    sample.cpuTimeUs = (fields.utime + fields.stime) * 1000000 / _ticksPerSecond;
+    sample.rssKb = fields.rssPages * _pageSizeKb;
+    sample.threads = static_cast<std::uint32_t>(fields.threads);
+    sample.startTime = fields.startTime;
+    if(files.fdDirectory)
+        sample.fds = countFds(files.fdDirectory.get());
+
+    return sample;
+}
+
+void ProcessResources::forget(pid_t pid)
+{
+    _files.erase(pid);
+}
+
+ProcessResources::Files ProcessResources::open(pid_t pid) const
+{
+    char path[32]{};
+    ::snprintf(path, sizeof(path), "%d/stat", pid);
+
+    Files files;
+    files.stat = ::openat(_procDirectory.get(), path, O_RDONLY | O_CLOEXEC);
+
+    // Only the process's owner (or root) can see its fds
+    ::snprintf(path, sizeof(path), "%d/fd", pid);
+    files.fdDirectory = ::openat(_procDirectory.get(), path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    return files;
+}
+
+std::optional<std::uint32_t> ProcessResources::countFds(int fdDirectory)
+{
+    if(_fdCountInSize)
+    {
+        struct stat info{};
+        if(::fstat(fdDirectory, &info))
+            return {};
+        return static_cast<std::uint32_t>(info.st_size);
+    }
+
+    if(::lseek(fdDirectory, 0, SEEK_SET) < 0)
+        return {};
+
+    std::uint32_t count{};
+    while(true)
+    {
+        const auto length = ::getdents64(fdDirectory, _directoryBuffer.data(), _directoryBuffer.size());
+        if(length < 0)
+            return {};
+        if(length == 0)
+            return count;
+
+        for(std::size_t offset = 0; offset < static_cast<std::size_t>(length);)
+        {
+            const auto *pEntry = reinterpret_cast<const dirent64*>(_directoryBuffer.data() + offset);
+            if(pEntry->d_name[0] != '.')
+                ++count;
+            offset += pEntry->d_reclen;
+        }
+    }
+}
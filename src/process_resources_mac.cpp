@@ -0,0 +1,51 @@
+#include "process_resources.h"
+#include <libproc.h>
+#include <mach/mach_time.h>
+#include <cstring>
+
+ProcessResources::ProcessResources()
+{
+    // Task times are in Mach absolute time units, which are only nanoseconds on Intel
+    mach_timebase_info_data_t timebase{};
+    if(::mach_timebase_info(&timebase) == KERN_SUCCESS && timebase.denom)
+    {
+        _timebaseNumer = timebase.numer;
+        _timebaseDenom = timebase.denom;
+    }
+}
+
+std::optional<ProcessResources::Sample> ProcessResources::sample(pid_t pid)
+{
+    proc_taskallinfo info{};
+    if(proc_pidinfo(pid, PROC_PIDTASKALLINFO, 0, &info, sizeof(info)) != sizeof(info))
+        return {};
+
+    Sample sample;
+    ::strlcpy(_name.data(), info.pbsd.pbi_name[0] ? info.pbsd.pbi_name : info.pbsd.pbi_comm, _name.size());
+    sample.name = _name.data();
+    const auto cpuTime = info.ptinfo.pti_total_user + info.ptinfo.pti_total_system;
+    sample.cpuTimeUs = cpuTime * _timebaseNumer / _timebaseDenom / 1000;
+    sample.rssKb = info.ptinfo.pti_resident_size / 1024;
+    sample.threads = static_cast<std::uint32_t>(info.ptinfo.pti_threadnum);
+    sample.startTime = info.pbsd.pbi_start_tvsec * 1000000 + info.pbsd.pbi_start_tvusec;
+
+    // The fd table's size bounds the list, so the buffer only grows when a table does
+    const std::size_t neededSize = info.pbsd.pbi_nfiles * sizeof(proc_fdinfo);
+    if(!neededSize)
+    {
+        sample.fds = 0;
+        return sample;
+    }
+    if(_fdBuffer.size() < neededSize)
+        _fdBuffer.resize(neededSize);
+
+    const auto size = proc_pidinfo(pid, PROC_PIDLISTFDS, 0, _fdBuffer.data(), static_cast<int>(_fdBuffer.size()));
+    if(size >= 0)
+        sample.fds = static_cast<std::uint32_t>(static_cast<std::size_t>(size) / sizeof(proc_fdinfo));
+
+    return sample;
+}
+
+void ProcessResources::forget(pid_t)
+{
+}
@@ -0,0 +1,156 @@
+#include "process_selection.h"
+#include "port_finder.h"
+#include "process_cgroups.h"
+#include "process_cache.h"
+
+ProcessSelection::ProcessSelection(const Config::SelectedProcesses &selectedProcesses,
+    std::chrono::milliseconds reconcileInterval)
+: _selectedProcesses{selectedProcesses}
+, _reconcileInterval{reconcileInterval}
+, _pids{scan()}
+{
+    // Explicit pids never change, so we only need to reconcile
+    // if processes were selected by name or cgroup
+    if(!_selectedProcesses.names().empty() || !_selectedProcesses.cgroups().empty())
+        _reconcileThread = std::thread{[this] { reconcileLoop(); }};
+}
+
+ProcessSelection::~ProcessSelection()
+{
+    {
+        std::lock_guard lock{_stopMutex};
+        _stop = true;
+    }
+    _stopCondition.notify_all();
+
+    if(_reconcileThread.joinable())
+        _reconcileThread.join();
+}
+
+std::shared_ptr<const PidSet> ProcessSelection::snapshot() const
+{
+    std::lock_guard lock{_snapshotMutex};
+    return _pids;
+}
+
+void ProcessSelection::publish(std::shared_ptr<const PidSet> pids)
+{
+    std::lock_guard lock{_snapshotMutex};
+    _pids = std::move(pids);
+}
+
+bool ProcessSelection::matchesName(std::string_view path) const
+{
+    return PortFinder::matchesPath(_selectedProcesses.names(), path);
+}
+
+bool ProcessSelection::matchesCgroup(pid_t pid) const
+{
+    const auto &cgroups = _selectedProcesses.cgroups();
+    if(cgroups.empty())
+        return false;
+
+    const auto path = ProcessCgroups::shared().lookup(pid).path;
+    return !path.empty() && std::any_of(cgroups.begin(), cgroups.end(), [&](const std::string &cgroup)
+    {
+        return path.find(cgroup) != std::string::npos;
+    });
+}
+
+bool ProcessSelection::containsAncestorOf(pid_t pid) const
+{
+    const auto pids = snapshot();
+    return ProcessCache::shared().descendsFrom(pid, *pids);
+}
+
+void ProcessSelection::processStarted(pid_t pid, std::string_view path)
+{
+    const Event event{pid, matches(pid, path)};
+
+    std::lock_guard lock{_updateMutex};
+    update(event);
+}
+
+void ProcessSelection::processExited(pid_t pid)
+{
+    std::lock_guard lock{_updateMutex};
+    update({pid, false});
+}
+
+bool ProcessSelection::changes(const Event &event, const PidSet &pids) const
+{
+    if(!event.selected && _selectedProcesses.pids().contains(event.pid))
+        return false;
+
+    return event.selected != pids.contains(event.pid);
+}
+
+void ProcessSelection::apply(const Event &event, PidSet &pids)
+{
+    if(event.selected)
+        pids.insert(event.pid);
+    else
+        pids.erase(event.pid);
+}
+
+void ProcessSelection::update(const Event &event)
+{
+    // The rescan in progress may have looked at the process before the event
+    if(_scanEvents)
+        _scanEvents->push_back(event);
+
+    auto pids = snapshot();
+    // Nothing to do if the pid's membership hasn't changed
+    if(!changes(event, *pids))
+        return;
+
+    auto newPids = std::make_shared<PidSet>(*pids);
+    apply(event, *newPids);
+    publish(std::move(newPids));
+}
+
+std::shared_ptr<PidSet> ProcessSelection::scan() const
+{
+    auto pids = std::make_shared<PidSet>(_selectedProcesses.pids());
+    if(!_selectedProcesses.names().empty())
+        pids->merge(PortFinder::pids(_selectedProcesses.names()));
+
+    if(!_selectedProcesses.cgroups().empty())
+    {
+        for(const auto pid : PortFinder::allPids())
+        {
+            if(matchesCgroup(pid))
+                pids->insert(pid);
+        }
+    }
+
+    return pids;
+}
+
+void ProcessSelection::reconcileLoop()
+{
+    std::unique_lock lock{_stopMutex};
+    while(!_stopCondition.wait_for(lock, _reconcileInterval, [this] { return _stop; }))
+    {
+        lock.unlock();
+        {
+            std::unique_lock updateLock{_updateMutex};
+            _scanEvents.emplace();
+            updateLock.unlock();
+
+            // Scan outside of _updateMutex so events aren't blocked for the duration
+            auto pids = scan();
+
+            updateLock.lock();
+            // Events during the scan are at least as new as what it saw
+            for(const auto &event : *_scanEvents)
+            {
+                if(changes(event, *pids))
+                    apply(event, *pids);
+            }
+            _scanEvents.reset();
+            publish(std::move(pids));
+        }
+        lock.lock();
+    }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "common.h"
+#include "config.h"
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+
+// The set of pids matching a -p/-P selection (explicit pids plus processes whose
+// path matches one of the names, or whose cgroup matches --cgroup). The set is
+// computed once up front and then kept current from process start/exit events,
+// with a periodic rescan to reconcile anything the events missed.
+//
+// Readers take a snapshot, which is an immutable set that is never modified after
+// being published - updates publish a new copy instead (copy-on-write), so a
+// per-event membership check costs a shared_ptr copy rather than a process scan.
+//
+// Events that arrive while a rescan is running are recorded and replayed on top
+// of its result, so the rescan never undoes them.
+class ProcessSelection
+{
+public:
+    ProcessSelection(const Config::SelectedProcesses &selectedProcesses,
+        std::chrono::milliseconds reconcileInterval = std::chrono::milliseconds{2000});
+    ~ProcessSelection();
+
+    ProcessSelection(const ProcessSelection&) = delete;
+    ProcessSelection& operator=(const ProcessSelection&) = delete;
+
+public:
+    std::shared_ptr<const PidSet> snapshot() const;
+    bool contains(pid_t pid) const {return snapshot()->contains(pid);}
+    // Is the process anywhere below one of the selected processes? (according
+    // to the ProcessCache's process tree)
+    bool containsAncestorOf(pid_t pid) const;
+    // Does the path match one of the selected names? (PortFinder::matchesPath)
+    bool matchesName(std::string_view path) const;
+    // Is the process in one of the selected cgroups?
+    bool matchesCgroup(pid_t pid) const;
+    // Does the process match the selection by name or cgroup - it may not be
+    // in the snapshot yet if it only just started
+    bool matches(pid_t pid, std::string_view path) const {return matchesName(path) || matchesCgroup(pid);}
+
+    // Process lifecycle events - add newly started processes that match the
+    // selection and drop exited ones
+    void processStarted(pid_t pid, std::string_view path);
+    void processExited(pid_t pid);
+
+private:
+    // A start or exit event: whether the pid should now be selected
+    struct Event
+    {
+        pid_t pid{};
+        bool selected{};
+    };
+
+private:
+    // Rescan all processes for ones matching the selection
+    std::shared_ptr<PidSet> scan() const;
+    void publish(std::shared_ptr<const PidSet> pids);
+    // Does the event change pids' membership? Explicitly selected pids stay
+    // selected (if they exec something else or exit and the pid gets reused,
+    // the user asked for it).
+    bool changes(const Event &event, const PidSet &pids) const;
+    static void apply(const Event &event, PidSet &pids);
+    // Apply the event to the snapshot, _updateMutex must be held
+    void update(const Event &event);
+    void reconcileLoop();
+
+private:
+    const Config::SelectedProcesses &_selectedProcesses;
+    const std::chrono::milliseconds _reconcileInterval;
+
+    // Only guards the pointer itself, the set it points to is immutable
+    mutable std::mutex _snapshotMutex;
+    std::shared_ptr<const PidSet> _pids;
+    // Serializes writers (event handlers and the reconcile thread)
+    std::mutex _updateMutex;
+    // Events since the running rescan started, if there is one (guarded by _updateMutex)
+    std::optional<std::vector<Event>> _scanEvents;
+
+    std::mutex _stopMutex;
+    std::condition_variable _stopCondition;
+    bool _stop{false};
+    std::thread _reconcileThread;
+};
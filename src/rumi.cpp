@@ -2,6 +2,8 @@
 #include "engine.h"
 #if defined(RUMI_MACOS)
 #include "mac_engine.h"
+#elif defined(RUMI_LINUX)
+#include "linux_engine.h"
 #endif
 
 int main(int argc, char** argv)
@@ -10,6 +12,8 @@ int main(int argc, char** argv)
 
 #if defined(RUMI_MACOS)
     engine = std::make_unique<MacEngine>();
+#elif defined(RUMI_LINUX)
+    engine = std::make_unique<LinuxEngine>();
 #endif
 
     try
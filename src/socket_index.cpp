@@ -0,0 +1,244 @@
+#include "socket_index.h"
+#include "port_finder.h"
+#include "thread_pool.h"
+
+namespace
+{
+    // Every Nth background refresh re-queries all sockets, in case a socket fd
+    // number was closed and reused between two refreshes (or a pid was reused)
+    const unsigned fullRefreshEvery{30};
+    // Don't refresh for deferred packets if the index is fresher than this
+    const auto minTargetedRefreshAge{std::chrono::milliseconds{100}};
+
+    // The IPv4 address embedded in a v4-mapped IPv6 address (::ffff:a.b.c.d)
+    std::optional<IPAddressBytes> mappedIpv4(const IPAddressBytes &address)
+    {
+        constexpr std::uint8_t prefix[12]{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+        if(!std::equal(std::begin(prefix), std::end(prefix), address.begin()))
+            return {};
+
+        IPAddressBytes ipv4{};
+        std::copy(address.begin() + 12, address.end(), ipv4.begin());
+        return ipv4;
+    }
+}
+
+std::string SocketIndex::Stats::toString() const
+{
+    return fmt::format("socket index: {} sockets, {} hits, {} misses, {} refreshes ({} for deferred packets)",
+        sockets, hits, misses, refreshes, targetedRefreshes);
+}
+
+SocketIndex::SocketIndex(std::chrono::milliseconds refreshInterval)
+: _refreshInterval{refreshInterval}
+{
+    // Populate the index up front so the first lookups don't all miss
+    refresh(true);
+    _refreshThread = std::thread{[this] { refreshLoop(); }};
+}
+
+SocketIndex::~SocketIndex()
+{
+    {
+        std::lock_guard lock{_stopMutex};
+        _stop = true;
+    }
+    _stopCondition.notify_all();
+    _refreshThread.join();
+}
+
+std::size_t SocketIndex::KeyHash::operator()(const Key &key) const
+{
+    std::uint64_t high{}, low{};
+    std::memcpy(&high, key.address.data(), sizeof(high));
+    std::memcpy(&low, key.address.data() + sizeof(high), sizeof(low));
+
+    return std::hash<std::uint64_t>{}(high ^ (low * 0x9e3779b97f4a7c15ULL) ^ key.portKey ^
+        (static_cast<std::uint64_t>(key.netns) << 32));
+}
+
+SocketIndex::Key SocketIndex::makeKey(std::uint32_t netns, std::uint16_t port, std::uint8_t protocol, IPVersion ipVersion,
+    const IPAddressBytes &address)
+{
+    return {(static_cast<std::uint32_t>(ipVersion) << 24) | (static_cast<std::uint32_t>(protocol) << 16) | port, netns, address};
+}
+
+std::optional<pid_t> SocketIndex::find(const Key &key) const
+{
+    std::shared_lock lock{_indexMutex};
+    auto it = _portTable.find(key);
+    if(it != _portTable.end())
+        return it->second;
+
+    // Sockets bound to the "any" address own the port on every local address
+    it = _portTable.find({key.portKey, key.netns, {}});
+    if(it != _portTable.end())
+        return it->second;
+
+    return {};
+}
+
+std::optional<pid_t> SocketIndex::find(const Endpoint &endpoint) const
+{
+    return find(makeKey(endpoint.netns, endpoint.port, endpoint.protocol, endpoint.ipVersion, endpoint.address));
+}
+
+void SocketIndex::refreshNow()
+{
+    std::lock_guard lock{_refreshMutex};
+    if(Clock::now() - _lastRefresh >= minTargetedRefreshAge)
+    {
+        ++_targetedRefreshes;
+        rebuild(false);
+    }
+}
+
+pid_t SocketIndex::endpointToPid(const Endpoint &endpoint)
+{
+    // A miss isn't refreshed here, on the capture thread - the caller defers the
+    // packet and the attribution queue's thread refreshes and retries it
+    if(auto pid = find(endpoint))
+    {
+        ++_hits;
+        return *pid;
+    }
+
+    ++_misses;
+    return 0;
+}
+
+SocketIndex::Stats SocketIndex::stats() const
+{
+    Stats stats;
+    stats.hits = _hits;
+    stats.misses = _misses;
+    stats.refreshes = _refreshes;
+    stats.targetedRefreshes = _targetedRefreshes;
+
+    std::shared_lock lock{_indexMutex};
+    stats.sockets = _portTable.size();
+
+    return stats;
+}
+
+void SocketIndex::refresh(bool full)
+{
+    std::lock_guard lock{_refreshMutex};
+    rebuild(full);
+}
+
+void SocketIndex::rebuild([[maybe_unused]] bool full)
+{
+    std::unordered_map<pid_t, FdTable> fdTables;
+    PortTable portTable;
+
+    auto addKey = [&](const Key &key, pid_t pid)
+    {
+        // The first process found owning an endpoint wins
+        portTable.try_emplace(key, pid);
+    };
+
+    auto addEntry = [&](const SocketEntry &entry, pid_t pid)
+    {
+        if(entry.protocol == 0 || entry.localPort == 0)
+            return;
+
+        if(entry.isIpv4)
+            addKey(makeKey(entry.netns, entry.localPort, entry.protocol, IPv4, entry.localAddress), pid);
+        else if(entry.isIpv6)
+        {
+            addKey(makeKey(entry.netns, entry.localPort, entry.protocol, IPv6, entry.localAddress), pid);
+            // IPv6 sockets bound to the "any" address also receive IPv4 traffic
+            if(entry.isIpv6AnyAddress)
+                addKey(makeKey(entry.netns, entry.localPort, entry.protocol, IPv4, {}), pid);
+            // and those talking to an IPv4 peer have a v4-mapped (::ffff:a.b.c.d) address
+            else if(const auto ipv4 = mappedIpv4(entry.localAddress))
+                addKey(makeKey(entry.netns, entry.localPort, entry.protocol, IPv4, *ipv4), pid);
+        }
+    };
+
+#if defined(RUMI_MACOS)
+    // Processes are scanned in parallel, each into its own slot
+    const auto allPids = PortFinder::allPids();
+    std::vector<FdTable> newFdTables(allPids.size());
+
+    ThreadPool::shared().parallelFor(allPids.size(), [&](std::size_t index, unsigned)
+    {
+        const pid_t pid = allPids[index];
+        const FdTable *pPreviousTable{nullptr};
+        if(!full)
+        {
+            auto it = _fdTables.find(pid);
+            if(it != _fdTables.end())
+                pPreviousTable = &it->second;
+        }
+
+        FdTable &fdTable = newFdTables[index];
+        for(const auto &fd : PortFinder::socketFds(pid))
+        {
+            // Only query sockets we haven't seen before
+            if(pPreviousTable)
+            {
+                auto it = pPreviousTable->find(fd);
+                if(it != pPreviousTable->end())
+                {
+                    fdTable.emplace(fd, it->second);
+                    continue;
+                }
+            }
+
+            // Sockets other than TCP/UDP are remembered too (with a zero protocol)
+            // so that we don't query them again on the next refresh
+            SocketEntry entry{};
+            if(const auto connection = PortFinder::connectionForFd(pid, fd))
+            {
+                entry.protocol = static_cast<std::uint8_t>(connection->protocol());
+                entry.localPort = connection->localPort();
+                entry.localAddress = connection->localAddressBytes();
+                entry.isIpv4 = connection->isIpv4();
+                entry.isIpv6 = connection->isIpv6();
+                entry.isIpv6AnyAddress = connection->isIpv6AnyAddress();
+            }
+            fdTable.emplace(fd, entry);
+        }
+    });
+
+    for(std::size_t index = 0; index < allPids.size(); ++index)
+    {
+        for(const auto &[fd, entry] : newFdTables[index])
+            addEntry(entry, allPids[index]);
+
+        if(!newFdTables[index].empty())
+            fdTables.emplace(allPids[index], std::move(newFdTables[index]));
+    }
+#elif defined(RUMI_LINUX)
+    // The Linux PortFinder dumps all sockets in bulk and maintains its own
+    // incremental inode -> pid index, so there's no per-fd state to keep here
+    for(const auto &connection : PortFinder::allConnections())
+    {
+        if(connection.pid() == 0)
+            continue;
+
+        addEntry({static_cast<std::uint8_t>(connection.protocol()), connection.localPort(), connection.localAddressBytes(),
+            connection.isIpv4(), connection.isIpv6(), connection.isIpv6AnyAddress(), connection.netns()}, connection.pid());
+    }
+#endif
+
+    _fdTables = std::move(fdTables);
+    _lastRefresh = Clock::now();
+    ++_refreshes;
+
+    std::unique_lock lock{_indexMutex};
+    _portTable.swap(portTable);
+}
+
+void SocketIndex::refreshLoop()
+{
+    std::unique_lock lock{_stopMutex};
+    while(!_stopCondition.wait_for(lock, _refreshInterval, [this] { return _stop; }))
+    {
+        lock.unlock();
+        refresh(++_refreshCount % fullRefreshEvery == 0);
+        lock.lock();
+    }
+}
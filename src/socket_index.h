@@ -0,0 +1,111 @@
+#pragma once
+
+#include "common.h"
+#include "socket_owners.h"
+#include <unordered_map>
+#include <shared_mutex>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+
+// Persistent (ipVersion, protocol, local address, local port) -> pid index of all TCP/UDP sockets.
+// The index is refreshed incrementally by a background thread: each refresh lists the
+// socket fds of every process but only queries the socket info of fds it hasn't seen before.
+// A lookup never refreshes - packets that miss are deferred, and refreshNow() is called
+// (rate limited) from the thread that retries them.
+class SocketIndex : public SocketOwners
+{
+public:
+    struct Stats
+    {
+        std::uint64_t hits{};
+        std::uint64_t misses{};
+        std::uint64_t refreshes{};
+        std::uint64_t targetedRefreshes{};
+        std::uint64_t sockets{};
+
+        std::string toString() const;
+    };
+
+public:
+    SocketIndex(std::chrono::milliseconds refreshInterval = std::chrono::milliseconds{1000});
+    ~SocketIndex();
+
+    SocketIndex(const SocketIndex&) = delete;
+    SocketIndex& operator=(const SocketIndex&) = delete;
+
+public:
+    virtual pid_t endpointToPid(const Endpoint &endpoint) override;
+    virtual std::optional<pid_t> find(const Endpoint &endpoint) const override;
+    // Refresh the index now, unless it was refreshed very recently
+    virtual void refreshNow() override;
+    virtual std::string statsString() const override {return stats().toString();}
+    Stats stats() const;
+
+private:
+    // A socket as seen by the index - just the parts we need to build the keys
+    struct SocketEntry
+    {
+        std::uint8_t protocol{};
+        std::uint16_t localPort{};
+        IPAddressBytes localAddress{};
+        bool isIpv4{};
+        bool isIpv6{};
+        bool isIpv6AnyAddress{};
+        std::uint32_t netns{};
+    };
+
+    // Socket fd -> socket entry, for a single process
+    using FdTable = std::unordered_map<int, SocketEntry>;
+    struct Key
+    {
+        std::uint32_t portKey{};
+        std::uint32_t netns{};
+        IPAddressBytes address{};
+
+        bool operator==(const Key&) const = default;
+    };
+
+    struct KeyHash
+    {
+        std::size_t operator()(const Key &key) const;
+    };
+
+    using PortTable = std::unordered_map<Key, pid_t, KeyHash>;
+
+private:
+    static Key makeKey(std::uint32_t netns, std::uint16_t port, std::uint8_t protocol, IPVersion ipVersion,
+        const IPAddressBytes &address);
+
+    // Exact match on the key's address, falling back to the wildcard address
+    std::optional<pid_t> find(const Key &key) const;
+    // Refresh the index; a full refresh re-queries every socket fd rather than just the new ones
+    void refresh(bool full);
+    // As above, but _refreshMutex must already be held
+    void rebuild(bool full);
+    void refreshLoop();
+
+private:
+    const std::chrono::milliseconds _refreshInterval;
+
+    // The published index, read by find()
+    mutable std::shared_mutex _indexMutex;
+    PortTable _portTable;
+
+    // Refresh state, only touched while holding _refreshMutex
+    std::mutex _refreshMutex;
+    std::unordered_map<pid_t, FdTable> _fdTables;
+    Clock::time_point _lastRefresh;
+    unsigned _refreshCount{};
+
+    std::atomic<std::uint64_t> _hits{};
+    std::atomic<std::uint64_t> _misses{};
+    std::atomic<std::uint64_t> _refreshes{};
+    std::atomic<std::uint64_t> _targetedRefreshes{};
+
+    std::mutex _stopMutex;
+    std::condition_variable _stopCondition;
+    bool _stop{false};
+    std::thread _refreshThread;
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "common.h"
+#include "ip_address.h"
+#include <chrono>
+
+// Maps the local end of a TCP/UDP socket to the process that owns it - used by
+// showTraffic() to attribute packets. SocketIndex does this by scanning socket
+// tables, and on Linux EbpfSocketOwners has the kernel record owners as sockets
+// are created.
+class SocketOwners
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // The local end of a socket. A zero address is the wildcard (a socket bound to
+    // the "any" address), which matches any local address without an exact match.
+    struct Endpoint
+    {
+        IPVersion ipVersion{};
+        std::uint8_t protocol{};
+        std::uint16_t port{};
+        IPAddressBytes address{};
+        // The network namespace the address belongs to (Linux only, 0 elsewhere) -
+        // the same endpoint can exist in several containers
+        std::uint32_t netns{};
+    };
+
+    // What was recorded of a socket's owner, for once the process has exited
+    struct OwnerDetails
+    {
+        std::string comm;
+        // Relative to the cgroup v2 root, empty if unknown
+        std::string cgroupPath;
+    };
+
+public:
+    virtual ~SocketOwners() = default;
+
+public:
+    // Returns 0 if no process is known to own the endpoint (yet). Called for every
+    // packet on the capture thread, so it mustn't block on a refresh.
+    virtual pid_t endpointToPid(const Endpoint &endpoint) = 0;
+    // Look the endpoint up as things stand, without counting it as a hit or miss
+    virtual std::optional<pid_t> find(const Endpoint &endpoint) const = 0;
+    // Nothing if the implementation doesn't record owners (or has no record of this one)
+    virtual std::optional<OwnerDetails> ownerDetails(const Endpoint &) const {return {};}
+    // Bring the owners up to date now, if that means anything for this implementation
+    virtual void refreshNow() {}
+    virtual std::string statsString() const = 0;
+};
@@ -0,0 +1,119 @@
+#include "socket_traffic.h"
+#include <linux/sock_diag.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <thread>
+#include <unordered_set>
+
+namespace
+{
+    const std::uint32_t destroyGroups{(1U << (SKNLGRP_INET_TCP_DESTROY - 1)) |
+        (1U << (SKNLGRP_INET6_TCP_DESTROY - 1))};
+}
+
+SocketTraffic::Counters &SocketTraffic::Counters::operator+=(const Counters &other)
+{
+    sent += other.sent;
+    received += other.received;
+    return *this;
+}
+
+SocketTraffic::SocketTraffic()
+{
+    try
+    {
+        // Subscribe before the baseline dump so no socket slips through
+        _destroyed.emplace(NETLINK_SOCK_DIAG, destroyGroups);
+    }
+    catch(const SystemError &)
+    {
+        // Not permitted, we'll have to do without
+    }
+
+    update(true);
+}
+
+void SocketTraffic::waitFor(std::chrono::milliseconds timeout)
+{
+    if(!_destroyed)
+    {
+        std::this_thread::sleep_for(timeout);
+        return;
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    for(auto now = std::chrono::steady_clock::now(); now < deadline; now = std::chrono::steady_clock::now())
+    {
+        const auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - now);
+        pollfd pollFd{_destroyed->fd(), POLLIN, 0};
+        if(::poll(&pollFd, 1, static_cast<int>(remaining.count())) > 0)
+            receiveDestroyed(false);
+    }
+}
+
+SocketTraffic::TotalsT SocketTraffic::sample()
+{
+    update(false);
+    return std::exchange(_totals, {});
+}
+
+void SocketTraffic::update(bool baseline)
+{
+    std::unordered_set<std::uint64_t> dumped;
+    for(const auto &connection : PortFinder::allConnections(true))
+    {
+        // No counters for UDP or TIME_WAIT sockets
+        if(!connection.tcpInfo())
+            continue;
+
+        // A socket closed by its process (e.g lingering in FIN_WAIT) no longer has
+        // an owner, it still belongs to the one we saw before
+        auto &state = _sockets[connection.cookie()];
+        if(connection.pid())
+            state.pid = connection.pid();
+
+        // Sockets new since the last dump count from zero
+        if(!baseline)
+            account(state.pid, state.info, *connection.tcpInfo());
+
+        state.info = *connection.tcpInfo();
+        dumped.insert(connection.cookie());
+    }
+
+    // Sockets missing from the dump were destroyed. Their notifications can still use
+    // the state they had in the previous dump, until we've read them.
+    if(_destroyed)
+        receiveDestroyed(baseline);
+
+    std::erase_if(_sockets, [&](const auto &entry) {return !dumped.contains(entry.first);});
+}
+
+void SocketTraffic::receiveDestroyed(bool baseline)
+{
+    _destroyed->receivePending([&](const nlmsghdr &msg)
+    {
+        auto connection = PortFinder::connectionFromMessage(msg, IPPROTO_TCP);
+        if(!connection || !connection->tcpInfo())
+            return;
+
+        auto it = _sockets.find(connection->cookie());
+        if(it == _sockets.end())
+        {
+            // Opened and closed since the last dump (or before the baseline)
+            if(!baseline)
+                account(0, {}, *connection->tcpInfo());
+            return;
+        }
+
+        if(!baseline)
+            account(it->second.pid, it->second.info, *connection->tcpInfo());
+        _sockets.erase(it);
+    });
+}
+
+void SocketTraffic::account(pid_t pid, const PortFinder::TcpInfo &previous, const PortFinder::TcpInfo &current)
+{
+    const Counters delta{current.bytesAcked - previous.bytesAcked, current.bytesReceived - previous.bytesReceived};
+    if(!delta.empty())
+        _totals[pid] += delta;
+}
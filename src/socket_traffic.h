@@ -0,0 +1,60 @@
+#pragma once
+
+#include "common.h"
+#include "port_finder.h"
+#include "netlink_socket.h"
+#include <unordered_map>
+
+// Per-process TCP traffic without capturing any packets: the kernel already counts
+// the bytes acked and received by every TCP socket (tcp_info), so we periodically
+// dump those counters via sock_diag and diff them against the previous dump.
+// Sockets closed in between are covered by the kernel's TCP destroy notifications,
+// which carry the socket's final counters.
+class SocketTraffic
+{
+public:
+    struct Counters
+    {
+        std::uint64_t sent{};
+        std::uint64_t received{};
+
+        Counters &operator+=(const Counters &other);
+        bool empty() const {return sent == 0 && received == 0;}
+    };
+
+    using TotalsT = std::unordered_map<pid_t, Counters>;
+
+public:
+    // Takes the baseline - only traffic from now on is counted
+    SocketTraffic();
+
+public:
+    // Wait for the timeout, accounting sockets as they are destroyed
+    void waitFor(std::chrono::milliseconds timeout);
+    // Bytes per process since the previous sample. Sockets that were opened and
+    // closed between dumps were never seen with an owner, so they count for pid 0.
+    TotalsT sample();
+    // Destroy notifications need CAP_NET_ADMIN; without them the traffic of a
+    // socket since the last dump is lost when it closes
+    bool tracksClosedSockets() const {return _destroyed.has_value();}
+
+private:
+    struct SocketState
+    {
+        pid_t pid{};
+        PortFinder::TcpInfo info;
+    };
+
+private:
+    // Dump every TCP socket; with baseline set, only record the counters
+    void update(bool baseline);
+    void receiveDestroyed(bool baseline);
+    void account(pid_t pid, const PortFinder::TcpInfo &previous, const PortFinder::TcpInfo &current);
+
+private:
+    std::optional<NetlinkSocket> _destroyed;
+    // Socket cookie -> the socket's owner and counters as of the last dump
+    std::unordered_map<std::uint64_t, SocketState> _sockets;
+    // Accumulated since the last sample
+    TotalsT _totals;
+};
@@ -0,0 +1,269 @@
+#include "task_stats.h"
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+#include <linux/taskstats.h>
+#include <linux/acct.h>
+#include <sys/socket.h>
+#include <sys/sysinfo.h>
+#include <poll.h>
+#include <cstring>
+#include <cstddef>
+
+namespace
+{
+    // Room for bursts of exits (e.g the end of a parallel build) while the callback is busy
+    const int receiveBufferSize{16 * 1024 * 1024};
+    // A message holds a thread's stats, and its process's aggregate when it's the last
+    const std::size_t messageSize{16 * 1024};
+    // How long a read waits before checking whether to stop
+    const int pollTimeoutMs{200};
+    // The first version to say which process a thread belongs to, and whether it was the last
+    const std::uint16_t threadGroupVersion{12};
+
+    void appendAttribute(std::vector<std::uint8_t> &message, std::uint16_t type, const void *pData, std::size_t size)
+    {
+        const nlattr attribute{static_cast<std::uint16_t>(NLA_HDRLEN + size), type};
+        const auto offset = message.size();
+        message.resize(offset + NLA_ALIGN(NLA_HDRLEN + size));
+        std::memcpy(message.data() + offset, &attribute, sizeof(attribute));
+        std::memcpy(message.data() + offset + NLA_HDRLEN, pData, size);
+    }
+
+    std::vector<std::uint8_t> makeRequest(std::uint16_t familyId, std::uint8_t command, std::uint8_t version)
+    {
+        std::vector<std::uint8_t> message(NLMSG_HDRLEN + GENL_HDRLEN);
+        auto *pHeader = reinterpret_cast<nlmsghdr*>(message.data());
+        pHeader->nlmsg_type = familyId;
+        pHeader->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+
+        auto *pGenericHeader = reinterpret_cast<genlmsghdr*>(message.data() + NLMSG_HDRLEN);
+        pGenericHeader->cmd = command;
+        pGenericHeader->version = version;
+        return message;
+    }
+
+    // Call func(type, payload) for each attribute in attributes
+    template <typename FuncT>
+    void forEachAttribute(std::span<const std::uint8_t> attributes, FuncT func)
+    {
+        while(attributes.size() >= NLA_HDRLEN)
+        {
+            nlattr attribute{};
+            std::memcpy(&attribute, attributes.data(), sizeof(attribute));
+            if(attribute.nla_len < NLA_HDRLEN || attribute.nla_len > attributes.size())
+                return;
+
+            func(attribute.nla_type & NLA_TYPE_MASK, attributes.subspan(NLA_HDRLEN, attribute.nla_len - NLA_HDRLEN));
+            attributes = attributes.subspan(std::min<std::size_t>(NLA_ALIGN(attribute.nla_len), attributes.size()));
+        }
+    }
+
+    // Send a request and wait for its ack, returning the attributes of the reply
+    // that came before it (if any) - ignoring any exits that turn up meanwhile
+    std::vector<std::uint8_t> transact(int fd, std::vector<std::uint8_t> message, std::uint16_t replyType,
+        const std::string &failure)
+    {
+        reinterpret_cast<nlmsghdr*>(message.data())->nlmsg_len = static_cast<std::uint32_t>(message.size());
+        if(::send(fd, message.data(), message.size(), 0) < 0)
+            throw SystemError(failure);
+
+        std::vector<std::uint8_t> reply;
+        std::vector<std::uint8_t> buffer(messageSize);
+        while(true)
+        {
+            const auto length = ::recv(fd, buffer.data(), buffer.size(), 0);
+            if(length < 0)
+            {
+                if(errno == EINTR || errno == ENOBUFS)
+                    continue;
+                throw SystemError(failure);
+            }
+
+            int remaining = static_cast<int>(length);
+            for(auto *pMsg = reinterpret_cast<const nlmsghdr*>(buffer.data()); NLMSG_OK(pMsg, remaining);
+                pMsg = NLMSG_NEXT(pMsg, remaining))
+            {
+                if(pMsg->nlmsg_type == NLMSG_ERROR)
+                {
+                    const auto *pError = static_cast<const nlmsgerr*>(NLMSG_DATA(pMsg));
+                    if(pError->error)
+                    {
+                        errno = -pError->error;
+                        throw SystemError(failure);
+                    }
+                    return reply;
+                }
+
+                if(pMsg->nlmsg_type == replyType && pMsg->nlmsg_len >= NLMSG_LENGTH(GENL_HDRLEN))
+                {
+                    const auto *pAttributes = static_cast<const std::uint8_t*>(NLMSG_DATA(pMsg)) + GENL_HDRLEN;
+                    reply.assign(pAttributes, pAttributes + pMsg->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN));
+                }
+            }
+        }
+    }
+
+    std::uint16_t resolveFamily(int fd)
+    {
+        auto message = makeRequest(GENL_ID_CTRL, CTRL_CMD_GETFAMILY, 1);
+        appendAttribute(message, CTRL_ATTR_FAMILY_NAME, TASKSTATS_GENL_NAME, sizeof(TASKSTATS_GENL_NAME));
+
+        std::uint16_t familyId{};
+        const auto reply = transact(fd, std::move(message), GENL_ID_CTRL, "Could not find the taskstats netlink family");
+        forEachAttribute(reply, [&](std::uint16_t type, std::span<const std::uint8_t> payload)
+        {
+            if(type == CTRL_ATTR_FAMILY_ID && payload.size() >= sizeof(familyId))
+                std::memcpy(&familyId, payload.data(), sizeof(familyId));
+        });
+
+        if(!familyId)
+            throw std::runtime_error{"The kernel has no taskstats netlink family"};
+        return familyId;
+    }
+
+    ProcessEvent::Usage usageOf(const taskstats &stats)
+    {
+        ProcessEvent::Usage usage;
+        usage.userTimeUs = stats.ac_utime;
+        usage.systemTimeUs = stats.ac_stime;
+        usage.maxRssKb = stats.hiwater_rss;
+        usage.readBytes = stats.read_bytes;
+        usage.writeBytes = stats.write_bytes;
+        usage.cpuDelayNs = stats.cpu_delay_total;
+        usage.blockIoDelayNs = stats.blkio_delay_total;
+        return usage;
+    }
+}
+
+std::string TaskStats::Stats::toString() const
+{
+    return fmt::format("taskstats: {} thread exits, {} process exits, {} overflows", threads, exits, overflows);
+}
+
+TaskStats::TaskStats()
+: _socket{::socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC)}
+{
+    if(!_socket)
+        throw SystemError("Could not open taskstats socket");
+
+    if(::setsockopt(_socket.get(), SOL_SOCKET, SO_RCVBUFFORCE, &receiveBufferSize, sizeof(receiveBufferSize)))
+        ::setsockopt(_socket.get(), SOL_SOCKET, SO_RCVBUF, &receiveBufferSize, sizeof(receiveBufferSize));
+
+    sockaddr_nl address{};
+    address.nl_family = AF_NETLINK;
+    if(::bind(_socket.get(), reinterpret_cast<sockaddr*>(&address), sizeof(address)))
+        throw SystemError("Could not bind taskstats socket");
+
+    _familyId = resolveFamily(_socket.get());
+
+    // Exits are only sent to the listeners for the CPU they happen on
+    const auto cpus = fmt::format("0-{}", std::max(::get_nprocs_conf(), 1) - 1);
+    auto message = makeRequest(_familyId, TASKSTATS_CMD_GET, TASKSTATS_GENL_VERSION);
+    appendAttribute(message, TASKSTATS_CMD_ATTR_REGISTER_CPUMASK, cpus.c_str(), cpus.size() + 1);
+    transact(_socket.get(), std::move(message), _familyId, "Could not listen for taskstats exits");
+}
+
+TaskStats::~TaskStats()
+{
+    _stop = true;
+    if(_receiveThread.joinable())
+        _receiveThread.join();
+}
+
+void TaskStats::start()
+{
+    _receiveThread = std::thread{[this] { receiveLoop(); }};
+}
+
+TaskStats::Stats TaskStats::stats() const
+{
+    return {_threads, _exits, _overflows};
+}
+
+void TaskStats::receiveLoop()
+{
+    std::vector<std::uint8_t> buffer(messageSize);
+    pollfd pollFd{_socket.get(), POLLIN, 0};
+
+    while(!_stop)
+    {
+        if(::poll(&pollFd, 1, pollTimeoutMs) <= 0)
+            continue;
+
+        const auto length = ::recv(_socket.get(), buffer.data(), buffer.size(), MSG_DONTWAIT);
+        if(length < 0)
+        {
+            // Exits were dropped, so some processes will never see their last thread
+            if(errno == ENOBUFS)
+            {
+                ++_overflows;
+                _processes.clear();
+            }
+            continue;
+        }
+
+        int remaining = static_cast<int>(length);
+        for(auto *pMsg = reinterpret_cast<const nlmsghdr*>(buffer.data()); NLMSG_OK(pMsg, remaining);
+            pMsg = NLMSG_NEXT(pMsg, remaining))
+        {
+            if(pMsg->nlmsg_type != _familyId || pMsg->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN))
+                continue;
+
+            // Each task's stats are nested in an AGGR_PID attribute - the AGGR_TGID
+            // one that can follow only has its process's delays, so is ignored
+            const std::span<const std::uint8_t> attributes{static_cast<const std::uint8_t*>(NLMSG_DATA(pMsg)) + GENL_HDRLEN,
+                pMsg->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN)};
+            forEachAttribute(attributes, [&](std::uint16_t type, std::span<const std::uint8_t> aggregate)
+            {
+                if(type != TASKSTATS_TYPE_AGGR_PID)
+                    return;
+
+                forEachAttribute(aggregate, [&](std::uint16_t nestedType, std::span<const std::uint8_t> payload)
+                {
+                    if(nestedType != TASKSTATS_TYPE_STATS || payload.size() < offsetof(taskstats, ac_comm))
+                        return;
+
+                    // Older kernels send a smaller struct
+                    taskstats stats{};
+                    std::memcpy(&stats, payload.data(), std::min(payload.size(), sizeof(stats)));
+                    processTask(stats);
+                });
+            });
+        }
+    }
+}
+
+void TaskStats::processTask(const taskstats &stats)
+{
+    ++_threads;
+
+    const bool knowsProcess = stats.version >= threadGroupVersion && stats.ac_tgid;
+    const auto pid = static_cast<pid_t>(knowsProcess ? stats.ac_tgid : stats.ac_pid);
+
+    auto &event = _processes[pid];
+    if(!event.usage)
+        event.usage.emplace();
+    *event.usage += usageOf(stats);
+
+    // The main thread speaks for the process
+    if(static_cast<pid_t>(stats.ac_pid) == pid || event.path.empty())
+    {
+        event.ppid = static_cast<pid_t>(stats.ac_ppid);
+        event.uid = stats.ac_uid;
+        event.exitStatus = stats.ac_exitcode;
+        // Only the comm, see the header
+        event.path = std::string{stats.ac_comm, ::strnlen(stats.ac_comm, sizeof(stats.ac_comm))};
+    }
+
+    if(knowsProcess && !(stats.ac_flag & AGROUP))
+        return;
+
+    auto node = _processes.extract(pid);
+    auto &exited = node.mapped();
+    exited.mode = ProcessEvent::Exiting;
+    exited.type = TASKSTATS_CMD_NEW;
+    exited.pid = pid;
+
+    ++_exits;
+    _procExitedFunc(exited);
+}
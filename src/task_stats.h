@@ -0,0 +1,79 @@
+#pragma once
+
+#include "util.h"
+#include "fd.h"
+#include "process_event.h"
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+
+struct taskstats;
+
+// Process exits with their resource usage - CPU time, peak RSS, storage I/O and
+// delays - from the kernel's taskstats netlink family. Needs CAP_NET_ADMIN.
+//
+// The kernel sends the stats of every exiting task (thread) to the listeners it
+// has for the CPU it exited on, so we listen on all of them. A thread's stats are
+// added to its process's until the last thread of the process exits (taskstats
+// version 12 and later, kernel 5.19), at which point the exit is passed on - so
+// nothing is read from /proc, however short-lived the process. Older kernels
+// don't say which process a thread belongs to, so there each thread's exit is
+// passed on as it happens.
+//
+// The kernel only names a task by its comm (its name, truncated to 15 characters),
+// so that's all an exit's path is - callers that know the process's actual path
+// should use that instead.
+//
+// Events are read, and the callback called, on a thread of its own.
+class TaskStats
+{
+public:
+    using ProcessEvent = ::ProcessEvent;
+
+    struct Stats
+    {
+        std::uint64_t threads{};
+        std::uint64_t exits{};
+        // Times the socket buffer overflowed, losing an unknown number of exits
+        std::uint64_t overflows{};
+
+        std::string toString() const;
+    };
+
+private:
+    using ProcCallbackT = std::function<void(const ProcessEvent&)>;
+
+public:
+    TaskStats();
+    ~TaskStats();
+
+    TaskStats(const TaskStats&) = delete;
+    TaskStats& operator=(const TaskStats&) = delete;
+
+public:
+    void onProcessExited(ProcCallbackT proc) { _procExitedFunc = std::move(proc); }
+    // Start reading exits, until destroyed
+    void start();
+
+    Stats stats() const;
+
+private:
+    void receiveLoop();
+    // Handle a thread's exit, passing on its process's when it's the last
+    void processTask(const taskstats &stats);
+
+private:
+    Fd _socket;
+    std::uint16_t _familyId{};
+
+    // The stats so far of processes that have had threads exit
+    std::unordered_map<pid_t, ProcessEvent> _processes;
+
+    std::atomic<std::uint64_t> _threads{};
+    std::atomic<std::uint64_t> _exits{};
+    std::atomic<std::uint64_t> _overflows{};
+
+    std::atomic<bool> _stop{false};
+    std::thread _receiveThread;
+    ProcCallbackT _procExitedFunc=[](auto&){};
+};
@@ -0,0 +1,104 @@
+#include "tcp_health.h"
+#include <regex>
+
+namespace
+{
+    const std::pair<const char*, TcpHealth::Metric> metricNames[]{
+        {"rtt", TcpHealth::Metric::Rtt},
+        {"rttvar", TcpHealth::Metric::RttVar},
+        {"cwnd", TcpHealth::Metric::Cwnd},
+        {"retrans", TcpHealth::Metric::Retrans},
+        {"sendq", TcpHealth::Metric::SendQueue},
+        {"recvq", TcpHealth::Metric::ReceiveQueue},
+        {"sendmem", TcpHealth::Metric::SendMemory}};
+
+    bool compare(double value, const std::string &op, double operand)
+    {
+        if(op == ">") return value > operand;
+        if(op == ">=") return value >= operand;
+        if(op == "<") return value < operand;
+        if(op == "<=") return value <= operand;
+        if(op == "!=") return value != operand;
+        return value == operand;
+    }
+}
+
+namespace TcpHealth
+{
+Metric parseMetric(const std::string &name)
+{
+    for(const auto &[metricName, metric] : metricNames)
+    {
+        if(name == metricName)
+            return metric;
+    }
+
+    throw std::invalid_argument{"Unknown TCP metric: " + name +
+        " (expected rtt, rttvar, cwnd, retrans, sendq, recvq or sendmem)"};
+}
+
+double value(const PortFinder::Connection &connection, Metric metric)
+{
+    // The queues are in the diag message itself, for every TCP socket
+    if(metric == Metric::SendQueue)
+        return connection.sendQueue();
+    if(metric == Metric::ReceiveQueue)
+        return connection.receiveQueue();
+
+    const auto &tcpInfo = connection.tcpInfo();
+    if(!tcpInfo)
+        return 0;
+
+    switch(metric)
+    {
+    case Metric::Rtt:
+        return tcpInfo->rttUs / 1000.0;
+    case Metric::RttVar:
+        return tcpInfo->rttVarUs / 1000.0;
+    case Metric::Cwnd:
+        return tcpInfo->congestionWindow;
+    case Metric::Retrans:
+        return tcpInfo->retransmits;
+    case Metric::SendMemory:
+        return tcpInfo->sendQueued;
+    default:
+        return 0;
+    }
+}
+
+std::string columns(const PortFinder::Connection &connection)
+{
+    const auto &tcpInfo = connection.tcpInfo();
+    if(!tcpInfo)
+        return {};
+
+    return fmt::format("rtt={:.2f}ms rttvar={:.2f}ms cwnd={} retrans={} sendq={} recvq={} sendmem={}/{}",
+        tcpInfo->rttUs / 1000.0, tcpInfo->rttVarUs / 1000.0, tcpInfo->congestionWindow, tcpInfo->retransmits,
+        connection.sendQueue(), connection.receiveQueue(), tcpInfo->sendQueued, tcpInfo->sendBuffer);
+}
+
+Filter::Filter(const std::string &expression)
+{
+    // <metric> <op> <number>, separated by commas
+    static const std::regex conditionRegex{R"(\s*([a-z]+)\s*(>=|<=|!=|==|>|<|=)\s*([0-9]+(?:\.[0-9]*)?)\s*(,|$))"};
+
+    auto begin = expression.cbegin();
+    std::smatch match;
+    while(begin != expression.cend())
+    {
+        if(!std::regex_search(begin, expression.cend(), match, conditionRegex, std::regex_constants::match_continuous))
+            throw std::invalid_argument{"Could not parse condition: " + std::string{begin, expression.cend()}};
+
+        _conditions.push_back({parseMetric(match[1]), match[2], std::stod(match[3])});
+        begin = match[0].second;
+    }
+}
+
+bool Filter::matches(const PortFinder::Connection &connection) const
+{
+    return std::all_of(_conditions.begin(), _conditions.end(), [&](const auto &condition)
+    {
+        return compare(value(connection, condition.metric), condition.op, condition.operand);
+    });
+}
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "common.h"
+#include "port_finder.h"
+
+// TCP health metrics of -s connections (RTT, cwnd, retransmits, queues) and the
+// --sort/--where expressions over them. Everything is evaluated on what the
+// sock_diag dump already returned - no syscalls per socket.
+namespace TcpHealth
+{
+    enum class Metric
+    {
+        Rtt,
+        RttVar,
+        Cwnd,
+        Retrans,
+        SendQueue,
+        ReceiveQueue,
+        SendMemory
+    };
+
+    // Throws std::invalid_argument for an unknown name
+    Metric parseMetric(const std::string &name);
+    // RTTs are in milliseconds, queues in bytes. Connections without tcp_info
+    // (UDP and TIME_WAIT sockets) are all zeroes.
+    double value(const PortFinder::Connection &connection, Metric metric);
+    // The metrics of the connection, as columns to follow its description
+    std::string columns(const PortFinder::Connection &connection);
+
+    // A --where expression: comparisons such as "retrans>0" or "rtt>=50",
+    // joined with ',' (all of them must hold)
+    class Filter
+    {
+    public:
+        // Throws std::invalid_argument if the expression doesn't parse
+        explicit Filter(const std::string &expression);
+
+    public:
+        bool matches(const PortFinder::Connection &connection) const;
+
+    private:
+        struct Condition
+        {
+            Metric metric;
+            std::string op;
+            double operand;
+        };
+
+    private:
+        std::vector<Condition> _conditions;
+    };
+}
@@ -0,0 +1,130 @@
+#include "thread_pool.h"
+
+namespace
+{
+    // Scans are syscall bound, beyond this extra threads mostly contend in the kernel
+    const unsigned defaultMaxThreads{8};
+
+    unsigned sharedThreadCount{0};
+}
+
+ThreadPool::ThreadPool(unsigned threadCount)
+: _threadCount{std::max(threadCount, 1U)}
+, _ranges{std::make_unique<Range[]>(_threadCount)}
+{
+    // The calling thread acts as worker 0
+    for(unsigned worker = 1; worker < _threadCount; ++worker)
+        _threads.emplace_back([this, worker] { workerLoop(worker); });
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard lock{_mutex};
+        _stop = true;
+    }
+    _workAvailable.notify_all();
+
+    for(auto &thread : _threads)
+        thread.join();
+}
+
+ThreadPool &ThreadPool::shared()
+{
+    static ThreadPool pool{sharedThreadCount ? sharedThreadCount :
+        std::min(std::max(std::thread::hardware_concurrency(), 1U), defaultMaxThreads)};
+    return pool;
+}
+
+void ThreadPool::setSharedThreadCount(unsigned threadCount)
+{
+    sharedThreadCount = threadCount;
+}
+
+void ThreadPool::run(std::size_t count, const JobT &job)
+{
+    std::lock_guard runLock{_runMutex};
+
+    // Split the indexes evenly between workers
+    const std::size_t share = count / _threadCount;
+    const std::size_t remainder = count % _threadCount;
+    std::size_t begin{0};
+    for(unsigned worker = 0; worker < _threadCount; ++worker)
+    {
+        const std::size_t end = begin + share + (worker < remainder ? 1 : 0);
+        _ranges[worker].next = begin;
+        _ranges[worker].end = end;
+        begin = end;
+    }
+
+    {
+        std::lock_guard lock{_mutex};
+        _pJob = &job;
+        _busyWorkers = _threadCount - 1;
+        ++_generation;
+    }
+    _workAvailable.notify_all();
+
+    workCatching(0);
+
+    // Even if the job failed, the workers may still be in it
+    std::unique_lock lock{_mutex};
+    _workDone.wait(lock, [this] { return _busyWorkers == 0; });
+    _pJob = nullptr;
+
+    if(auto pException = std::exchange(_pException, nullptr))
+        std::rethrow_exception(pException);
+}
+
+void ThreadPool::work(unsigned worker)
+{
+    for(unsigned offset = 0; offset < _threadCount; ++offset)
+    {
+        Range &range = _ranges[(worker + offset) % _threadCount];
+        for(std::size_t index = range.next++; index < range.end; index = range.next++)
+            (*_pJob)(index, worker);
+    }
+}
+
+void ThreadPool::workCatching(unsigned worker)
+{
+    try
+    {
+        work(worker);
+    }
+    catch(...)
+    {
+        // Skip whatever indexes are left
+        for(unsigned other = 0; other < _threadCount; ++other)
+            _ranges[other].next = _ranges[other].end;
+
+        std::lock_guard lock{_mutex};
+        if(!_pException)
+            _pException = std::current_exception();
+    }
+}
+
+void ThreadPool::workerLoop(unsigned worker)
+{
+    std::uint64_t lastGeneration{0};
+
+    while(true)
+    {
+        {
+            std::unique_lock lock{_mutex};
+            _workAvailable.wait(lock, [&] { return _stop || _generation != lastGeneration; });
+            if(_stop)
+                return;
+
+            lastGeneration = _generation;
+        }
+
+        workCatching(worker);
+
+        {
+            std::lock_guard lock{_mutex};
+            --_busyWorkers;
+        }
+        _workDone.notify_one();
+    }
+}
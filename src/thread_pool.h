@@ -0,0 +1,87 @@
+#pragma once
+
+#include "common.h"
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+// A fixed set of worker threads for splitting process/socket scans.
+//
+// parallelFor() divides the index range evenly between the workers (the calling
+// thread is worker 0). A worker that finishes its own share steals indexes from
+// the shares of the others, so one slow process (say with 100k fds) doesn't
+// leave the remaining workers idle.
+class ThreadPool
+{
+    using JobT = std::function<void(std::size_t index, unsigned worker)>;
+
+public:
+    explicit ThreadPool(unsigned threadCount);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+public:
+    // The pool used by PortFinder scans
+    static ThreadPool &shared();
+    // Must be called before the first use of shared() to have any effect
+    static void setSharedThreadCount(unsigned threadCount);
+
+public:
+    unsigned threadCount() const {return _threadCount;}
+
+    // Invoke func(index, worker) for every index in [0, count), blocking until all are done.
+    // worker is in [0, threadCount()) - use it to index per-thread buffers so that
+    // workers never contend with each other. func must not itself call parallelFor().
+    // If func throws (on any worker), the remaining indexes are skipped and the first
+    // exception is rethrown here once every worker has stopped.
+    template <typename Func_T>
+    void parallelFor(std::size_t count, Func_T func)
+    {
+        run(count, JobT{std::move(func)});
+    }
+
+private:
+    // Each worker's share of the indexes. Aligned to avoid false sharing between workers.
+    struct alignas(64) Range
+    {
+        std::atomic<std::size_t> next{0};
+        std::size_t end{0};
+    };
+
+private:
+    void run(std::size_t count, const JobT &job);
+    // Work through our own range, then steal from everyone else's
+    void work(unsigned worker);
+    // As above, but an exception is kept for run() and ends the job early
+    void workCatching(unsigned worker);
+    void workerLoop(unsigned worker);
+
+private:
+    const unsigned _threadCount;
+    std::unique_ptr<Range[]> _ranges;
+
+    // Only one parallelFor() at a time
+    std::mutex _runMutex;
+
+    std::mutex _mutex;
+    std::condition_variable _workAvailable;
+    std::condition_variable _workDone;
+    const JobT *_pJob{nullptr};
+    std::uint64_t _generation{0};
+    unsigned _busyWorkers{0};
+    // The first exception thrown by the current job
+    std::exception_ptr _pException;
+    bool _stop{false};
+
+    std::vector<std::thread> _threads;
+};
+
+// A per-worker buffer for parallelFor() results, padded to its own cache line
+template <typename T>
+struct alignas(64) WorkerBuffer
+{
+    T value{};
+};
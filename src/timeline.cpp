@@ -0,0 +1,151 @@
+#include "timeline.h"
+#include <fmt/format.h>
+
+namespace
+{
+    // Spans are written in large blocks rather than a write per process
+    const std::size_t fileBufferSize{1024 * 1024};
+    // More running processes than this means exits are being missed, start again
+    const std::size_t maxRunning{65536};
+    const auto flushInterval{std::chrono::seconds{1}};
+
+    std::string escape(std::string_view value)
+    {
+        std::string result;
+        result.reserve(value.size());
+        for(const char ch : value)
+        {
+            if(ch == '"' || ch == '\\')
+            {
+                result += '\\';
+                result += ch;
+            }
+            else if(static_cast<unsigned char>(ch) < 0x20)
+                result += fmt::format("\\u{:04x}", static_cast<unsigned>(ch));
+            else
+                result += ch;
+        }
+        return result;
+    }
+
+    std::string_view basename(std::string_view path)
+    {
+        const auto slash = path.rfind('/');
+        return slash == std::string_view::npos ? path : path.substr(slash + 1);
+    }
+}
+
+std::string Timeline::Stats::toString() const
+{
+    return fmt::format("timeline: {} spans written, {} processes running", spans, running);
+}
+
+Timeline::Timeline(const std::string &path)
+: _file{::fopen(path.c_str(), "we")}
+{
+    if(_file == nullptr)
+        throw SystemError("Could not open timeline " + path);
+
+    ::setvbuf(_file, nullptr, _IOFBF, fileBufferSize);
+    ::fputs("[\n", _file);
+
+    _flushThread = std::thread{[this] { flushLoop(); }};
+}
+
+Timeline::~Timeline()
+{
+    {
+        std::lock_guard lock{_stopMutex};
+        _stop = true;
+    }
+    _stopCondition.notify_all();
+    _flushThread.join();
+
+    // The processes still running end with the last event (a trail's may be long ago)
+    for(const auto &[pid, running] : _running)
+        writeSpan(pid, running, _lastEventUs);
+
+    ::fputs("\n]\n", _file);
+}
+
+std::uint64_t Timeline::now()
+{
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+void Timeline::start(pid_t pid, pid_t ppid, std::string_view path, std::string commandLine, std::uint64_t timeUs)
+{
+    _lastEventUs = std::max(_lastEventUs, timeUs);
+
+    // Exec'ing again ends the process's previous span
+    auto it = _running.find(pid);
+    if(it != _running.end())
+    {
+        writeSpan(pid, it->second, timeUs);
+        _running.erase(it);
+    }
+
+    if(_running.size() >= maxRunning)
+        _running.clear();
+
+    Running running{ppid, timeUs, std::string{path}, std::move(commandLine), 0, 0};
+    auto parent = _running.find(ppid);
+    if(parent != _running.end())
+    {
+        running.flowId = _nextFlowId++;
+        running.parentGroup = parent->second.ppid;
+    }
+
+    _running.insert_or_assign(pid, std::move(running));
+}
+
+void Timeline::exited(pid_t pid, std::uint64_t timeUs)
+{
+    _lastEventUs = std::max(_lastEventUs, timeUs);
+
+    auto node = _running.extract(pid);
+    if(node)
+        writeSpan(pid, node.mapped(), timeUs);
+}
+
+void Timeline::writeSpan(pid_t pid, const Running &running, std::uint64_t endUs)
+{
+    const auto name = escape(basename(running.path));
+
+    // The process's track is in its parent's group, and names the group of its own children
+    writeEvent(fmt::format(R"({{"name":"thread_name","ph":"M","pid":{},"tid":{},"args":{{"name":"{} {}"}}}})",
+        running.ppid, pid, name, pid));
+    writeEvent(fmt::format(R"({{"name":"process_name","ph":"M","pid":{},"args":{{"name":"{} {}"}}}})",
+        pid, name, pid));
+    writeEvent(fmt::format(R"({{"name":"{}","cat":"process","ph":"X","ts":{},"dur":{},"pid":{},"tid":{},)"
+        R"("args":{{"pid":{},"ppid":{},"path":"{}","command":"{}"}}}})",
+        name, running.startUs, endUs > running.startUs ? endUs - running.startUs : 0, running.ppid, pid,
+        pid, running.ppid, escape(running.path), escape(running.commandLine)));
+
+    if(running.flowId)
+    {
+        writeEvent(fmt::format(R"({{"name":"spawn","cat":"process","ph":"s","id":{},"ts":{},"pid":{},"tid":{}}})",
+            running.flowId, running.startUs, running.parentGroup, running.ppid));
+        writeEvent(fmt::format(R"({{"name":"spawn","cat":"process","ph":"f","bp":"e","id":{},"ts":{},"pid":{},"tid":{}}})",
+            running.flowId, running.startUs, running.ppid, pid));
+    }
+
+    ++_spans;
+}
+
+void Timeline::writeEvent(const std::string &json)
+{
+    if(!_first)
+        ::fputs(",\n", _file);
+    _first = false;
+    ::fputs(json.c_str(), _file);
+}
+
+void Timeline::flushLoop()
+{
+    // stdio locks the file, so this is safe alongside the writes
+    std::unique_lock lock{_stopMutex};
+    while(!_stopCondition.wait_for(lock, flushInterval, [this] { return _stop; }))
+        ::fflush(_file);
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "util.h"
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <unordered_map>
+
+// Writes -e execs and exits to a Chrome trace (JSON array format) file, viewable
+// in Perfetto or chrome://tracing, to find the critical path of a build.
+//
+// Each process is a span from its exec to its exit, on a track of its own within
+// its parent's group, with a flow arrow from the parent's span to the start of
+// the child's. Only the processes still running are held in memory: a span is
+// written out when its process exits (or execs again), so recording a build of
+// millions of processes costs no more than its busiest moment. Writes are buffered
+// but flushed every second (by a thread of its own, so a quiet spell doesn't hold
+// spans back), and the closing ']' is optional in this format, so the file is
+// usable even if rumi is killed.
+class Timeline
+{
+public:
+    struct Stats
+    {
+        std::uint64_t spans{};
+        std::size_t running{};
+
+        std::string toString() const;
+    };
+
+public:
+    explicit Timeline(const std::string &path);
+    ~Timeline();
+
+    Timeline(const Timeline&) = delete;
+    Timeline& operator=(const Timeline&) = delete;
+
+public:
+    // Microseconds since the epoch, for events that don't carry their own time
+    static std::uint64_t now();
+
+    template <typename EventT>
+    void started(const EventT &event, std::uint64_t timeUs)
+    {
+        std::string commandLine;
+        for(const auto &argument : event.arguments)
+        {
+            if(!commandLine.empty())
+                commandLine += ' ';
+            commandLine += argument;
+        }
+
+        start(event.pid, event.ppid, event.path, std::move(commandLine), timeUs);
+    }
+
+    void exited(pid_t pid, std::uint64_t timeUs);
+
+    Stats stats() const {return {_spans, _running.size()};}
+
+private:
+    struct Running
+    {
+        pid_t ppid{};
+        std::uint64_t startUs{};
+        std::string path;
+        std::string commandLine;
+        // The flow from the parent's span, 0 if the parent isn't being recorded
+        std::uint64_t flowId{};
+        // The parent's own parent - the group its span is in
+        pid_t parentGroup{};
+    };
+
+private:
+    void start(pid_t pid, pid_t ppid, std::string_view path, std::string commandLine, std::uint64_t timeUs);
+    void writeSpan(pid_t pid, const Running &running, std::uint64_t endUs);
+    void writeEvent(const std::string &json);
+    void flushLoop();
+
+private:
+    AutoCloseFile _file;
+    bool _first{true};
+    std::unordered_map<pid_t, Running> _running;
+    std::uint64_t _spans{};
+    std::uint64_t _nextFlowId{1};
+    std::uint64_t _lastEventUs{};
+
+    std::mutex _stopMutex;
+    std::condition_variable _stopCondition;
+    bool _stop{false};
+    std::thread _flushThread;
+};
@@ -2,96 +2,342 @@
 
 #include "common.h"
 #include "config.h"
-#include "proc.h"
+#include "output_format.h"
+#include "port_finder.h"
+#include "process_cache.h"
+#include "process_cgroups.h"
+#if defined(RUMI_LINUX)
+#include "tcp_health.h"
+#endif
 
+// How each mode renders what it shows: a fixed layout by default, or the
+// -f/--format (or -c/--cols) template, compiled once per view.
 namespace View
 {
 namespace fs = std::filesystem;
 
+inline std::string basename(std::string_view path)
+{
+    return static_cast<std::string>(fs::path(path).filename());
+}
+
+// What a process's container and cgroup fields look up, at most once per item
+struct CgroupFields
+{
+    pid_t pid{};
+    bool live{true};
+    mutable std::optional<ProcessCgroups::Cgroup> cgroup;
+
+    const ProcessCgroups::Cgroup &lookup() const
+    {
+        if(!cgroup)
+            cgroup = live ? ProcessCgroups::shared().lookup(pid) : ProcessCgroups::Cgroup{};
+        return *cgroup;
+    }
+
+    template <typename ItemT>
+    static void addTo(std::vector<typename OutputFormat<ItemT>::Field> &table)
+    {
+        table.push_back({"container", [](const ItemT &item, std::string &output)
+        {
+            output += item.cgroups.lookup().containerId;
+        }});
+        table.push_back({"cgroup", [](const ItemT &item, std::string &output)
+        {
+            output += item.cgroups.lookup().path;
+        }});
+    }
+};
+
+// T is ProcessEvent or BsmReader::ProcessEvent
 template <typename T>
 class Exec
 {
 public:
-    Exec(const T& event, const Config& config)
-    : _event{event}
-    , _config{config}
+    // live: the events are happening now, rather than replayed from a trail, so
+    // the process and its parent can be looked up
+    explicit Exec(const Config& config, bool live = true)
+    : _config{config}
+    , _live{live}
+    , _format{config.formatString(), config.displayColumns(), fields()}
     {}
 
 public:
-    void render() const
+    void render(const T &event) const
     {
-        if(!_config.displayColumns().empty())
+        _output.clear();
+
+        if(!_format.empty())
         {
-            for(const auto &column : _config.displayColumns())
-            {
-                if(column == "pid")
-                    std::cout << _event.pid << " ";
-                else if(column == "ppid")
-                    std::cout << _event.ppid << " ";
-                else if(column == "path")
-                    std::cout << _event.path << " ";
-                else if(column == "ppath")
-                    std::cout << Proc::pidToPath(_event.ppid) << " ";
-                else if(column == "name")
-                    std::cout << basename(_event.path) << " ";
-                else if(column == "pname")
-                    std::cout << basename(Proc::pidToPath(_event.ppid)) << " ";
-                else if(column == "args")
+            _format.render({event, _live, {}, {event.pid, _live, {}}}, _output);
+        }
+        else
+        {
+            _output += fmt::format("pid: {} ppid: {} - {} ", event.pid, event.ppid,
+                _config.verbose() ? std::string{event.path} : basename(event.path));
+            appendArguments(event, _output);
+
+            // Containerised processes are tagged with their container (and cgroup, if verbose)
+            const auto cgroupColumns = _live ? ProcessCgroups::shared().columns(event.pid, _config.verbose()) : std::string{};
+            if(!cgroupColumns.empty())
+                _output += cgroupColumns.substr(1);
+        }
+
+        _output += '\n';
+        std::cout << _output << std::flush;
+    }
+
+private:
+    // The event with what its fields look up
+    struct Item
+    {
+        const T &event;
+        bool live;
+        mutable std::optional<std::string> parentPath;
+        CgroupFields cgroups;
+
+        const std::string &lookupParentPath() const
+        {
+            if(!parentPath)
+                parentPath = live ? ProcessCache::shared().path(event.ppid) : std::string{};
+            return *parentPath;
+        }
+    };
+
+    using Format = OutputFormat<Item>;
+
+    static std::span<const typename Format::Field> fields()
+    {
+        static const auto table = []
+        {
+            std::vector<typename Format::Field> table{
+                {"pid", [](const Item &item, std::string &output) {appendNumber(output, item.event.pid);}},
+                {"ppid", [](const Item &item, std::string &output) {appendNumber(output, item.event.ppid);}},
+                {"uid", [](const Item &item, std::string &output) {appendNumber(output, item.event.uid);}},
+                {"path", [](const Item &item, std::string &output) {output += item.event.path;}},
+                {"name", [](const Item &item, std::string &output) {output += basename(item.event.path);}},
+                {"ppath", [](const Item &item, std::string &output) {output += item.lookupParentPath();}},
+                {"pname", [](const Item &item, std::string &output) {output += basename(item.lookupParentPath());}},
+                {"args", [](const Item &item, std::string &output)
                 {
-                    for(size_t index = 0; const auto &arg : _event.arguments)
+                    // Skip argv[0] (program name), as for the default layout
+                    for(std::size_t index = 1; index < item.event.arguments.size(); ++index)
                     {
-                        // Skip argv[0] (program name) as we already display the path
-                        if(index != 0)
-                            std::cout << arg << " ";
-                        ++index;
+                        if(index > 1)
+                            output += ' ';
+                        output += item.event.arguments[index];
                     }
-                }
-            }
-            std::cout << std::endl;
+                }},
+            };
+            CgroupFields::addTo<Item>(table);
+            return table;
+        }();
+        return table;
+    }
+
+    static void appendArguments(const T &event, std::string &output)
+    {
+        // Skip argv[0] (program name) as we already display the path
+        for(std::size_t index = 1; index < event.arguments.size(); ++index)
+        {
+            output += event.arguments[index];
+            output += ' ';
+        }
+    }
+
+private:
+    const Config &_config;
+    bool _live;
+    Format _format;
+    // Reused for each line
+    mutable std::string _output;
+};
+
+// Captured packets, with the process they belong to - PacketT is either a
+// PacketView or a PacketRecord
+template <typename PacketT>
+class Packet
+{
+public:
+    explicit Packet(const Config &config)
+    : _format{config.formatString(), config.displayColumns(), fields()}
+    {}
+
+public:
+    // path: the process's path (or name) as it should be shown. cgroup: the
+    // process's cgroup if it's already known, e.g because the process has exited
+    void render(const PacketT &packet, const std::string &path, pid_t pid, bool verbose,
+        const std::optional<ProcessCgroups::Cgroup> &cgroup = {}) const
+    {
+        if(!_format.empty())
+        {
+            std::string output;
+            _format.render({packet, path, pid, {pid, true, cgroup}}, output);
+            output += '\n';
+            std::cout << output << std::flush;
+            return;
+        }
+
+        constexpr const char *ipv6FormatString = "{:.20} {} {}.{} > {}.{}{}\n";
+        constexpr const char *ipv4FormatString = "{:.20} {} {}:{} > {}:{}{}\n";
+
+        const auto details = cgroup ? ProcessCgroups::columns(*cgroup, verbose) : ProcessCgroups::shared().columns(pid, verbose);
+        if(packet.isIpv6())
+        {
+            fmt::print(ipv6FormatString, path, packet.transportName(), packet.sourceAddress(), packet.sourcePort(),
+                    packet.destAddress(), packet.destPort(), details);
         }
         else
         {
-            std::cout << "pid: " << _event.pid << " ppid: " << _event.ppid << " - ";
-            std::cout << (_config.verbose() ? _event.path : basename(_event.path)) << " ";
+            fmt::print(ipv4FormatString, path, packet.transportName(), packet.sourceAddress(), packet.sourcePort(),
+                    packet.destAddress(), packet.destPort(), details);
+        }
 
-            for (size_t index = 0; const auto &arg : _event.arguments)
-            {
-                // Skip argv[0] (program name) as we already display the path
-                if (index != 0)
-                    std::cout << arg << " ";
+        ::fflush(stdout);
+    }
 
-                ++index;
-            }
+private:
+    struct Item
+    {
+        const PacketT &packet;
+        const std::string &path;
+        pid_t pid;
+        CgroupFields cgroups;
+    };
+
+    using Format = OutputFormat<Item>;
+
+    static std::span<const typename Format::Field> fields()
+    {
+        static const auto table = []
+        {
+            std::vector<typename Format::Field> table{
+                {"process", [](const Item &item, std::string &output) {output += item.path;}},
+                {"pid", [](const Item &item, std::string &output) {appendNumber(output, item.pid);}},
+                {"proto", [](const Item &item, std::string &output) {output += item.packet.transportName();}},
+                {"src", [](const Item &item, std::string &output) {output += item.packet.sourceAddress();}},
+                {"sport", [](const Item &item, std::string &output) {appendNumber(output, item.packet.sourcePort());}},
+                {"dst", [](const Item &item, std::string &output) {output += item.packet.destAddress();}},
+                {"dport", [](const Item &item, std::string &output) {appendNumber(output, item.packet.destPort());}},
+            };
+            CgroupFields::addTo<Item>(table);
+            return table;
+        }();
+        return table;
+    }
+
+private:
+    Format _format;
+};
 
-            std::cout << std::endl;
+// The sockets of -s. RecordT is a ConnectionRecord for a plain scan, or a
+// Connection for --watch and --tcp-info, which also has the socket's state (and
+// on Linux its TCP health metrics).
+template <typename RecordT>
+class Socket
+{
+public:
+    explicit Socket(const Config &config)
+    : _format{config.formatString(), config.displayColumns(), fields()}
+    {}
+
+public:
+    // Append the socket's line to output. path: the process's path (or name)
+    // as it should be shown. details: what the fixed layout shows after the
+    // socket (e.g its state), before its cgroup
+    void render(const RecordT &record, const std::string &path, bool verbose, std::string &output,
+        std::string_view details = {}) const
+    {
+        if(!_format.empty())
+            _format.render({record, path, {record.pid(), true, {}}}, output);
+        else
+        {
+            if constexpr(std::is_same_v<RecordT, PortFinder::ConnectionRecord>)
+                output += record.toString(path);
+            else
+                output += PortFinder::ConnectionRecord{record}.toString(path);
+            output += details;
+            output += ProcessCgroups::shared().columns(record.pid(), verbose);
         }
+        output += '\n';
     }
 
 private:
-    std::string basename(const std::string& path) const
+    struct Item
+    {
+        const RecordT &record;
+        const std::string &path;
+        CgroupFields cgroups;
+    };
+
+    using Format = OutputFormat<Item>;
+
+    static void appendAddress(const RecordT &record, bool local, std::string &output)
     {
-        return static_cast<std::string>(fs::path(path).filename());
+        IPAddressBytes address;
+        if constexpr(std::is_same_v<RecordT, PortFinder::ConnectionRecord>)
+            address = local ? record.localAddress() : record.remoteAddress();
+        else
+            address = local ? record.localAddressBytes() : record.remoteAddressBytes();
+
+        // inet_ntop() straight from the network order bytes
+        char text[INET6_ADDRSTRLEN]{};
+        ::inet_ntop(record.isIpv4() ? AF_INET : AF_INET6, address.data(), text, sizeof(text));
+        output += text;
     }
 
-    std::string join(const std::vector<std::string> &vec) const
+#if defined(RUMI_LINUX)
+    // RTTs in milliseconds, everything else a count
+    template <TcpHealth::Metric metric>
+    static void appendMetric(const Item &item, std::string &output)
     {
-        std::stringstream str;
-        for(size_t index = 0; const auto &arg : _event.arguments)
-        {
-            // Skip argv[0] (program name) as we already display the path
-            if(index != 0)
-                str << arg;
+        const auto value = TcpHealth::value(item.record, metric);
+        if constexpr(metric == TcpHealth::Metric::Rtt || metric == TcpHealth::Metric::RttVar)
+            output += fmt::format("{:.2f}", value);
+        else
+            appendNumber(output, static_cast<std::uint64_t>(value));
+    }
+#endif
 
-            if(index != 0 && index < (_event.arguments.size() - 1))
-                str << " ";
-            ++index;
-        }
-        return str.str();
+    static std::span<const typename Format::Field> fields()
+    {
+        static const auto table = []
+        {
+            std::vector<typename Format::Field> table{
+                {"process", [](const Item &item, std::string &output) {output += item.path;}},
+                {"pid", [](const Item &item, std::string &output) {appendNumber(output, item.record.pid());}},
+                {"proto", [](const Item &item, std::string &output)
+                {
+                    output += item.record.protocol() == IPPROTO_TCP ? "TCP" : "UDP";
+                }},
+                {"laddr", [](const Item &item, std::string &output) {appendAddress(item.record, true, output);}},
+                {"lport", [](const Item &item, std::string &output) {appendNumber(output, item.record.localPort());}},
+                {"raddr", [](const Item &item, std::string &output) {appendAddress(item.record, false, output);}},
+                {"rport", [](const Item &item, std::string &output) {appendNumber(output, item.record.remotePort());}},
+            };
+            if constexpr(std::is_same_v<RecordT, PortFinder::Connection>)
+            {
+                table.push_back({"state", [](const Item &item, std::string &output) {output += item.record.stateName();}});
+#if defined(RUMI_LINUX)
+                using enum TcpHealth::Metric;
+                table.insert(table.end(), {
+                    {"rtt", &appendMetric<Rtt>},
+                    {"rttvar", &appendMetric<RttVar>},
+                    {"cwnd", &appendMetric<Cwnd>},
+                    {"retrans", &appendMetric<Retrans>},
+                    {"sendq", &appendMetric<SendQueue>},
+                    {"recvq", &appendMetric<ReceiveQueue>},
+                    {"sendmem", &appendMetric<SendMemory>}});
+#endif
+            }
+            CgroupFields::addTo<Item>(table);
+            return table;
+        }();
+        return table;
     }
 
 private:
-    T& _event;
-    const Config &_config;
+    Format _format;
 };
 
 }